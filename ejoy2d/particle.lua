@@ -8,6 +8,7 @@ local matrix = require "ejoy2d.matrix"
 local math = require "math"
 
 local particle_configs = {}
+local particle_compiled = {}
 local particle_group_configs = {}
 
 local particle = {}
@@ -72,19 +73,40 @@ function particle_meta.__index:reset()
 	end
 end
 
+-- the same seed replays the same particles
+function particle_meta.__index:seed(seed)
+	for i, v in ipairs(self.particles) do
+		c.seed(v.particle, seed + i)
+	end
+end
+
 function particle_meta.__index:is_particle_visible(particle)
 	return self.group:child_visible(particle.anchor.name)
 end
 
+-- update the particle systems on n worker threads (0 by default, update in place)
+-- c.update then returns the state of the previous update, the systems are waited for when drawn
+particle.workers = c.workers
+
+-- the global budget of the updates : particle.budget { cap = n, time = ms, lod = scale, cull = true }
+-- particle.stat() returns the counters { spawned, culled, throttled, alive, time, emit }
+particle.budget = c.budget
+particle.stat = c.stat
+
 function particle.preload(config_path)
 	particle_configs = dofile(config_path.."_particle_config.lua")
+	-- compiled once, the particle systems of a config share it
+	particle_compiled = {}
+	for name, config in pairs(particle_configs) do
+		particle_compiled[name] = c.compile(config)
+	end
 end
 
 local function new_single(name, anchor)
 	local config = rawget(particle_configs, name)
 	assert(config ~= nil, "particle not exists:"..name)
 	local texid = config.texId
-	local cobj = c.new(config)
+	local cobj = c.new(particle_compiled[name] or config)
 	anchor.visible = true
 
 	if cobj then
@@ -44,6 +44,90 @@ void main() {
 }
 ]]
 
+-- picture shader samples one of 8 textures by slot, the slot is in additive.w
+local multi_fs = [[
+varying vec2 v_texcoord;
+varying vec4 v_color;
+varying vec4 v_additive;
+varying float v_slot;
+uniform sampler2D texture0;
+uniform sampler2D texture1;
+uniform sampler2D texture2;
+uniform sampler2D texture3;
+uniform sampler2D texture4;
+uniform sampler2D texture5;
+uniform sampler2D texture6;
+uniform sampler2D texture7;
+
+vec4 sample_slot(vec2 uv) {
+	if (v_slot < 3.5) {
+		if (v_slot < 1.5) {
+			return v_slot < 0.5 ? texture2D(texture0, uv) : texture2D(texture1, uv);
+		} else {
+			return v_slot < 2.5 ? texture2D(texture2, uv) : texture2D(texture3, uv);
+		}
+	} else {
+		if (v_slot < 5.5) {
+			return v_slot < 4.5 ? texture2D(texture4, uv) : texture2D(texture5, uv);
+		} else {
+			return v_slot < 6.5 ? texture2D(texture6, uv) : texture2D(texture7, uv);
+		}
+	}
+}
+
+void main() {
+	vec4 tmp = sample_slot(v_texcoord);
+	gl_FragColor.xyz = tmp.xyz * v_color.xyz;
+	gl_FragColor.w = tmp.w;
+	gl_FragColor *= v_color.w;
+	gl_FragColor.xyz += v_additive.xyz * tmp.w;
+}
+]]
+
+local multi_vs = [[
+attribute vec4 position;
+attribute vec2 texcoord;
+attribute vec4 color;
+attribute vec4 additive;
+
+varying vec2 v_texcoord;
+varying vec4 v_color;
+varying vec4 v_additive;
+varying float v_slot;
+
+void main() {
+	gl_Position = position + vec4(-1.0,1.0,0,0);
+	v_texcoord = texcoord;
+	v_color = color;
+	v_additive = additive;
+	v_slot = additive.w * 255.0;
+}
+]]
+
+-- picture shader for instanced draw, the matrix/color/additive of each instance come from the second stream
+local instance_vs = [[
+attribute vec4 position;
+attribute vec2 texcoord;
+attribute vec4 color;
+attribute vec4 additive;
+attribute vec4 inst_m;
+attribute vec2 inst_t;
+attribute vec4 inst_color;
+attribute vec4 inst_additive;
+
+varying vec2 v_texcoord;
+varying vec4 v_color;
+varying vec4 v_additive;
+
+void main() {
+	vec2 pos = position.x * inst_m.xy + position.y * inst_m.zw + inst_t;
+	gl_Position = vec4(pos.x - 1.0, pos.y + 1.0, 0, 1.0);
+	v_texcoord = texcoord;
+	v_color = color * inst_color;
+	v_additive = additive + inst_additive;
+}
+]]
+
 local gui_text_vs = [[
 attribute vec4 position;
 attribute vec2 texcoord;
@@ -138,6 +222,46 @@ local text_edge_fs = {
 	]],
 }
 
+-- signed distance field glyph, 0.5 is the edge and 1 pixel of FONT_SIZE is 1/8
+local text_sdf_fs = [[
+varying vec2 v_texcoord;
+varying vec4 v_color;
+varying vec4 v_additive;
+
+uniform sampler2D texture0;
+
+void main() {
+	float d = texture2D(texture0, v_texcoord).CHANNEL;
+	float alpha = smoothstep(0.44, 0.56, d);
+
+	gl_FragColor.xyz = (v_color.xyz + v_additive.xyz) * alpha;
+	gl_FragColor.w = alpha;
+	gl_FragColor *= v_color.w;
+}
+]]
+
+local text_sdf_edge_fs = [[
+varying vec2 v_texcoord;
+varying vec4 v_color;
+varying vec4 v_additive;
+
+uniform sampler2D texture0;
+
+void main() {
+	float d = texture2D(texture0, v_texcoord).CHANNEL;
+	float alpha = smoothstep(0.29, 0.41, d);
+	float color = smoothstep(0.44, 0.56, d);
+
+	gl_FragColor.xyz = (v_color.xyz + v_additive.xyz) * color;
+	gl_FragColor.w = alpha;
+	gl_FragColor *= v_color.w;
+}
+]]
+
+-- A8 texture is GL_ALPHA in ES2, and GL_RED in ES3
+local TEXT_CHANNEL = OPENGLES_VERSION == 3 and "r" or "w"
+text_sdf_fs = text_sdf_fs:gsub("CHANNEL", TEXT_CHANNEL)
+text_sdf_edge_fs = text_sdf_edge_fs:gsub("CHANNEL", TEXT_CHANNEL)
 
 local gray_fs = [[
 varying vec2 v_texcoord;
@@ -264,10 +388,12 @@ local shader_name = {
 	GRAY = 6,
 	COLOR = 7,
 	BLEND = 8,
+	PICTURE_MULTI = 9,
+	PICTURE_INSTANCE = 10,
 }
 -- user defined shader (or replace default shader)
-local MAX_PROGRAM = 16
-local USER_PROGRAM = 9
+local MAX_PROGRAM = 18
+local USER_PROGRAM = 11
 
 local uniform_format = {
 	float = 1,
@@ -284,6 +410,10 @@ shader.draw = s.draw
 shader.blend = s.blend
 shader.clear = s.clear
 shader.texture = s.shader_texture
+shader.deferred = s.deferred
+shader.multitexture = s.multitexture
+shader.stat = s.stat
+shader.batch = s.batch
 
 function shader.id(name)
 	local id = assert(shader_name[name] , "Invalid shader name " .. name)
@@ -340,22 +470,53 @@ local function create_text_material(id)
 	return setmetatable(mat, meta)
 end
 
+local function load_text(sdf)
+	local fs, edge_fs
+	if sdf then
+		fs = text_sdf_fs
+		edge_fs = text_sdf_edge_fs
+	else
+		fs = text_fs[OPENGLES_VERSION] or text_fs[2]
+		edge_fs = text_edge_fs[OPENGLES_VERSION] or text_edge_fs[2]
+	end
+	s.load(shader_name.TEXT, PRECISION .. fs, PRECISION .. sprite_vs)
+	s.load(shader_name.EDGE, PRECISION .. edge_fs, PRECISION .. sprite_vs)
+	s.load(shader_name.GUI_TEXT, PRECISION .. fs, PRECISION .. gui_text_vs)
+	s.load(shader_name.GUI_EDGE, PRECISION .. edge_fs, PRECISION .. gui_text_vs)
+
+	shader.gui_text_material = create_text_material(shader_name.GUI_TEXT)
+	shader.gui_edge_material = create_text_material(shader_name.GUI_EDGE)
+	shader.gui_text_material:inv_pmv(1.0,0,0,0,  0,1.0,0,0, 0,0,1.0,0, 0,0,0,1.0)
+	shader.gui_edge_material:inv_pmv(1.0,0,0,0,  0,1.0,0,0, 0,0,1.0,0, 0,0,0,1.0)
+end
+
 function shader.init()
 	s.load(shader_name.NORMAL, PRECISION .. sprite_fs, PRECISION .. sprite_vs)
-	s.load(shader_name.TEXT, PRECISION .. (text_fs[OPENGLES_VERSION] or text_fs[2]), PRECISION .. sprite_vs)
-	s.load(shader_name.EDGE, PRECISION .. (text_edge_fs[OPENGLES_VERSION] or text_edge_fs[2]), PRECISION .. sprite_vs)
-	s.load(shader_name.GUI_TEXT, PRECISION .. (text_fs[OPENGLES_VERSION] or text_fs[2]), PRECISION .. gui_text_vs)
-	s.load(shader_name.GUI_EDGE, PRECISION .. (text_edge_fs[OPENGLES_VERSION] or text_edge_fs[2]), PRECISION .. gui_text_vs)
 	s.load(shader_name.GRAY, PRECISION .. gray_fs, PRECISION .. sprite_vs)
 	s.load(shader_name.COLOR, PRECISION .. color_fs, PRECISION .. sprite_vs)
 	s.load(shader_name.BLEND, PRECISION .. blend_fs, PRECISION .. blend_vs)
+	s.load(shader_name.PICTURE_MULTI, PRECISION .. multi_fs, PRECISION .. multi_vs,
+		{ "texture0", "texture1", "texture2", "texture3", "texture4", "texture5", "texture6", "texture7" })
+	s.load(shader_name.PICTURE_INSTANCE, PRECISION .. sprite_fs, PRECISION_HIGH .. instance_vs)
 	s.load(shader_name.RENDERBUFFER, PRECISION .. renderbuffer_fs, PRECISION_HIGH .. renderbuffer_vs)
 	s.uniform_bind(shader_name.RENDERBUFFER, { { name = "st", type = uniform_format.float4} })	-- st must the first uniform (the type is float4/4)
-	
-	shader.gui_text_material = create_text_material(shader_name.GUI_TEXT)
-	shader.gui_edge_material = create_text_material(shader_name.GUI_EDGE)
-	shader.gui_text_material:inv_pmv(1.0,0,0,0,  0,1.0,0,0, 0,0,1.0,0, 0,0,0,1.0)
-	shader.gui_edge_material:inv_pmv(1.0,0,0,0,  0,1.0,0,0, 0,0,1.0,0, 0,0,0,1.0)
+	load_text(false)
+end
+
+-- switch the glyph atlas to signed distance field (or back), and load the matching text shaders
+function shader.text_sdf(enable)
+	s.text_sdf(enable)
+	load_text(enable)
+end
+
+-- rasterize new glyphs in a worker thread, and upload at most budget bytes per frame. 0 or nil to turn off
+function shader.text_async(budget)
+	s.text_async(budget)
+end
+
+-- glyph atlas pages (1024x1024 A8) are added when needed, up to budget bytes. 4M by default
+function shader.text_atlas(budget)
+	s.text_atlas(budget)
 end
 
 function shader.define( arg )
@@ -205,4 +205,13 @@ function sprite.drawtext(txt,x,y,w,size,color,edge,align)
 	drawtext(mat, txt, x, y, w, size, color, edge, align)
 end
 
+-- rasterize the glyphs of a string (or a table of strings) before they are drawn, as on a loading screen.
+-- it returns the number of glyphs not ready yet, with shader.text_async they are ready in later frames
+sprite.prewarm = c.prewarm
+
+-- skip the sprites out of screen, enabled by default
+sprite.enable_visible_test = c.enable_visible_test
+-- return the total number of sprites tested and culled
+sprite.visible_stat = c.visible_stat
+
 return sprite
@@ -0,0 +1,65 @@
+-- Interleave sprites and text in a grid of cells that don't overlap, and count the batches.
+-- Run it headless : ./ej2d -frames 10 examples/deferredbench.lua
+-- In immediate mode every cell switches texture twice; the deferred queue (on by default, set DEFERRED=0
+-- to turn it off) merges the sprites and the text into a few batches, "batch saved" counts the rest.
+
+local ej = require "ejoy2d"
+local fw = require "ejoy2d.framework"
+local pack = require "ejoy2d.simplepackage"
+local sprite = require "ejoy2d.sprite"
+local shader = require "ejoy2d.shader"
+
+pack.load {
+	pattern = fw.WorkDir..[[examples/asset/?]],
+	"sample",
+}
+
+local deferred = os.getenv "DEFERRED" ~= "0"
+shader.deferred(deferred)
+
+local COLS, ROWS = 8, 6
+local W, H = 120, 120
+
+local cells = {}
+for y = 0, ROWS-1 do
+	for x = 0, COLS-1 do
+		local obj = ej.sprite("sample","mine")
+		obj:ps(x * W + 40, y * H + 40, 0.3)
+		table.insert(cells, { obj = obj, x = x * W + 10, y = y * H + 80, text = tostring(#cells + 1) })
+	end
+end
+
+local game = {}
+local frame = 0
+
+function game.update()
+	for _, c in ipairs(cells) do
+		c.obj.frame = c.obj.frame + 1
+	end
+end
+
+function game.drawframe()
+	ej.clear(0xff808080)
+	for _, c in ipairs(cells) do
+		c.obj:draw()
+		sprite.drawtext(c.text, c.x, c.y, 60, 16, 0xffffffff)
+	end
+	frame = frame + 1
+end
+
+function game.touch(what, x, y)
+end
+
+function game.message(...)
+end
+
+function game.handle_error(...)
+end
+
+function game.on_resume()
+end
+
+function game.on_pause()
+end
+
+ej.start(game)
@@ -0,0 +1,121 @@
+-- Replay a multi-language chat stream into a dynamic font texture, and report the cache stats.
+-- Run it headless : ./ej2d -frames 1 examples/dfontbench.lua
+-- Each frame shows the last LINES messages in several font sizes, then flushes the dfont.
+
+local ej = require "ejoy2d"
+local sprite = require "ejoy2d.sprite"
+
+local FRAMES = 3000
+local LINES = 12
+local SIZE = tonumber(os.getenv "SIZE" or "1024")
+local TEXTURE_A8 = 5
+local TEXTURE_ID = 500
+
+-- code point ranges, width of a glyph in 1/10 of the size
+local scripts = {
+	{ name = "latin", from = 0x61, n = 26, w = 6, weight = 4 },
+	{ name = "cyrillic", from = 0x430, n = 32, w = 6, weight = 1 },
+	{ name = "greek", from = 0x3b1, n = 25, w = 6, weight = 1 },
+	{ name = "kana", from = 0x3041, n = 86, w = 10, weight = 1 },
+	{ name = "hangul", from = 0xac00, n = 2000, w = 10, weight = 1 },
+	{ name = "cjk", from = 0x4e00, n = 3500, w = 10, weight = 3 },
+}
+local sizes = { 14, 18, 24, 32, 48 }
+
+math.randomseed(1)
+
+local total_weight = 0
+for _, s in ipairs(scripts) do
+	total_weight = total_weight + s.weight
+end
+
+local function pick_script()
+	local r = math.random(total_weight)
+	for _, s in ipairs(scripts) do
+		r = r - s.weight
+		if r <= 0 then
+			return s
+		end
+	end
+end
+
+-- a few chars are common, most are rare
+local function message()
+	local s = pick_script()
+	local size = sizes[math.random(#sizes)]
+	local m = { size = size, w = s.w }
+	for i = 1, math.random(8, 30) do
+		m[i] = s.from + math.floor(s.n ^ math.random()) - 1
+	end
+	return m
+end
+
+local df = sprite.dfont(SIZE, SIZE, TEXTURE_A8, TEXTURE_ID)
+local history = {}
+
+local lookup, insert, fail = 0, 0, 0
+
+local function draw(m)
+	local size = m.size
+	local w = size * m.w // 10 + 1
+	for i = 1, #m do
+		local c = m[i]
+		lookup = lookup + 1
+		if not df:lookup(c, size) then
+			insert = insert + 1
+			if not df:insert(c, size, w, size + 1) then
+				fail = fail + 1
+			end
+		end
+	end
+end
+
+local game = {}
+local done = false
+
+function game.update()
+end
+
+function game.drawframe()
+	ej.clear(0xff808080)
+	if done then
+		return
+	end
+	done = true
+	local t = os.clock()
+	for f = 1, FRAMES do
+		table.insert(history, message())
+		if #history > LINES then
+			table.remove(history, 1)
+		end
+		for _, m in ipairs(history) do
+			draw(m)
+		end
+		df:flush()
+	end
+	t = os.clock() - t
+	local stat = df:stat()
+	print(string.format("%d frames in %.3f s, %d lookups, hit %.1f%%, %d inserts, %d failed",
+		FRAMES, t, lookup, (lookup - insert) * 100 / lookup, insert, fail))
+	print(string.format("evict %d (%.1f%% of inserts), %d chars, occupancy %.1f%%, fragmentation %.1f%%",
+		stat.evict, stat.evict * 100 / stat.insert, stat.chars,
+		stat.area * 100 / (SIZE * SIZE), stat.shelf > 0 and (stat.shelf - stat.area) * 100 / stat.shelf or 0))
+end
+
+function game.touch(what, x, y)
+end
+
+function game.message(...)
+end
+
+function game.handle_error(...)
+	print(...)
+end
+
+function game.on_resume()
+end
+
+function game.on_pause()
+end
+
+ej.start(game)
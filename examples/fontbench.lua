@@ -0,0 +1,52 @@
+-- Rasterize 5000 distinct glyphs (CJK from U+4E00 by default) in the first frame, and report glyphs/sec.
+-- Run it headless : ./ej2d -frames 1 examples/fontbench.lua
+-- Set FROM (eg. FROM=0x100) to start from another code point, if your font has no CJK glyph.
+
+local ej = require "ejoy2d"
+local sprite = require "ejoy2d.sprite"
+
+local N = 5000
+local from = tonumber(os.getenv "FROM" or "0x4e00")
+
+local chars = {}
+for i = 0, N-1 do
+	chars[i+1] = utf8.char(from + i)
+end
+
+local game = {}
+local done = false
+
+function game.update()
+end
+
+function game.drawframe()
+	ej.clear(0xff808080)
+	if done then
+		return
+	end
+	done = true
+	local t = os.clock()
+	-- 50 glyphs per line, each glyph is rasterized once
+	for i = 1, N, 50 do
+		sprite.drawtext(table.concat(chars, "", i, math.min(i+49, N)), 0, 0, 2000, 24, 0xffffffff)
+	end
+	t = os.clock() - t
+	print(string.format("%d glyphs in %.3f s, %.0f glyphs/sec", N, t, N / t))
+end
+
+function game.touch(what, x, y)
+end
+
+function game.message(...)
+end
+
+function game.handle_error(...)
+end
+
+function game.on_resume()
+end
+
+function game.on_pause()
+end
+
+ej.start(game)
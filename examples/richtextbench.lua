@@ -0,0 +1,70 @@
+-- Rebuild the glyph quads of a 2000 chars label with 300 color fields, and report the cost of each rebuild.
+-- Run it headless : ./ej2d -frames 1 examples/richtextbench.lua
+
+local ej = require "ejoy2d"
+local sprite = require "ejoy2d.sprite"
+
+local CHARS = 2000
+local FIELDS = 300
+local N = 200
+
+local words = { "hello", "world", "chat", "log", "ejoy2d", "label", "color" }
+local colors = { "#[red]", "#[green]", "#[blue]", "#[yellow]" }
+
+local t = {}
+local len = 0
+local step = CHARS // FIELDS
+local i = 0
+while len < CHARS do
+	if len >= i * step and i < FIELDS then
+		i = i + 1
+		t[#t+1] = colors[i % #colors + 1]
+	end
+	local w = words[#t % #words + 1] .. " "
+	t[#t+1] = w
+	len = len + #w
+end
+
+local label = sprite.label { width = 600, height = 24, size = 16 }
+label.text = table.concat(t)
+
+local game = {}
+local done = false
+
+function game.update()
+end
+
+function game.drawframe()
+	ej.clear(0xff808080)
+	if done then
+		return
+	end
+	done = true
+	-- rasterize the glyphs first
+	label:draw()
+	local t = os.clock()
+	for i = 1, N do
+		-- a new auto_scale invalidates the cached quads
+		label.auto_scale = i % 2 == 0
+		label:draw()
+	end
+	t = os.clock() - t
+	print(string.format("%d rebuilds in %.3f s, %.3f ms each", N, t, t * 1000 / N))
+end
+
+function game.touch(what, x, y)
+end
+
+function game.message(...)
+end
+
+function game.handle_error(...)
+end
+
+function game.on_resume()
+end
+
+function game.on_pause()
+end
+
+ej.start(game)
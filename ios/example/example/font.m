@@ -1,5 +1,6 @@
 #import <UIKit/UIKit.h>
 #include "label.h"
+#include "bitmap.h"
 #include <stdio.h>
 #include <stdint.h>
 #include <assert.h>
@@ -77,18 +78,7 @@ _font_glyph_gray(NSString* str, void* buffer, struct font_context* ctx){
 
 static void
 convert_rgba_to_alpha(int sz, uint32_t * src, uint8_t *dest) {
-	int i;
-	for (i=0;i<sz;i++) {
-		uint8_t alpha = (src[i]>>24) & 0xff;
-		uint8_t color = (src[i] >> 8) & 0xff;
-		if (alpha == 0xff) {
-//			dest[i] = color / 2 + 128;
-      dest[i]=255;
-		} else {
-			dest[i] = alpha / 2;
-		}
-    //dest[i] = alpha;
-	}
+	bitmap_alpha(dest, src, sz);
 }
 
 static void
@@ -0,0 +1,269 @@
+#ifndef ejoy2d_bitmap_h
+#define ejoy2d_bitmap_h
+
+// Kernels for 8bit glyph bitmaps, 16 pixels at a time with SSE2 or NEON.
+// Define BITMAP_SCALAR to use the plain C loops only.
+
+#include <stdint.h>
+#include <string.h>
+
+#if !defined(BITMAP_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define BITMAP_SSE2
+#include <emmintrin.h>
+#elif !defined(BITMAP_SCALAR) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define BITMAP_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(BITMAP_SSE2)
+
+#define BITMAP_SIMD
+typedef __m128i bitmap_v;
+
+#define bv_load(p) _mm_loadu_si128((const __m128i *)(p))
+#define bv_store(p, v) _mm_storeu_si128((__m128i *)(p), (v))
+#define bv_max(a, b) _mm_max_epu8((a), (b))
+
+// (n1 * 3 + n2) / 8
+static inline bitmap_v
+bv_edge_(bitmap_v n1, bitmap_v n2) {
+	__m128i z = _mm_setzero_si128();
+	__m128i lo = _mm_unpacklo_epi8(n1, z);
+	__m128i hi = _mm_unpackhi_epi8(n1, z);
+	lo = _mm_add_epi16(_mm_add_epi16(lo, _mm_add_epi16(lo, lo)), _mm_unpacklo_epi8(n2, z));
+	hi = _mm_add_epi16(_mm_add_epi16(hi, _mm_add_epi16(hi, hi)), _mm_unpackhi_epi8(n2, z));
+	return _mm_packus_epi16(_mm_srli_epi16(lo, 3), _mm_srli_epi16(hi, 3));
+}
+
+// c / 2 + 128 where c != 0, else e
+static inline bitmap_v
+bv_inside_(bitmap_v c, bitmap_v e) {
+	__m128i inside = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(c, 1), _mm_set1_epi8(0x7f)), _mm_set1_epi8((char)0x80));
+	__m128i zero = _mm_cmpeq_epi8(c, _mm_setzero_si128());
+	return _mm_or_si128(_mm_and_si128(zero, e), _mm_andnot_si128(zero, inside));
+}
+
+// g * 255 / 64
+static inline bitmap_v
+bv_gray64_(bitmap_v g) {
+	__m128i z = _mm_setzero_si128();
+	__m128i lo = _mm_unpacklo_epi8(g, z);
+	__m128i hi = _mm_unpackhi_epi8(g, z);
+	lo = _mm_srli_epi16(_mm_sub_epi16(_mm_slli_epi16(lo, 8), lo), 6);
+	hi = _mm_srli_epi16(_mm_sub_epi16(_mm_slli_epi16(hi, 8), hi), 6);
+	return _mm_packus_epi16(lo, hi);
+}
+
+// alpha of 16 RGBA pixels : 255 if opaque, else alpha / 2
+static inline bitmap_v
+bv_alpha_(const uint32_t *src) {
+	__m128i a0 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)src), 24);
+	__m128i a1 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src+4)), 24);
+	__m128i a2 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src+8)), 24);
+	__m128i a3 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src+12)), 24);
+	__m128i a = _mm_packus_epi16(_mm_packs_epi32(a0, a1), _mm_packs_epi32(a2, a3));
+	__m128i opaque = _mm_cmpeq_epi8(a, _mm_set1_epi8((char)0xff));
+	return _mm_or_si128(opaque, _mm_and_si128(_mm_srli_epi16(a, 1), _mm_set1_epi8(0x7f)));
+}
+
+#elif defined(BITMAP_NEON)
+
+#define BITMAP_SIMD
+typedef uint8x16_t bitmap_v;
+
+#define bv_load(p) vld1q_u8((const uint8_t *)(p))
+#define bv_store(p, v) vst1q_u8((uint8_t *)(p), (v))
+#define bv_max(a, b) vmaxq_u8((a), (b))
+
+static inline bitmap_v
+bv_edge_(bitmap_v n1, bitmap_v n2) {
+	uint16x8_t lo = vmlal_u8(vmovl_u8(vget_low_u8(n2)), vget_low_u8(n1), vdup_n_u8(3));
+	uint16x8_t hi = vmlal_u8(vmovl_u8(vget_high_u8(n2)), vget_high_u8(n1), vdup_n_u8(3));
+	return vcombine_u8(vshrn_n_u16(lo, 3), vshrn_n_u16(hi, 3));
+}
+
+static inline bitmap_v
+bv_inside_(bitmap_v c, bitmap_v e) {
+	uint8x16_t inside = vorrq_u8(vshrq_n_u8(c, 1), vdupq_n_u8(0x80));
+	return vbslq_u8(vceqq_u8(c, vdupq_n_u8(0)), e, inside);
+}
+
+static inline bitmap_v
+bv_gray64_(bitmap_v g) {
+	uint16x8_t lo = vmull_u8(vget_low_u8(g), vdup_n_u8(255));
+	uint16x8_t hi = vmull_u8(vget_high_u8(g), vdup_n_u8(255));
+	return vcombine_u8(vqshrn_n_u16(lo, 6), vqshrn_n_u16(hi, 6));
+}
+
+static inline bitmap_v
+bv_alpha_(const uint32_t *src) {
+	uint8x16_t a = vld4q_u8((const uint8_t *)src).val[3];
+	uint8x16_t opaque = vceqq_u8(a, vdupq_n_u8(0xff));
+	return vorrq_u8(opaque, vshrq_n_u8(a, 1));
+}
+
+#endif
+
+static inline int
+bitmap_max4_(int a, int b, int c, int d) {
+	a = a>b ? a : b;
+	a = a>c ? a : c;
+	a = a>d ? a : d;
+	return a;
+}
+
+// outline of pixel j, the neighbours out of the bitmap are the pixel itself
+static inline uint8_t
+bitmap_outline1_(const uint8_t *prev, const uint8_t *line, const uint8_t *next, int j, int w) {
+	int left = j == 0 ? 0 : 1;
+	int right = j == w-1 ? 0 : 1;
+	int n1 = bitmap_max4_(line[j-left],line[j+right],prev[j],next[j]);
+	int n2 = bitmap_max4_(prev[j-left],prev[j+right],next[j-left],next[j+right]);
+	int edge = (n1*3 + n2) / 4;
+	if (line[j] == 0) {
+		return edge / 2;
+	} else {
+		return line[j]/2 + 128;
+	}
+}
+
+#ifdef BITMAP_SIMD
+
+// a line of a narrow bitmap (w <= 32) with its border pixels on both sides, as the neighbours out of the bitmap
+static inline void
+bitmap_pad_(uint8_t *pad, const uint8_t *line, int w) {
+	pad[0] = line[0];
+	memcpy(pad+1, line, w);
+	pad[w+1] = line[w-1];
+}
+
+// the outline of the padded lines, in one or two vectors
+static inline void
+bitmap_outline_narrow_(int w, int h, const uint8_t *src, uint8_t *dest) {
+	uint8_t pad[3][48];
+	uint8_t out[32];
+	int i,j;
+	memset(pad, 0, sizeof(pad));
+	bitmap_pad_(pad[0], src, w);
+	if (h > 1) {
+		bitmap_pad_(pad[1], src+w, w);
+	}
+	for (i=0;i<h;i++) {
+		const uint8_t * line = pad[i%3];
+		const uint8_t * prev = i==0 ? line : pad[(i+2)%3];
+		const uint8_t * next = i==h-1 ? line : pad[(i+1)%3];
+		for (j=0;j<w;j+=16) {
+			bitmap_v n1 = bv_max(bv_max(bv_load(line+j), bv_load(line+j+2)), bv_max(bv_load(prev+j+1), bv_load(next+j+1)));
+			bitmap_v n2 = bv_max(bv_max(bv_load(prev+j), bv_load(prev+j+2)), bv_max(bv_load(next+j), bv_load(next+j+2)));
+			bv_store(out+j, bv_inside_(bv_load(line+j+1), bv_edge_(n1, n2)));
+		}
+		uint8_t * output = dest + i*w;
+		memcpy(output, out, w);
+		if (output[0] > 128) {
+			output[0]/=2;
+		}
+		if (output[w-1] > 128) {
+			output[w-1]/=2;
+		}
+		if (i+2 < h) {
+			// the slot of line i-1 isn't used any more
+			bitmap_pad_(pad[(i+2)%3], src+(i+2)*w, w);
+		}
+	}
+}
+
+#endif
+
+// Glyph with an edge : the glyph goes to 128-255, and its neighbourhood to 0-127.
+// src and dest are w*h, and don't overlap.
+static inline void
+bitmap_outline(int w, int h, const uint8_t *src, uint8_t *dest) {
+	int i,j;
+#ifdef BITMAP_SIMD
+	if (w < 18) {
+		bitmap_outline_narrow_(w, h, src, dest);
+		return;
+	}
+#endif
+	for (i=0;i<h;i++) {
+		uint8_t * output = dest + i*w;
+		const uint8_t * line = src + i*w;
+		const uint8_t * prev = i==0 ? line : line-w;
+		const uint8_t * next = i==h-1 ? line : line+w;
+#ifdef BITMAP_SIMD
+		if (w >= 18) {
+			output[0] = bitmap_outline1_(prev, line, next, 0, w);
+			// the last 16 overlap the ones before
+			for (j=1;j<w-1;j+=16) {
+				if (j+16 > w-1) {
+					j = w-1-16;
+				}
+				bitmap_v n1 = bv_max(bv_max(bv_load(line+j-1), bv_load(line+j+1)), bv_max(bv_load(prev+j), bv_load(next+j)));
+				bitmap_v n2 = bv_max(bv_max(bv_load(prev+j-1), bv_load(prev+j+1)), bv_max(bv_load(next+j-1), bv_load(next+j+1)));
+				bv_store(output+j, bv_inside_(bv_load(line+j), bv_edge_(n1, n2)));
+			}
+			output[w-1] = bitmap_outline1_(prev, line, next, w-1, w);
+		} else
+#endif
+		for (j=0;j<w;j++) {
+			output[j] = bitmap_outline1_(prev, line, next, j, w);
+		}
+		if (output[0] > 128) {
+			output[0]/=2;
+		}
+		if (output[w-1] > 128) {
+			output[w-1]/=2;
+		}
+	}
+}
+
+// copy w*h pixels, memcpy is already vectorized
+static inline void
+bitmap_copy(uint8_t *dest, int dest_pitch, const uint8_t *src, int src_pitch, int w, int h) {
+	int i;
+	for (i=0;i<h;i++) {
+		memcpy(dest, src, w);
+		src += src_pitch;
+		dest += dest_pitch;
+	}
+}
+
+// 65 levels of gray (GGO_GRAY8_BITMAP) to 0-255
+static inline void
+bitmap_gray64(uint8_t *dest, int dest_pitch, const uint8_t *src, int src_pitch, int w, int h) {
+	int i,j;
+	for (i=0;i<h;i++) {
+#ifdef BITMAP_SIMD
+		if (w >= 16) {
+			for (j=0;j<w;j+=16) {
+				if (j+16 > w) {
+					j = w-16;
+				}
+				bv_store(dest+j, bv_gray64_(bv_load(src+j)));
+			}
+		} else
+#endif
+		for (j=0;j<w;j++) {
+			dest[j] = src[j] * 255 / 64;
+		}
+		src += src_pitch;
+		dest += dest_pitch;
+	}
+}
+
+// alpha of n RGBA pixels : 255 if opaque, else alpha / 2
+static inline void
+bitmap_alpha(uint8_t *dest, const uint32_t *src, int n) {
+	int i = 0;
+#ifdef BITMAP_SIMD
+	for (;i+16<=n;i+=16) {
+		bv_store(dest+i, bv_alpha_(src+i));
+	}
+#endif
+	for (;i<n;i++) {
+		uint8_t alpha = (src[i]>>24) & 0xff;
+		dest[i] = alpha == 0xff ? 255 : alpha / 2;
+	}
+}
+
+#endif
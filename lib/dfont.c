@@ -5,6 +5,8 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <assert.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 #define HASH_SIZE 4096
 #define TINY_FONT 12
@@ -21,19 +23,34 @@ struct hash_rect {
 	struct dfont_rect rect;
 };
 
+// A shelf of chars, or a free band of the texture when it's not used.
+// A char goes in a shelf as high as it, or a bit higher.
+// The pages are stacked by y, and a shelf never crosses a page.
 struct font_line {
 	int start_line;
 	int height;
-	int space;
-	struct list_head head;
+	int space;	// no gap in the shelf is wider
+	bool used;
+	struct list_head head;	// chars by x
+	struct list_head next;	// shelves and bands by y, or the spare ones
 };
 
 struct dfont {
 	int width;
-	int height;
+	int height;	// of a page
+	int page;
+	int max_page;
 	int max_line;
 	int version;
+	int chars;
+	int area;
+	int shelf;
+	int insert;
+	int evict;
+	int fail;
 	struct list_head time;
+	struct list_head lines;
+	struct list_head spare;
 	struct hash_rect *freelist;
 	struct font_line *line;
 	struct hash_rect *hash[HASH_SIZE];
@@ -66,38 +83,77 @@ hash(int c, int font, int edge) {
 }
 #endif
 
+// a free band may be left between two shelves
+static inline int
+max_line(int height, int page) {
+	return (height / TINY_FONT * 2 + 1) * page;
+}
+
+static inline int
+max_char(int width, int height, int page) {
+	return height / TINY_FONT * width / TINY_FONT * page;
+}
+
 size_t
-dfont_data_size(int width, int height) {
-	int max_line = height / TINY_FONT;
-	int max_char = max_line * width / TINY_FONT;
-	size_t ssize = max_char * sizeof(struct hash_rect);
-	size_t lsize = max_line * sizeof(struct font_line);
+dfont_data_size(int width, int height, int page) {
+	size_t ssize = max_char(width, height, page) * sizeof(struct hash_rect);
+	size_t lsize = max_line(height, page) * sizeof(struct font_line);
 	return sizeof(struct dfont) + ssize + lsize;
 }
 
+// the new page is a free band
+static bool
+add_page(struct dfont *df) {
+	if (list_empty(&df->spare))
+		return false;
+	struct font_line *band = list_entry(df->spare.next, struct font_line, next);
+	list_move_tail(&band->next, &df->lines);
+	band->start_line = df->page * df->height;
+	band->height = df->height;
+	band->space = 0;
+	band->used = false;
+	INIT_LIST_HEAD(&band->head);
+	++df->page;
+	return true;
+}
+
 void
-dfont_init(void* d, int width, int height) {
-	int max_line = height / TINY_FONT;
-	int max_char = max_line * width / TINY_FONT;
-	size_t ssize = max_char * sizeof(struct hash_rect);
+dfont_init(void* d, int width, int height, int page) {
+	int max = max_char(width, height, page);
+	size_t ssize = max * sizeof(struct hash_rect);
 	
 	struct dfont *df = (struct dfont*)d;
 	
 	df->width = width;
 	df->height = height;
-	df->max_line = 0;
+	df->page = 0;
+	df->max_page = page;
+	df->max_line = max_line(height, page);
 	df->version = 0;
+	df->chars = 0;
+	df->area = 0;
+	df->shelf = 0;
+	df->insert = 0;
+	df->evict = 0;
+	df->fail = 0;
 	INIT_LIST_HEAD(&df->time);
+	INIT_LIST_HEAD(&df->lines);
+	INIT_LIST_HEAD(&df->spare);
 	df->freelist = (struct hash_rect *)(df+1);
 	df->line = (struct font_line *)((intptr_t)df->freelist + ssize);
-	init_hash(df, max_char);
+	int i;
+	for (i=0;i<df->max_line;i++) {
+		list_add_tail(&df->line[i].next, &df->spare);
+	}
+	add_page(df);
+	init_hash(df, max);
 }
 
 struct dfont *
-dfont_create(int width, int height) {
-	size_t size = dfont_data_size(width, height);
+dfont_create(int width, int height, int page) {
+	size_t size = dfont_data_size(width, height, page);
 	void *df = malloc(size);
-	dfont_init(df, width, height);
+	dfont_init(df, width, height, page);
 	
 	return (struct dfont*)df;
 }
@@ -126,6 +182,29 @@ dfont_remove(struct dfont *df, int c, int font, int edge) {
 	}
 }
 
+void
+dfont_touch(struct dfont *df, const struct dfont_rect *rect) {
+	struct hash_rect *hr = (struct hash_rect *)((char *)rect - offsetof(struct hash_rect, rect));
+	list_move_tail(&hr->time, &df->time);
+	hr->version = df->version;
+}
+
+int
+dfont_evict(struct dfont *df) {
+	return df->evict;
+}
+
+void
+dfont_stat(struct dfont *df, struct dfont_stat *stat) {
+	stat->chars = df->chars;
+	stat->area = df->area;
+	stat->shelf = df->shelf;
+	stat->insert = df->insert;
+	stat->evict = df->evict;
+	stat->fail = df->fail;
+	stat->page = df->page;
+}
+
 const struct dfont_rect * 
 dfont_lookup(struct dfont *df, int c, int font, int edge) {
 	int h = hash(c, font, edge);
@@ -141,38 +220,85 @@ dfont_lookup(struct dfont *df, int c, int font, int edge) {
 	return NULL;
 }
 
+static inline bool
+line_fit(const struct font_line *line, int height) {
+	return line->height >= height && line->height <= height + height / 4;
+}
+
+// take a shelf from the best fit free band
 static struct font_line *
 new_line(struct dfont *df, int height) {
-	int start_line = 0;
-	if (df->max_line > 0) {
-		struct font_line * lastline = &df->line[df->max_line-1];
-		start_line = lastline->start_line + lastline->height;
+	struct font_line *band, *line = NULL;
+	list_for_each_entry(band, struct font_line, &df->lines, next) {
+		if (!band->used && band->height >= height) {
+			if (line == NULL || band->height < line->height) {
+				line = band;
+			}
+		}
 	}
-	if (start_line + height > df->height)
+	if (line == NULL)
 		return NULL;
-	int max = df->height / TINY_FONT;
-	if (df->max_line >= max)
-		return NULL;
-	struct font_line * line = &df->line[df->max_line++];
-	line->start_line = start_line;
-	line->height = height;
+	if (line->height > height && !list_empty(&df->spare)) {
+		struct font_line *rest = list_entry(df->spare.next, struct font_line, next);
+		list_move(&rest->next, &line->next);
+		rest->start_line = line->start_line + height;
+		rest->height = line->height - height;
+		rest->space = 0;
+		rest->used = false;
+		INIT_LIST_HEAD(&rest->head);
+		line->height = height;
+	}
+	line->used = true;
 	line->space = df->width;
 	INIT_LIST_HEAD(&line->head);
+	df->shelf += df->width * line->height;
 	return line;
 }
 
 static struct font_line *
 find_line(struct dfont *df, int width, int height) {
-	int i;
-	for (i=0;i<df->max_line;i++) {
-		struct font_line * line = &df->line[i];
-		if (height == line->height && width <= line->space) {
-			return line;
+	struct font_line *line, *best = NULL;
+	list_for_each_entry(line, struct font_line, &df->lines, next) {
+		if (line->used && width <= line->space && line_fit(line, height)) {
+			if (best == NULL || line->height < best->height) {
+				best = line;
+				if (best->height == height)
+					break;
+			}
 		}
 	}
+	if (best)
+		return best;
 	return new_line(df, height);
 }
 
+static inline bool
+same_page(struct dfont *df, const struct font_line *a, const struct font_line *b) {
+	return a->start_line / df->height == b->start_line / df->height;
+}
+
+// the shelf is empty, merge it into the free bands around in the page
+static void
+release_line(struct dfont *df, struct font_line *line) {
+	line->used = false;
+	line->space = 0;
+	df->shelf -= df->width * line->height;
+	if (line->next.next != &df->lines) {
+		struct font_line *next = list_entry(line->next.next, struct font_line, next);
+		if (!next->used && same_page(df, line, next)) {
+			line->height += next->height;
+			list_move(&next->next, &df->spare);
+		}
+	}
+	if (line->next.prev != &df->lines) {
+		struct font_line *prev = list_entry(line->next.prev, struct font_line, next);
+		if (!prev->used && same_page(df, prev, line)) {
+			prev->height += line->height;
+			list_move(&line->next, &df->spare);
+		}
+	}
+}
+
 static struct hash_rect *
 new_node(struct dfont *df) {
 	if (df->freelist == NULL)
@@ -195,7 +321,8 @@ find_space(struct dfont *df, struct font_line *line, int width) {
 				return NULL;
 			n->line = line - df->line;
 			n->rect.x = start_pos;
-			n->rect.y = line->start_line;
+			n->rect.y = line->start_line % df->height;
+			n->rect.page = line->start_line / df->height;
 			n->rect.w = width;
 			n->rect.h = line->height;
 			list_add_tail(&n->next_char, &hr->next_char);
@@ -222,7 +349,8 @@ find_space(struct dfont *df, struct font_line *line, int width) {
 		return NULL;
 	n->line = line - df->line;
 	n->rect.x = start_pos;
-	n->rect.y = line->start_line;
+	n->rect.y = line->start_line % df->height;
+	n->rect.page = line->start_line / df->height;
 	n->rect.w = width;
 	n->rect.h = line->height;
 	list_add_tail(&n->next_char, &line->head);
@@ -230,75 +358,110 @@ find_space(struct dfont *df, struct font_line *line, int width) {
 	return n;
 }
 
-static void
-adjust_space(struct dfont *df, struct hash_rect *hr) {
+// the width of the gap, if the char is evicted
+static int
+char_gap(struct dfont *df, struct hash_rect *hr) {
 	struct font_line *line = &df->line[hr->line];
-	if (hr->next_char.next == &line->head) {
-		hr->rect.w = df->width - hr->rect.x;
-	} else {
+	int x0 = 0, x1 = df->width;
+	if (hr->next_char.prev != &line->head) {
+		struct hash_rect *prev = list_entry(hr->next_char.prev, struct hash_rect, next_char);
+		x0 = prev->rect.x + prev->rect.w;
+	}
+	if (hr->next_char.next != &line->head) {
 		struct hash_rect *next = list_entry(hr->next_char.next, struct hash_rect, next_char);
-		hr->rect.w = next->rect.x - hr->rect.x;
+		x1 = next->rect.x;
 	}
+	return x1 - x0;
+}
 
-	if (hr->next_char.prev == &line->head) {
-		hr->rect.w += hr->rect.x;
-		hr->rect.x = 0;
-	} else {
-		struct hash_rect *prev = list_entry(hr->next_char.prev, struct hash_rect, next_char);
-		int x = prev->rect.x + prev->rect.w;
-		hr->rect.w += hr->rect.x - x;
-		hr->rect.x = x;
+// remove a char from the texture, returns the shelf it was in
+static struct font_line *
+evict_char(struct dfont *df, struct hash_rect *hr) {
+	struct hash_rect **p = &df->hash[hash(hr->c, hr->font, hr->edge)];
+	while (*p != hr) {
+		assert(*p);
+		p = &(*p)->next_hash;
+	}
+	*p = hr->next_hash;
+	list_del(&hr->time);
+
+	struct font_line *line = &df->line[hr->line];
+	int gap = char_gap(df, hr);
+	list_del(&hr->next_char);
+	if (gap > line->space) {
+		line->space = gap;
 	}
-	if (hr->rect.w > line->space) {
-		line->space = hr->rect.w;
+
+	--df->chars;
+	df->area -= hr->rect.w * hr->rect.h;
+	++df->evict;
+	hr->next_hash = df->freelist;
+	df->freelist = hr;
+
+	if (list_empty(&line->head)) {
+		release_line(df, line);
 	}
+	return line;
 }
 
 static struct hash_rect *
-release_char(struct dfont *df, int c, int font, int edge) {
-	int h = hash(c, font, edge);
-	struct hash_rect *hr = df->hash[h];
-	if (hr->c == c && hr->font == font && hr->edge == edge) {
-		df->hash[h] = hr->next_hash;
-		list_del(&hr->time);
-		adjust_space(df, hr);
-		return hr;
-	}
-	struct hash_rect * last = hr;
-	hr = hr->next_hash;
-	while (hr) {
-		if (c == hr->c && hr->font == font && hr->edge == edge) {
-			last->next_hash = hr->next_hash;
-			list_del(&hr->time);
-			adjust_space(df, hr);
+alloc_space(struct dfont *df, int width, int height) {
+	// don't take a shelf without a node for it
+	if (df->freelist == NULL)
+		return NULL;
+	for (;;) {
+		struct font_line *line = find_line(df, width, height);
+		if (line == NULL)
+			return NULL;
+		struct hash_rect * hr = find_space(df, line, width);
+		if (hr)
 			return hr;
-		}
-		last = hr;
-		hr = hr->next_hash;
 	}
-	assert(0);
-	return NULL;
 }
 
+// evict the least recently used chars, until there is space for the new one
 static struct hash_rect *
 release_space(struct dfont *df, int width, int height) {
+	bool full = df->freelist == NULL;
 	struct hash_rect *hr, *tmp;
+	if (!full) {
+		// the oldest char leaving a wide enough gap in a shelf fits
+		list_for_each_entry(hr, struct hash_rect, &df->time, time) {
+			if (hr->version == df->version)
+				break;
+			struct font_line *line = &df->line[hr->line];
+			if (line_fit(line, height) && char_gap(df, hr) >= width) {
+				line = evict_char(df, hr);
+				if (line->used)
+					return find_space(df, line, width);
+				// it was the only char in the shelf
+				line = new_line(df, height);
+				return find_space(df, line, width);
+			}
+		}
+	}
+	// or empty shelves for a new one
 	list_for_each_entry_safe(hr, struct hash_rect, tmp, &df->time, time) {
-		if (hr->version == df->version)
-			continue;
-		if (hr->rect.h != height) {
-			continue;
+		if (hr->version == df->version) {
+			// used since the last flush, so are the later ones
+			break;
 		}
-		struct hash_rect * ret = release_char(df, hr->c, hr->font, hr->edge);
-		int w = hr->rect.w;
-		if (w >= width) {
-			ret->rect.w = width;
-			return ret;
-		} else {
-			list_del(&ret->next_char);
-			ret->next_hash = df->freelist;
-			df->freelist = ret;
+		struct font_line *line = evict_char(df, hr);
+		struct hash_rect *n = NULL;
+		if (full) {
+			// out of nodes rather than texture
+			full = false;
+			n = alloc_space(df, width, height);
+		} else if (!line->used) {
+			line = new_line(df, height);
+			if (line) {
+				n = find_space(df, line, width);
+			}
+		} else if (line->space >= width && line_fit(line, height)) {
+			n = find_space(df, line, width);
 		}
+		if (n)
+			return n;
 	}
 	return NULL;
 }
@@ -313,27 +476,30 @@ insert_char(struct dfont *df, int c, int font, struct hash_rect *hr, int edge) {
 	int h = hash(c, font, edge);
 	hr->next_hash = df->hash[h];
 	df->hash[h] = hr;
+	++df->chars;
+	df->area += hr->rect.w * hr->rect.h;
+	++df->insert;
 	return &hr->rect;
 }
 
 const struct dfont_rect * 
 dfont_insert(struct dfont *df, int c, int font, int width, int height, int edge) {
-	if (width > df->width)
+	if (width > df->width || height > df->height)
 		return NULL;
 	assert(dfont_lookup(df,c,font,edge) == NULL);
-	for (;;) {
-		struct font_line *line = find_line(df, width, height);
-		if (line == NULL)
-			break;
-		struct hash_rect * hr = find_space(df, line, width);
-		if (hr) {
-			return insert_char(df,c,font,hr,edge);
-		}
+	struct hash_rect * hr = alloc_space(df, width, height);
+	// a new page before evicting
+	while (hr == NULL && df->page < df->max_page && add_page(df)) {
+		hr = alloc_space(df, width, height);
+	}
+	if (hr == NULL) {
+		hr = release_space(df, width, height);
 	}
-	struct hash_rect * hr = release_space(df, width, height);
 	if (hr) {
+		hr->rect.h = height;
 		return insert_char(df,c,font,hr,edge);
 	}
+	++df->fail;
 	return NULL;
 }
 
@@ -344,7 +510,7 @@ dump_node(struct hash_rect *hr) {
 
 void 
 dfont_dump(struct dfont * df) {
-	printf("version = %d\n",df->version);
+	printf("version = %d page = %d/%d\n",df->version, df->page, df->max_page);
 	printf("By version : ");
 	struct hash_rect *hr;
 	int version = -1;
@@ -357,9 +523,12 @@ dfont_dump(struct dfont * df) {
 	}
 	printf("\n");
 	printf("By line : \n");
-	int i;
-	for (i=0;i<df->max_line;i++) {
-		struct font_line *line = &df->line[i];
+	struct font_line *line;
+	list_for_each_entry(line, struct font_line, &df->lines, next) {
+		if (!line->used) {
+			printf("free (y=%d h=%d)\n", line->start_line, line->height);
+			continue;
+		}
 		printf("line (y=%d h=%d space=%d) :",line->start_line, line->height,line->space);
 		list_for_each_entry(hr, struct hash_rect, &line->head, next_char) {
 			printf("%d(%d-%d) ",hr->c,hr->rect.x,hr->rect.x+hr->rect.w-1);
@@ -367,6 +536,7 @@ dfont_dump(struct dfont * df) {
 		printf("\n");
 	}
 	printf("By hash : \n");
+	int i;
 	for (i=0;i<HASH_SIZE;i++) {
 		struct hash_rect *hr = df->hash[i];
 		if (hr) {
@@ -9,17 +9,34 @@ struct dfont_rect {
 	int y;
 	int w;
 	int h;
+	int page;
 };
 
-struct dfont * dfont_create(int width, int height);
+struct dfont_stat {
+	int chars;	// chars in the texture
+	int area;	// texels of the chars, over width*height*page is the occupancy
+	int shelf;	// texels of the shelves, the part not used by chars is fragmentation
+	int insert;	// chars inserted so far
+	int evict;	// chars evicted so far
+	int fail;	// inserts failed so far
+	int page;	// pages in use
+};
+
+// the texture is up to page pages of width*height, a new one is used when the others are full
+struct dfont * dfont_create(int width, int height, int page);
 void dfont_release(struct dfont *);
 const struct dfont_rect * dfont_lookup(struct dfont *, int c, int font, int edge);
 const struct dfont_rect * dfont_insert(struct dfont *, int c, int font, int width, int height, int edge);
 void dfont_remove(struct dfont *, int c, int font, int edge);
 void dfont_flush(struct dfont *);
+// mark a rect from lookup/insert as used, like a lookup hit. the rect is valid until dfont_evict changes
+void dfont_touch(struct dfont *, const struct dfont_rect *);
+// count of chars evicted so far
+int dfont_evict(struct dfont *);
+void dfont_stat(struct dfont *, struct dfont_stat *);
 void dfont_dump(struct dfont *); // for debug
 
-size_t dfont_data_size(int width, int height);
-void dfont_init(void* d, int width, int height);
+size_t dfont_data_size(int width, int height, int page);
+void dfont_init(void* d, int width, int height, int page);
 
 #endif
@@ -15,6 +15,7 @@
 #include "label.h"
 #include "particle.h"
 #include "lrenderbuffer.h"
+#include "linstancebuffer.h"
 #include "lgeometry.h"
 #include "screen.h"
 
@@ -191,6 +192,7 @@ ejoy2d_init(lua_State *L) {
 	luaL_requiref(L, "ejoy2d.spritepack.c", ejoy2d_spritepack, 0);
 	luaL_requiref(L, "ejoy2d.sprite.c", ejoy2d_sprite, 0);
 	luaL_requiref(L, "ejoy2d.renderbuffer", ejoy2d_renderbuffer, 0);
+	luaL_requiref(L, "ejoy2d.instancebuffer", ejoy2d_instancebuffer, 0);
 	luaL_requiref(L, "ejoy2d.matrix.c", ejoy2d_matrix, 0);
 	luaL_requiref(L, "ejoy2d.particle.c", ejoy2d_particle, 0);
 	luaL_requiref(L, "ejoy2d.geometry.c", ejoy2d_geometry, 0);
@@ -230,6 +232,7 @@ ejoy2d_close_lua(struct game *G) {
 void
 ejoy2d_game_exit(struct game *G) {
 	ejoy2d_close_lua(G);
+	particle_workers(0);
 	label_unload();
 	texture_exit();
 	shader_unload();
@@ -373,6 +376,9 @@ ejoy2d_game_drawframe(struct game *G) {
 	lua_settop(G->L, TOP_FUNCTION);
 	shader_flush();
 	label_flush();
+	int view[4];
+	screen_viewbox(view);
+	particle_frame(view);
 	//int cnt = drawcall_count();
 	//printf("-> %d\n", cnt);
 }
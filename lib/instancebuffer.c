@@ -0,0 +1,60 @@
+#include "instancebuffer.h"
+
+#include <stdlib.h>
+
+void
+instancebuffer_init(struct instance_buffer *ib, int n) {
+	ib->n = 0;
+	ib->capacity = 0;
+	ib->mat = NULL;
+	ib->color = NULL;
+	ib->additive = NULL;
+	instancebuffer_resize(ib, n);
+}
+
+void
+instancebuffer_exit(struct instance_buffer *ib) {
+	free(ib->mat);
+	free(ib->color);
+	free(ib->additive);
+	ib->mat = NULL;
+	ib->color = NULL;
+	ib->additive = NULL;
+	ib->n = 0;
+	ib->capacity = 0;
+}
+
+void
+instancebuffer_resize(struct instance_buffer *ib, int n) {
+	if (n > ib->capacity) {
+		int cap = ib->capacity * 2;
+		if (cap < n)
+			cap = n;
+		ib->mat = (struct matrix *)realloc(ib->mat, cap * sizeof(struct matrix));
+		ib->color = (uint32_t *)realloc(ib->color, cap * sizeof(uint32_t));
+		ib->additive = (uint32_t *)realloc(ib->additive, cap * sizeof(uint32_t));
+		ib->capacity = cap;
+	}
+	int i;
+	for (i=ib->n;i<n;i++) {
+		matrix_identity(&ib->mat[i]);
+		ib->color[i] = 0xffffffff;
+		ib->additive[i] = 0;
+	}
+	ib->n = n;
+}
+
+void
+instancebuffer_srt(struct instance_buffer *ib, int index, int x, int y, int sx, int sy, int rot) {
+	struct matrix *mat = &ib->mat[index];
+	if (rot == 0) {
+		int *m = mat->m;
+		m[0] = sx;
+		m[1] = 0;
+		m[2] = 0;
+		m[3] = sy;
+	} else {
+		matrix_sr(mat, sx, sy, rot);
+	}
+	instancebuffer_trans(ib, index, x, y);
+}
@@ -0,0 +1,32 @@
+#ifndef ejoy2d_instancebuffer_h
+#define ejoy2d_instancebuffer_h
+
+#include "matrix.h"
+
+#include <stdint.h>
+
+// Instances for sprite multi_draw, in struct-of-arrays form so they can be filled in bulk.
+struct instance_buffer {
+	int n;
+	int capacity;
+	struct matrix *mat;
+	uint32_t *color;
+	uint32_t *additive;
+};
+
+void instancebuffer_init(struct instance_buffer *ib, int n);
+void instancebuffer_exit(struct instance_buffer *ib);
+// new instances are identity, white, and no additive
+void instancebuffer_resize(struct instance_buffer *ib, int n);
+
+// write matrix of instance index in place, x,y in SCREEN_SCALE, sx,sy in 1024, rot in EJMAT_R_FACTOR
+void instancebuffer_srt(struct instance_buffer *ib, int index, int x, int y, int sx, int sy, int rot);
+
+static inline void
+instancebuffer_trans(struct instance_buffer *ib, int index, int x, int y) {
+	int *m = ib->mat[index].m;
+	m[4] = x;
+	m[5] = y;
+}
+
+#endif
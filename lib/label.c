@@ -7,49 +7,144 @@
 #include "array.h"
 
 #include "render.h"
+#include "thread.h"
+#include "bitmap.h"
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
 
 #define TEX_HEIGHT 1024
 #define TEX_WIDTH 1024
 #define FONT_SIZE 31
 #define TEX_FMT TEXTURE_A8
+// pages of the glyph atlas, they are created when the others are full
+#define MAX_PAGE 16
+#define DEFAULT_PAGE 4
+// distance field spread in pixels of FONT_SIZE, the glyph is padded by it
+#define SDF_SPREAD 4
 
-static RID Tex;
+static RID Tex[MAX_PAGE];
+static int TexPage = 0;
+static int MaxPage = DEFAULT_PAGE;
 static struct dfont * Dfont = NULL;
 static struct render *R = NULL;
+static bool Sdf = false;
+// bumped when glyph rects change other than by dfont eviction (sdf switch, atlas reload)
+static uint32_t Generation = 0;
+
+static void commit_char();
+static void layout_release();
 
 void 
 label_initrender(struct render *r) {
 	R = r;
 }
 
+static RID
+page_texture(int page) {
+	while (TexPage <= page) {
+		RID tex = render_texture_create(R, TEX_WIDTH, TEX_HEIGHT, TEX_FMT, TEXTURE_2D, 0);
+		render_texture_update(R, tex, TEX_WIDTH, TEX_HEIGHT ,NULL, 0, 0);
+		Tex[TexPage++] = tex;
+	}
+	return Tex[page];
+}
+
+static void
+release_page(int page) {
+	while (TexPage > page) {
+		render_release(R, TEXTURE, Tex[--TexPage]);
+	}
+}
+
 void
 label_load() {
 	if (Dfont) return;
 
-	Dfont = dfont_create(TEX_WIDTH, TEX_HEIGHT);
+	Dfont = dfont_create(TEX_WIDTH, TEX_HEIGHT, MaxPage);
+	++Generation;
 
-	Tex = render_texture_create(R, TEX_WIDTH, TEX_HEIGHT, TEX_FMT, TEXTURE_2D, 0);
-	render_texture_update(R, Tex, TEX_WIDTH, TEX_HEIGHT ,NULL, 0, 0);
+	page_texture(0);
 }
 
 void
 label_unload() {
-	render_release(R, TEXTURE, Tex);
+	label_async(0);
+	layout_release();
+	release_page(0);
 	dfont_release(Dfont);
 	Dfont = NULL;
 }
 
+void
+label_atlas(int budget) {
+	int page = budget / (TEX_WIDTH * TEX_HEIGHT);
+	if (page < 1) {
+		page = 1;
+	} else if (page > MAX_PAGE) {
+		page = MAX_PAGE;
+	}
+	if (page == MaxPage)
+		return;
+	MaxPage = page;
+	if (Dfont) {
+		// all the glyphs are generated again
+		commit_char();
+		dfont_release(Dfont);
+		Dfont = dfont_create(TEX_WIDTH, TEX_HEIGHT, MaxPage);
+		++Generation;
+		release_page(1);
+	}
+}
+
 void
 label_flush() {
 	if (Dfont) {
+		commit_char();
 		dfont_flush(Dfont);
 	}
 }
 
+void
+label_sdf(bool enable) {
+	if (Sdf == enable)
+		return;
+	if (Dfont) {
+		// the glyphs in atlas are in the other format, generate them again
+		commit_char();
+		dfont_release(Dfont);
+		Dfont = dfont_create(TEX_WIDTH, TEX_HEIGHT, MaxPage);
+		release_page(1);
+	}
+	Sdf = enable;
+	++Generation;
+}
+
+// one sdf glyph serves both normal and edge text
+static inline int
+glyph_edge(int edge) {
+	return Sdf ? 0 : edge;
+}
+
+static inline int
+glyph_pad() {
+	return Sdf ? SDF_SPREAD : 0;
+}
+
+// glyph size in atlas without padding
+static inline int
+glyph_w(const struct dfont_rect *rect) {
+	return rect->w - glyph_pad() * 2;
+}
+
+static inline int
+glyph_h(const struct dfont_rect *rect) {
+	return rect->h - glyph_pad() * 2;
+}
+
 static inline int
 copystr(char *utf8, const char *str, int n) {
 	int i;
@@ -63,68 +158,64 @@ copystr(char *utf8, const char *str, int n) {
 	return unicode;
 }
 
-static inline int
-get_unicode(const char *str, int n) {
-	int i;
-	int unicode = str[0] & ((1 << (8-n)) - 1);
-	for (i=1;i<n;i++) {
-		unicode = unicode << 6 | ((uint8_t)str[i] & 0x3f);
-	}
-	return unicode;
-}
-
-static inline int
-max(int a, int b, int c, int d) {
-	a = a>b ? a : b;
-	a = a>c ? a : c;
-	a = a>d ? a : d;
-	return a;
-}
-
+// Signed distance field of the glyph (w*h) into dest (padded by pad on each side), 128 is the edge.
+// The anti-aliased coverage moves the edge inside a pixel.
 static void
-gen_outline(int w, int h, uint8_t *buffer, uint8_t *dest) {
-	int i,j;
-	for (i=0;i<h;i++) {
-		uint8_t * output = dest + i*w;
-		uint8_t * line = buffer + i*w;
-		uint8_t * prev;
-		uint8_t * next;
-		if (i==0) {
-			prev = line;
-		} else {
-			prev = line-w;
-		}
-		if (i==h-1) {
-			next = line;
-		} else {
-			next = line+w;
+gen_sdf(int w, int h, const uint8_t *glyph, int pad, uint8_t *dest) {
+	int dw = w + pad * 2;
+	int dh = h + pad * 2;
+	int r = pad;
+	int side = r * 2 + 1;
+	ARRAY(float, dist, side * side);
+	ARRAY(uint8_t, cov, dw * dh);
+	int x,y,i,j;
+	for (i=0;i<side;i++) {
+		for (j=0;j<side;j++) {
+			int dx = j - r;
+			int dy = i - r;
+			dist[i*side+j] = sqrtf((float)(dx*dx + dy*dy));
 		}
-		for (j=0;j<w;j++) {
-			int left, right;
-			if (j==0) {
-				left = 0;
-			} else {
-				left = 1;
-			}
-			if (j==w-1) {
-				right = 0;
+	}
+	memset(cov, 0, dw * dh);
+	for (y=0;y<h;y++) {
+		memcpy(cov + (y+pad) * dw + pad, glyph + y * w, w);
+	}
+	for (y=0;y<dh;y++) {
+		for (x=0;x<dw;x++) {
+			int c = cov[y*dw+x];
+			float d;
+			if (c != 0 && c != 255) {
+				d = c / 255.0f - 0.5f;
 			} else {
-				right = 1;
+				float best = (float)(r + 1);
+				for (i=-r;i<=r;i++) {
+					int yy = y + i;
+					if (yy < 0 || yy >= dh)
+						continue;
+					const uint8_t * line = cov + yy * dw;
+					const float * dline = dist + (i+r) * side + r;
+					for (j=-r;j<=r;j++) {
+						int xx = x + j;
+						if (xx < 0 || xx >= dw)
+							continue;
+						int c2 = line[xx];
+						if (c2 == c)
+							continue;
+						// distance to the edge near the pixel (xx,yy)
+						float e = dline[j] + (c ? c2 : 255 - c2) / 255.0f - 0.5f;
+						if (e < best)
+							best = e;
+					}
+				}
+				d = c ? best : -best;
 			}
-			int n1 = max(line[j-left],line[j+right],prev[j],next[j]);
-			int n2 = max(prev[j-left],prev[j+right],next[j-left],next[j+right]);
-			int edge = (n1*3 + n2) / 4;
-			if (line[j] == 0) {
-				output[j] = edge / 2;
-			} else {
-				output[j] = line[j]/2 + 128;
+			float v = (0.5f + d / (pad * 2)) * 255.0f + 0.5f;
+			if (v < 0) {
+				v = 0;
+			} else if (v > 255) {
+				v = 255;
 			}
-		}
-		if (output[0] > 128) {
-			output[0]/=2;
-		}
-		if (output[w-1] > 128) {
-			output[w-1]/=2;
+			dest[y*dw+x] = (uint8_t)v;
 		}
 	}
 }
@@ -148,111 +239,475 @@ write_pgm(int unicode, int w, int h, const uint8_t * buffer) {
 }
 */
 
-static const struct dfont_rect *
-gen_char(int unicode, const char * utf8, int size, int edge) {
+// font_* share one face, the glyph worker and the main thread take turns
+static struct thread_mutex FontLock = THREAD_MUTEX_INIT;
+
+// rasterize the glyph into its atlas rect, ctx is from glyph_measure and released here
+static void
+glyph_fill(struct font_context *ctx, int unicode, const char * utf8, int edge, bool sdf, int w, int h, uint8_t *buffer) {
+	int buffer_sz = w * h;
+	if (sdf) {
+		int pad = SDF_SPREAD;
+		ctx->w = w - pad * 2;
+		ctx->h = h - pad * 2;
+		int glyph_sz = ctx->w * ctx->h;
+		ARRAY(uint8_t, tmp, glyph_sz);
+		memset(tmp,0,glyph_sz);
+		font_glyph(utf8, unicode, tmp, ctx);
+		font_release(ctx);
+		thread_mutex_unlock(&FontLock);
+		gen_sdf(ctx->w, ctx->h, tmp, pad, buffer);
+		return;
+	}
+	ctx->w = w;
+	ctx->h = h;
+#ifdef FONT_EDGE_HASH
+	if (!edge) {
+		memset(buffer,0,buffer_sz);
+		font_glyph(utf8, unicode, buffer, ctx);
+		font_release(ctx);
+		thread_mutex_unlock(&FontLock);
+		return;
+	}
+#endif
+	ARRAY(uint8_t, tmp, buffer_sz);
+	memset(tmp,0,buffer_sz);
+	font_glyph(utf8, unicode, tmp, ctx);
+	font_release(ctx);
+	thread_mutex_unlock(&FontLock);
+	bitmap_outline(w, h, tmp, buffer);
+}
+
+// load the glyph and get its atlas rect size. on success FontLock is held until glyph_fill
+static bool
+glyph_measure(struct font_context *ctx, int unicode, const char * utf8, bool sdf, int *w, int *h) {
 	// todo : use large size when size is large
-	struct font_context ctx;
-	font_create(FONT_SIZE, &ctx);
-	if (ctx.font == NULL) {
-		return NULL;
+	thread_mutex_lock(&FontLock);
+	font_create(FONT_SIZE, ctx);
+	if (ctx->font == NULL) {
+		thread_mutex_unlock(&FontLock);
+		return false;
+	}
+	font_size(utf8, unicode, ctx);
+	int pad = sdf ? SDF_SPREAD : 0;
+	*w = ctx->w + 1 + pad * 2;
+	*h = ctx->h + 1 + pad * 2;
+	return true;
+}
+
+// Staged glyphs : new glyphs are rasterized into their atlas rects in bulk, and uploaded with one
+// texture update per run of adjacent glyphs in a shelf. The rows under a shorter glyph belong to it.
+
+struct glyph_stage {
+	struct dfont_rect rect;
+	uint8_t *buffer;	// rect.w * rect.h
+};
+
+static struct {
+	int n;
+	int cap;
+	struct glyph_stage *glyph;
+} Stage;
+
+static int
+stage_compar(const void *a, const void *b) {
+	const struct dfont_rect *r1 = &((const struct glyph_stage *)a)->rect;
+	const struct dfont_rect *r2 = &((const struct glyph_stage *)b)->rect;
+	if (r1->page != r2->page)
+		return r1->page - r2->page;
+	if (r1->y != r2->y)
+		return r1->y - r2->y;
+	return r1->x - r2->x;
+}
+
+static void
+stage_upload() {
+	int i,j,k;
+	if (Stage.n == 0)
+		return;
+	qsort(Stage.glyph, Stage.n, sizeof(struct glyph_stage), stage_compar);
+	for (i=0;i<Stage.n;i=j) {
+		const struct dfont_rect *first = &Stage.glyph[i].rect;
+		int w = first->w;
+		int h = first->h;
+		for (j=i+1;j<Stage.n;j++) {
+			const struct dfont_rect *r = &Stage.glyph[j].rect;
+			if (r->page != first->page || r->y != first->y || r->x != first->x + w)
+				break;
+			w += r->w;
+			if (r->h > h) {
+				h = r->h;
+			}
+		}
+		if (j == i+1) {
+			render_texture_subupdate(R, page_texture(first->page), Stage.glyph[i].buffer, first->x, first->y, first->w, first->h);
+		} else {
+			uint8_t *buffer = (uint8_t *)calloc(w, h);
+			for (k=i;k<j;k++) {
+				const struct dfont_rect *r = &Stage.glyph[k].rect;
+				bitmap_copy(buffer + r->x - first->x, w, Stage.glyph[k].buffer, r->w, r->w, r->h);
+			}
+			render_texture_subupdate(R, page_texture(first->page), buffer, first->x, first->y, w, h);
+			free(buffer);
+		}
+		for (k=i;k<j;k++) {
+			free(Stage.glyph[k].buffer);
+		}
+	}
+	Stage.n = 0;
+}
+
+// the buffer is freed after uploading
+static void
+stage_push(const struct dfont_rect *rect, uint8_t *buffer) {
+	if (Stage.n >= Stage.cap) {
+		Stage.cap = Stage.cap ? Stage.cap * 2 : 64;
+		Stage.glyph = (struct glyph_stage *)realloc(Stage.glyph, Stage.cap * sizeof(struct glyph_stage));
 	}
+	struct glyph_stage *g = &Stage.glyph[Stage.n++];
+	g->rect = *rect;
+	g->buffer = buffer;
+}
 
-	font_size(utf8, unicode, &ctx);
-	const struct dfont_rect * rect = dfont_insert(Dfont, unicode, FONT_SIZE, ctx.w+1, ctx.h+1, edge);
+// the staged glyphs are of the current version, so they are not evicted until the atlas is flushed
+static const struct dfont_rect *
+stage_insert(int unicode, int edge, int w, int h) {
+	const struct dfont_rect * rect = dfont_insert(Dfont, unicode, FONT_SIZE, w, h, edge);
 	if (rect == NULL) {
+		stage_upload();
 		dfont_flush(Dfont);
-		rect = dfont_insert(Dfont, unicode, FONT_SIZE, ctx.w+1, ctx.h+1, edge);
-		if (rect == NULL) {
-			font_release(&ctx);
-			return NULL;
-		}
+		rect = dfont_insert(Dfont, unicode, FONT_SIZE, w, h, edge);
 	}
-	ctx.w = rect->w ;
-	ctx.h = rect->h ;
-	int buffer_sz = ctx.w * ctx.h;
+	return rect;
+}
 
-	ARRAY(uint8_t, buffer, buffer_sz);
-	
-#ifdef FONT_EDGE_HASH
-  if (edge) {
-    ARRAY(uint8_t, tmp, buffer_sz);
-    memset(tmp,0,buffer_sz);
-    font_glyph(utf8, unicode, tmp, &ctx);
-    gen_outline(ctx.w, ctx.h, tmp, buffer);
-  } else {
-    memset(buffer,0,buffer_sz);
-    font_glyph(utf8, unicode, buffer, &ctx);
-  }
-#else
-	ARRAY(uint8_t, tmp, buffer_sz);
-	memset(tmp,0,buffer_sz);
-	font_glyph(utf8, unicode, tmp, &ctx);
-	gen_outline(ctx.w, ctx.h, tmp, buffer);
-#endif
-	
-//	write_pgm(unicode, ctx.w, ctx.h, buffer);
-	font_release(&ctx);
+// rasterize a missing glyph into the stage
+static const struct dfont_rect *
+stage_char(int unicode, const char * utf8, int edge) {
+	struct font_context ctx;
+	int w,h;
+	if (!glyph_measure(&ctx, unicode, utf8, Sdf, &w, &h)) {
+		return NULL;
+	}
+	edge = glyph_edge(edge);
+	const struct dfont_rect * rect = stage_insert(unicode, edge, w, h);
+	if (rect == NULL) {
+		font_release(&ctx);
+		thread_mutex_unlock(&FontLock);
+		return NULL;
+	}
+
+	uint8_t *buffer = (uint8_t *)malloc(w * h);
+	glyph_fill(&ctx, unicode, utf8, edge, Sdf, w, h, buffer);
+
+//	write_pgm(unicode, w, h, buffer);
 
-	render_texture_subupdate(R, Tex, buffer, rect->x, rect->y, rect->w, rect->h);
+	stage_push(rect, buffer);
+	return rect;
+}
 
+static const struct dfont_rect *
+gen_char(int unicode, const char * utf8, int size, int edge) {
+	const struct dfont_rect * rect = stage_char(unicode, utf8, edge);
+	stage_upload();
 	return rect;
 }
 
+// Glyph jobs : missing glyphs are rasterized by a worker thread when Async.budget > 0,
+// and label_flush uploads the finished ones, at most budget bytes per frame.
+
+#define GLYPH_JOB 256
+
+struct glyph_job {
+	struct glyph_job *next;	// pending hash or free list
+	int unicode;
+	int edge;
+	bool sdf;
+	int w;
+	int h;
+	uint8_t *buffer;	// NULL if the glyph can't be rasterized
+	char utf8[8];
+};
+
+struct glyph_ring {
+	int head;
+	int tail;
+	struct glyph_job * job[GLYPH_JOB];
+};
+
+static struct {
+	int budget;
+	bool quit;
+	struct thread worker;
+	struct thread_mutex lock;
+	struct thread_cond cond;
+	struct glyph_ring todo;	// rings never overflow, there are only GLYPH_JOB jobs
+	struct glyph_ring done;
+	// owned by the main thread
+	struct glyph_job *freelist;
+	struct glyph_job *pending[GLYPH_JOB];
+	struct glyph_job job[GLYPH_JOB];
+} Async = { 0, false, { 0 }, THREAD_MUTEX_INIT, THREAD_COND_INIT };
+
+static inline bool
+ring_empty(struct glyph_ring *r) {
+	return r->head == r->tail;
+}
 
 static inline void
-set_point(struct vertex_pack *v, int *m, int xx, int yy,int tx, int ty) {
-	v->vx = (xx * m[0] + yy * m[2]) / 1024 + m[4];
-	v->vy = (xx * m[1] + yy * m[3]) / 1024 + m[5];
-	screen_trans(&v->vx,&v->vy);
+ring_push(struct glyph_ring *r, struct glyph_job *job) {
+	r->job[r->tail % GLYPH_JOB] = job;
+	++r->tail;
+}
 
-	v->tx = (uint16_t)(tx * (65535.0f/TEX_WIDTH));
-	v->ty = (uint16_t)(ty * (65535.0f/TEX_HEIGHT));
+static inline struct glyph_job *
+ring_pop(struct glyph_ring *r) {
+	struct glyph_job *job = r->job[r->head % GLYPH_JOB];
+	++r->head;
+	return job;
 }
 
 static void
-draw_rect(const struct dfont_rect *rect, int size, struct matrix *mat, uint32_t color, uint32_t additive) {
-	struct vertex_pack vb[4];
+glyph_worker(void *ud) {
+	for (;;) {
+		thread_mutex_lock(&Async.lock);
+		while (!Async.quit && ring_empty(&Async.todo)) {
+			thread_cond_wait(&Async.cond, &Async.lock);
+		}
+		if (Async.quit) {
+			thread_mutex_unlock(&Async.lock);
+			return;
+		}
+		struct glyph_job *job = ring_pop(&Async.todo);
+		thread_mutex_unlock(&Async.lock);
 
-	int w = (rect->w -1) * size / FONT_SIZE ;
-	int h = (rect->h -1) * size / FONT_SIZE ;
+		struct font_context ctx;
+		job->buffer = NULL;
+		if (glyph_measure(&ctx, job->unicode, job->utf8, job->sdf, &job->w, &job->h)) {
+			job->buffer = (uint8_t *)malloc(job->w * job->h);
+			glyph_fill(&ctx, job->unicode, job->utf8, job->edge, job->sdf, job->w, job->h, job->buffer);
+		}
 
-	set_point(&vb[0], mat->m, 0,0, rect->x, rect->y);
-	set_point(&vb[1], mat->m, w*SCREEN_SCALE,0, rect->x+rect->w-1, rect->y);
-	set_point(&vb[2], mat->m, w*SCREEN_SCALE,h*SCREEN_SCALE, rect->x+rect->w-1, rect->y+rect->h-1);
-	set_point(&vb[3], mat->m, 0,h*SCREEN_SCALE, rect->x, rect->y+rect->h-1);
-	shader_draw(vb, color, additive);
+		thread_mutex_lock(&Async.lock);
+		ring_push(&Async.done, job);
+		thread_mutex_unlock(&Async.lock);
+	}
 }
 
-static int
-draw_size(int unicode, const char *utf8, int size, int edge) {
-	const struct dfont_rect * rect = dfont_lookup(Dfont,unicode,FONT_SIZE,edge);
-	if (rect == NULL) {
-		rect = gen_char(unicode,utf8,size,edge);
+static inline int
+job_hash(int unicode, int edge) {
+	return (unicode ^ (edge << 7)) % GLYPH_JOB;
+}
+
+static void
+job_remove(struct glyph_job *job) {
+	struct glyph_job **p = &Async.pending[job_hash(job->unicode, job->edge)];
+	while (*p != job) {
+		p = &(*p)->next;
 	}
-	if (rect) {
-		return (rect->w -1) * size / FONT_SIZE;
+	*p = job->next;
+	free(job->buffer);
+	job->buffer = NULL;
+	job->next = Async.freelist;
+	Async.freelist = job;
+}
+
+// queue a missing glyph, it's ignored when the queue is full and asked again in later frames
+static void
+request_char(int unicode, const char * utf8, int edge) {
+	edge = glyph_edge(edge);
+	int h = job_hash(unicode, edge);
+	struct glyph_job *job = Async.pending[h];
+	while (job) {
+		if (job->unicode == unicode && job->edge == edge && job->sdf == Sdf)
+			return;
+		job = job->next;
+	}
+	job = Async.freelist;
+	if (job == NULL)
+		return;
+	Async.freelist = job->next;
+	job->next = Async.pending[h];
+	Async.pending[h] = job;
+	job->unicode = unicode;
+	job->edge = edge;
+	job->sdf = Sdf;
+	job->buffer = NULL;
+	strncpy(job->utf8, utf8, sizeof(job->utf8)-1);
+	job->utf8[sizeof(job->utf8)-1] = 0;
+
+	thread_mutex_lock(&Async.lock);
+	// the worker only sleeps on an empty queue
+	if (ring_empty(&Async.todo)) {
+		thread_cond_signal(&Async.cond);
 	}
-	return 0;
+	ring_push(&Async.todo, job);
+	thread_mutex_unlock(&Async.lock);
 }
 
-static int
-draw_height(int unicode, const char *utf8, int size, int edge) {
-	const struct dfont_rect * rect = dfont_lookup(Dfont,unicode,FONT_SIZE,edge);
-	if (rect == NULL) {
-		rect = gen_char(unicode,utf8,size,edge);
+// upload finished glyphs within the budget, at least one per frame
+static void
+commit_char() {
+	int bytes = 0;
+	for (;;) {
+		thread_mutex_lock(&Async.lock);
+		if (ring_empty(&Async.done)) {
+			thread_mutex_unlock(&Async.lock);
+			break;
+		}
+		struct glyph_job *job = Async.done.job[Async.done.head % GLYPH_JOB];
+		int sz = job->w * job->h;
+		if (bytes > 0 && bytes + sz > Async.budget) {
+			thread_mutex_unlock(&Async.lock);
+			break;
+		}
+		ring_pop(&Async.done);
+		thread_mutex_unlock(&Async.lock);
+
+		if (job->buffer && job->sdf == Sdf &&
+			dfont_lookup(Dfont, job->unicode, FONT_SIZE, job->edge) == NULL) {
+			const struct dfont_rect * rect = stage_insert(job->unicode, job->edge, job->w, job->h);
+			if (rect) {
+				stage_push(rect, job->buffer);
+				job->buffer = NULL;
+				bytes += sz;
+			}
+		}
+		job_remove(job);
 	}
-	if (rect) {
-		return rect->h * size / FONT_SIZE;
+	stage_upload();
+}
+
+static void
+async_stop() {
+	if (Async.budget == 0)
+		return;
+	thread_mutex_lock(&Async.lock);
+	Async.quit = true;
+	thread_cond_broadcast(&Async.cond);
+	thread_mutex_unlock(&Async.lock);
+	thread_join(&Async.worker);
+
+	int i;
+	for (i=0;i<GLYPH_JOB;i++) {
+		free(Async.job[i].buffer);
+		Async.job[i].buffer = NULL;
+	}
+	Async.budget = 0;
+}
+
+void
+label_async(int budget) {
+	if (budget <= 0) {
+		async_stop();
+		return;
+	}
+	if (Async.budget > 0) {
+		Async.budget = budget;
+		return;
+	}
+	Async.quit = false;
+	Async.todo.head = Async.todo.tail = 0;
+	Async.done.head = Async.done.tail = 0;
+	memset(Async.pending, 0, sizeof(Async.pending));
+	Async.freelist = NULL;
+	int i;
+	for (i=0;i<GLYPH_JOB;i++) {
+		Async.job[i].next = Async.freelist;
+		Async.freelist = &Async.job[i];
 	}
-	return 0;
+	if (thread_create(&Async.worker, glyph_worker, NULL)) {
+		return;
+	}
+	Async.budget = budget;
+}
+
+// the glyph for drawing, NULL if it's not ready
+static const struct dfont_rect *
+load_char(int unicode, const char *utf8, int edge) {
+	const struct dfont_rect * rect = dfont_lookup(Dfont,unicode,FONT_SIZE,glyph_edge(edge));
+	if (rect == NULL) {
+		if (Async.budget > 0) {
+			request_char(unicode, utf8, edge);
+		} else {
+			rect = gen_char(unicode,utf8,FONT_SIZE,edge);
+		}
+	}
+	return rect;
+}
+
+// a glyph quad in label space (SCREEN_SCALE), with its texture coord
+struct label_quad {
+	int x0, y0, x1, y1;
+	uint16_t u0, v0, u1, v1;
+	uint32_t color;	// rich text field color, 0 for the label color
+	int page;
+	const struct dfont_rect *rect;
+};
+
+struct label_mesh {
+	int cap;
+	int n;
+	bool valid;
+	uint32_t pages;	// mask of the atlas pages used
+	uint32_t generation;
+	int evict;
+	struct pack_label label;	// settings the quads are built for
+	struct label_quad q[1];
+};
+
+static inline void
+set_point(struct vertex_pack *v, const int *m, int xx, int yy, uint16_t tx, uint16_t ty) {
+	v->vx = (xx * m[0] + yy * m[2]) / 1024 + m[4];
+	v->vy = (xx * m[1] + yy * m[3]) / 1024 + m[5];
+	screen_trans(&v->vx,&v->vy);
+
+	v->tx = tx;
+	v->ty = ty;
+}
+
+// quad of rect at (x,y) in SCREEN_SCALE
+static void
+init_quad(struct label_quad *q, const struct dfont_rect *rect, int size, int x, int y) {
+	int w = (rect->w -1) * size / FONT_SIZE ;
+	int h = (rect->h -1) * size / FONT_SIZE ;
+	// the sdf padding is out of the glyph box
+	int pad = glyph_pad() * size * SCREEN_SCALE / FONT_SIZE;
+	q->x0 = x - pad;
+	q->y0 = y - pad;
+	q->x1 = x + w*SCREEN_SCALE - pad;
+	q->y1 = y + h*SCREEN_SCALE - pad;
+	q->u0 = (uint16_t)(rect->x * (65535.0f/TEX_WIDTH));
+	q->v0 = (uint16_t)(rect->y * (65535.0f/TEX_HEIGHT));
+	q->u1 = (uint16_t)((rect->x+rect->w-1) * (65535.0f/TEX_WIDTH));
+	q->v1 = (uint16_t)((rect->y+rect->h-1) * (65535.0f/TEX_HEIGHT));
+	q->color = 0;
+	q->page = rect->page;
+	q->rect = rect;
+}
+
+static inline void
+draw_quad(const struct label_quad *q, const struct matrix *mat, uint32_t color, uint32_t additive) {
+	struct vertex_pack vb[4];
+	set_point(&vb[0], mat->m, q->x0, q->y0, q->u0, q->v0);
+	set_point(&vb[1], mat->m, q->x1, q->y0, q->u1, q->v0);
+	set_point(&vb[2], mat->m, q->x1, q->y1, q->u1, q->v1);
+	set_point(&vb[3], mat->m, q->x0, q->y1, q->u0, q->v1);
+	shader_draw(vb, color, additive);
 }
 
 static struct font_context
 char_size(int unicode, const char *utf8, int size, int edge) {
-	const struct dfont_rect * rect = dfont_lookup(Dfont,unicode,FONT_SIZE,edge);
+	const struct dfont_rect * rect = dfont_lookup(Dfont,unicode,FONT_SIZE,glyph_edge(edge));
 	struct font_context ctx;
+	if (rect == NULL && Async.budget > 0) {
+		// font_size only loads the glyph, the worker renders it
+		request_char(unicode, utf8, edge);
+	}
+	thread_mutex_lock(&FontLock);
 	font_create(FONT_SIZE, &ctx);
 	if (ctx.font == NULL) {
+		thread_mutex_unlock(&FontLock);
 		ctx.w = 0;
 		ctx.h = 0;
 		return ctx;
@@ -266,14 +721,34 @@ char_size(int unicode, const char *utf8, int size, int edge) {
 		ctx.w = (ctx.w -1) * size / FONT_SIZE;
 		ctx.h = ctx.h * size / FONT_SIZE;
 	} else {
-		ctx.w = (rect->w -1) * size / FONT_SIZE;
-		ctx.h = rect->h * size / FONT_SIZE;
+		ctx.w = (glyph_w(rect) -1) * size / FONT_SIZE;
+		ctx.h = glyph_h(rect) * size / FONT_SIZE;
 	}
 	// font_release should not reset ctx.w/ctx.h
 	font_release(&ctx);
+	thread_mutex_unlock(&FontLock);
 	return ctx;
 }
 
+// a glyph not rasterized yet takes the room it will have
+static int
+draw_size(int unicode, const char *utf8, int size, int edge) {
+	const struct dfont_rect * rect = load_char(unicode, utf8, edge);
+	if (rect) {
+		return (glyph_w(rect) -1) * size / FONT_SIZE;
+	}
+	return Async.budget > 0 ? char_size(unicode, utf8, size, edge).w : 0;
+}
+
+static int
+draw_height(int unicode, const char *utf8, int size, int edge) {
+	const struct dfont_rect * rect = load_char(unicode, utf8, edge);
+	if (rect) {
+		return glyph_h(rect) * size / FONT_SIZE;
+	}
+	return Async.budget > 0 ? char_size(unicode, utf8, size, edge).h : 0;
+}
+
 // also defined in sprite.c
 static inline uint32_t
 color_mul(uint32_t c1, uint32_t c2) {
@@ -292,69 +767,110 @@ color_mul(uint32_t c1, uint32_t c2) {
 		(a1 * a2 /255) ;
 }
 
+// append the quad of unicode at (cx,cy) to the mesh, returns the advance
 static int
-draw_utf8(int unicode, float cx, int cy, int size, const struct srt *srt,
-	uint32_t color, const struct sprite_trans *arg, int edge) {
-	const struct dfont_rect * rect = dfont_lookup(Dfont, unicode, FONT_SIZE, edge);
+build_char(struct label_mesh *mesh, int unicode, const char *utf8, float cx, int cy, int size, uint32_t color, int edge) {
+	const struct dfont_rect * rect = dfont_lookup(Dfont, unicode, FONT_SIZE, glyph_edge(edge));
 	if (rect == NULL) {
-		return 0;
+		// not ready yet, build again next time
+		mesh->valid = false;
+		return Async.budget > 0 ? char_size(unicode, utf8, size, edge).w : 0;
 	}
-	struct matrix tmp;
-	struct matrix mat1 = {{ 1024,0,0,1024, cx * SCREEN_SCALE, cy*SCREEN_SCALE }};
-	struct matrix *m;
-
-	if (arg->mat) {
-		m=&tmp;
-		matrix_mul(m, &mat1, arg->mat);
+	if (mesh->n < mesh->cap) {
+		struct label_quad *q = &mesh->q[mesh->n++];
+		init_quad(q, rect, size, cx * SCREEN_SCALE, cy * SCREEN_SCALE);
+		q->color = color;
+		mesh->pages |= 1u << rect->page;
 	} else {
-		m=&mat1;
+		mesh->valid = false;
 	}
-	matrix_srt(m, srt);
-	draw_rect(rect,size,m,color,arg->additive);
 
-	return (rect->w-1) * size / FONT_SIZE ;
+	return (glyph_w(rect)-1) * size / FONT_SIZE ;
 }
 
-static uint32_t
+static inline uint32_t
 get_rich_field_color(const struct rich_text *rich, int idx) {
-  int i;
-	uint32_t color = 0;
-  for (i=0;i<rich->count;i++) {
-    struct label_field *field = (struct label_field*)(rich->fields+i);
-		if (idx < field->start) return color;
-    if (idx >= field->start && idx <= field->end && field->type	== RL_COLOR) {
-      color = field->color;
-    }
-  }
-  return color;
+	return idx < rich->char_n ? rich->chars[idx].color : 0;
 }
 
-static int
+static inline int
 get_rich_field_width(const struct rich_text *rich, int idx) {
-	int i;
-  for (i=0;i<rich->count;i++) {
-    struct label_field *field = (struct label_field*)(rich->fields+i);
-		if (idx < field->start) return 0;
-    if (idx == field->start && field->type	== RL_FIXED_WIDTH) {
-      return field->val;
-    }
-  }
-  return 0;
+	return idx < rich->char_n ? rich->chars[idx].width : 0;
 }
 
-static bool
+static inline bool
 get_rich_filed_lf(const struct rich_text *rich, int idx, float * offset) {
-	int i;
-	for (i=0; i<rich->count; i++) {
-		struct label_field *field = (struct label_field*)(rich->fields+i);
-		if (idx==field->start && idx==field->end && field->type==RL_LINEFEED) {
-			*offset = (float)(field->val / 1000.0);
-			return true;
-		}
+	if (idx < rich->char_n && rich->chars[idx].lf) {
+		*offset = (float)(rich->chars[idx].lf_scale / 1000.0);
+		return true;
 	}
 	return false;
 }
 
+// the first index not painted from i
+static int
+paint_next(int *next, int i) {
+	while (next[i] != i) {
+		next[i] = next[next[i]];
+		i = next[i];
+	}
+	return i;
+}
+
+void
+label_rich_compile(struct rich_text *rich, struct rich_char *chars, int n) {
+	memset(chars, 0, n * sizeof(*chars));
+	rich->chars = chars;
+	rich->char_n = n;
+	int count = rich->count;
+	if (count == 0 || n == 0)
+		return;
+
+	// the fields are looked up in order, and the search stops at the first one starting after the char,
+	// so field k applies to the chars from the max start of fields 0..k
+	ARRAY(int, from, count);
+	int i, k;
+	int t = 0;
+	for (k=0;k<count;k++) {
+		if (rich->fields[k].start > t)
+			t = rich->fields[k].start;
+		from[k] = t;
+	}
+
+	// paint backward so a later color field wins, each char is painted once
+	ARRAY(int, next, n+1);
+	for (i=0;i<=n;i++) {
+		next[i] = i;
+	}
+	for (k=count-1;k>=0;k--) {
+		const struct label_field *f = &rich->fields[k];
+		int start = f->start;
+		int end = f->end < n ? f->end : n-1;
+		switch (f->type) {
+		case RL_COLOR:
+			if (from[k] > end)
+				break;
+			for (i=paint_next(next, from[k]); i<=end; i=paint_next(next, i)) {
+				chars[i].color = f->color;
+				next[i] = i+1;
+			}
+			break;
+		case RL_FIXED_WIDTH:
+			// the first one wins
+			if (from[k] == start && start < n) {
+				chars[start].width = f->val;
+			}
+			break;
+		case RL_LINEFEED:
+			if (start == f->end && start < n) {
+				chars[start].lf = true;
+				chars[start].lf_scale = f->val;
+			}
+			break;
+		}
+	}
+}
+
 static int
 unicode_len(const char chr) {
 	uint8_t c = (uint8_t)chr;
@@ -374,8 +890,8 @@ unicode_len(const char chr) {
 }
 
 static void
-draw_line(const struct rich_text *rich, struct pack_label * l, struct srt *srt, const struct sprite_trans *arg,
-          uint32_t color, int cy, int w, int start, int end, int *pre_char_cnt, float space_scale) {
+build_line(const struct rich_text *rich, struct pack_label * l, struct label_mesh *mesh,
+          int cy, int w, int start, int end, int *pre_char_cnt, float space_scale) {
     const char *str = rich->text;
 		float cx = 0.0;
     int j;
@@ -401,26 +917,22 @@ draw_line(const struct rich_text *rich, struct pack_label * l, struct srt *srt,
     }
   
     int char_cnt = 0;
+    char utf8[7];
     for (j=start; j<end;) {
         int unicode;
         char_cnt++;
 			
 				int len = unicode_len(str[j]);
-				unicode = get_unicode(str+j, len);
+				unicode = copystr(utf8, str+j, len);
 				j+=len;
 			
         if(unicode != '\n') {
             uint32_t field_color = get_rich_field_color(rich, *pre_char_cnt+char_cnt);
-						if (field_color == 0) {
-							field_color = color;
-						} else {
-							field_color = color_mul(field_color,  color | 0xffffff);
-						}
 						int fixed_width = get_rich_field_width(rich, *pre_char_cnt+char_cnt);
 						if (fixed_width > 0) {
 								cx = fixed_width;
 						}
-            cx+=(draw_utf8(unicode, cx, cy, size, srt, field_color, arg, l->edge) + l->space_w)*space_scale;
+            cx+=(build_char(mesh, unicode, utf8, cx, cy, size, field_color, l->edge) + l->space_w)*space_scale;
         }
     }
     *pre_char_cnt += char_cnt;
@@ -469,6 +981,326 @@ label_size(const char *str, struct pack_label * l, int* width, int* height) {
 	*height = max_h;
 }
 
+// Rich text layout : line breaking for a label, ported from richtext.lua.
+// Lines break at the label width; a punctuation never starts a line, and a word of
+// alphanumerics is moved to the next line, or squeezed into this one.
+
+int
+label_prewarm(const char *str, int edge) {
+	if (Dfont == NULL)
+		return 0;
+	char utf8[7];
+	int i;
+	int missing = 0;
+	for (i=0; str[i];) {
+		int len = unicode_len(str[i]);
+		int unicode = copystr(utf8, str+i, len);
+		i+=len;
+		if (unicode == '\n' || dfont_lookup(Dfont, unicode, FONT_SIZE, glyph_edge(edge)))
+			continue;
+		if (Async.budget > 0) {
+			request_char(unicode, utf8, edge);
+			++missing;
+		} else if (stage_char(unicode, utf8, edge) == NULL) {
+			++missing;
+		}
+	}
+	stage_upload();
+	return missing;
+}
+
+static inline bool
+is_ascii_dbc_punct(int unicode) {
+	return (unicode >= 33 && unicode <= 47) ||	// ! to /
+		(unicode >= 58 && unicode <= 64) ||	// : to @
+		(unicode >= 91 && unicode <= 96) ||	// [ to `
+		(unicode >= 123 && unicode <= 126);	// { to ~
+}
+
+static inline bool
+is_jp_punct(int unicode) {
+	return (unicode >= 65377 && unicode <= 65381) ||
+		unicode == 0x3002 || unicode == 0x3001 || unicode == 0x300C ||
+		unicode == 0x300D || unicode == 0x30FB;
+}
+
+// unicode < 0 means no char
+static inline bool
+is_punct(int unicode) {
+	if (unicode < 0)
+		return false;
+	return is_ascii_dbc_punct(unicode) || is_ascii_dbc_punct(unicode - 65248) || is_jp_punct(unicode);
+}
+
+static inline bool
+is_alnum(int unicode) {
+	if (unicode < 0)
+		return false;
+	int shift = unicode - 65248;
+	bool ascii = (unicode >= 33 && unicode <= 126) || (shift >= 33 && shift <= 126);
+	return ascii && !is_punct(unicode);
+}
+
+struct layout_char {
+	int w;
+	int h;
+	int unicode;
+};
+
+struct layout_line {
+	const struct layout_char *c;
+	int n;
+	struct label_field *lf;
+	int lf_n;
+};
+
+static inline int
+layout_unicode(const struct layout_line *line, int k) {
+	if (k < 0 || k >= line->n)
+		return -1;
+	return line->c[k].unicode;
+}
+
+// break the line after the k-th char, offset is the space scale of the line in 1/1000
+static void
+add_linefeed(struct layout_line *line, int k, int offset) {
+	struct label_field *f = &line->lf[line->lf_n++];
+	f->type = RL_LINEFEED;
+	f->start = k;
+	f->end = k;
+	f->val = offset;
+}
+
+// richtext.lua passed the scale through math.tointeger, so only an exact one was kept
+static inline int
+exact_scale(int num, int den) {
+	if (den <= 0 || num % den != 0)
+		return 1000;
+	return num / den;
+}
+
+static void
+layout_lines(struct layout_line *line, int width, int *out_w, int *out_h) {
+	const struct layout_char *c = line->c;
+	int line_width = 0;
+	int ignore_next = 0, extra_len = 0;
+	int max_width = 0, max_height = 0, line_max_height = 0;
+	int k;
+	for (k=0;k<line->n;k++) {
+		if (ignore_next == 0) {
+			line_width += c[k].w;
+		} else {
+			--ignore_next;
+		}
+		if (extra_len > 0) {
+			line_width += extra_len;
+			extra_len = 0;
+		}
+		if (c[k].unicode == '\n') {
+			max_height += c[k].h;
+			line_width = 0;
+		}
+		if (c[k].h > line_max_height) {
+			line_max_height = c[k].h;
+		}
+		if (line_width < width)
+			continue;
+
+		if (line_width > max_width) {
+			max_width = line_width;
+		}
+		max_height += line_max_height;
+		line_max_height = 0;
+
+		int pos = k;
+		int next_unicode = layout_unicode(line, k+1);
+		// make sure punctuation does not stand at line head
+		if (is_punct(next_unicode)) {
+			line_width += c[k+1].w;
+			++pos;
+			next_unicode = layout_unicode(line, k+2);
+			++ignore_next;
+		}
+
+		if (next_unicode >= 0 && next_unicode != '\n') {
+			if (ignore_next > 0 || !is_alnum(c[k].unicode)) {
+				add_linefeed(line, pos, 1000);
+			} else {
+				// the word around k
+				int start = k;
+				int forward_len = c[k].w;
+				while (start > 0 && is_alnum(c[start-1].unicode)) {
+					--start;
+					forward_len += c[start].w;
+				}
+				int stop = k;
+				while (is_alnum(layout_unicode(line, stop+1))) {
+					++stop;
+				}
+				if (stop == k+1 && !is_punct(layout_unicode(line, stop+1))) {
+					// squeeze the last char of the word into this line
+					++ignore_next;
+					int den = line_width + c[stop].w;
+					int scale = exact_scale(line_width * 1000, den);
+					if (den <= 0 || line_width * 1000 < den * 970) {
+						scale = 1000;
+					}
+					line_width += c[stop].w;
+					add_linefeed(line, pos+1, scale);
+				} else {
+					// move the word to the next line, and stretch this one
+					int den = line_width - forward_len;
+					if (den > 0 && width > 0 && width * 1000 <= den * 1250) {
+						extra_len = forward_len;
+						line_width -= extra_len;
+						add_linefeed(line, start-1, exact_scale(width * 1000, den));
+					} else {
+						add_linefeed(line, pos, 1000);
+					}
+				}
+			}
+		}
+		line_width = 0;
+	}
+	if (line_width < width && line_width > 0) {
+		max_height += line_max_height;
+	}
+	*out_w = max_width == 0 ? line_width : max_width;
+	*out_h = max_height;
+}
+
+// 4-way set associative, LRU in each set
+#define LAYOUT_WAY 4
+#define LAYOUT_SET 128
+#define LAYOUT_CACHE (LAYOUT_WAY * LAYOUT_SET)
+
+struct layout_entry {
+	uint32_t hash;
+	uint32_t last;
+	int width;
+	int size;
+	int edge;
+	int space_w;
+	int space_h;
+	int text_sz;
+	int tag_n;
+	int n;
+	int cap;
+	int w;
+	int h;
+	char *text;
+	struct label_field *fields;
+};
+
+static struct layout_entry Layout[LAYOUT_CACHE];
+static uint32_t LayoutClock = 0;
+
+static uint32_t
+layout_hash(const char *str, int sz, const struct pack_label *l, const struct label_field *tags, int tag_n) {
+	uint32_t h = 2166136261u;
+	int i;
+	for (i=0;i<sz;i++) {
+		h = (h ^ (uint8_t)str[i]) * 16777619u;
+	}
+	const uint8_t *t = (const uint8_t *)tags;
+	for (i=0;i<tag_n * (int)sizeof(*tags);i++) {
+		h = (h ^ t[i]) * 16777619u;
+	}
+	h ^= l->width * 31 + l->size;
+	h = (h ^ (l->edge << 16 | l->space_w << 8 | l->space_h)) * 16777619u;
+	return h;
+}
+
+static bool
+layout_equal(const struct layout_entry *e, uint32_t hash, const char *str, int sz, const struct pack_label *l, const struct label_field *tags, int tag_n) {
+	return e->text && e->hash == hash &&
+		e->width == l->width && e->size == l->size && e->edge == l->edge &&
+		e->space_w == l->space_w && e->space_h == l->space_h &&
+		e->text_sz == sz && e->tag_n == tag_n &&
+		memcmp(e->text, str, sz) == 0 &&
+		memcmp(e->fields, tags, tag_n * sizeof(*tags)) == 0;
+}
+
+static void
+layout_reserve(struct layout_entry *e, int sz, int cap) {
+	free(e->text);
+	e->text = (char *)malloc(sz + 1);
+	if (cap > e->cap) {
+		free(e->fields);
+		e->fields = (struct label_field *)malloc(cap * sizeof(struct label_field));
+		e->cap = cap;
+	}
+}
+
+static void
+layout_release() {
+	int i;
+	for (i=0;i<LAYOUT_CACHE;i++) {
+		free(Layout[i].text);
+		free(Layout[i].fields);
+	}
+	memset(Layout, 0, sizeof(Layout));
+}
+
+const struct label_field *
+label_layout(const char *str, int sz, struct pack_label *l, const struct label_field *tags, int tag_n, int *n, int *width, int *height) {
+	uint32_t hash = layout_hash(str, sz, l, tags, tag_n);
+	struct layout_entry *set = &Layout[hash % LAYOUT_SET * LAYOUT_WAY];
+	struct layout_entry *e = NULL;
+	int i;
+	for (i=0;i<LAYOUT_WAY;i++) {
+		if (layout_equal(&set[i], hash, str, sz, l, tags, tag_n)) {
+			e = &set[i];
+			break;
+		}
+	}
+	if (e == NULL) {
+		e = &set[0];
+		for (i=1;i<LAYOUT_WAY && e->text;i++) {
+			if (set[i].text == NULL || set[i].last < e->last) {
+				e = &set[i];
+			}
+		}
+		ARRAY(struct layout_char, c, sz + 1);
+		int cn = 0;
+		char utf8[7];
+		for (i=0;i<sz;) {
+			int len = unicode_len(str[i]);
+			int unicode = copystr(utf8, str+i, len);
+			i += len;
+			// measured even if the glyph worker hasn't rendered it yet
+			struct font_context ct = char_size(unicode, utf8, l->size, l->edge);
+			c[cn].w = ct.w + l->space_w;
+			c[cn].h = ct.h + l->space_h;
+			c[cn].unicode = unicode;
+			++cn;
+		}
+		// at most one linefeed for each char
+		layout_reserve(e, sz, tag_n + cn);
+		memcpy(e->text, str, sz);
+		e->text[sz] = 0;
+		memcpy(e->fields, tags, tag_n * sizeof(*tags));
+
+		struct layout_line line = { c, cn, e->fields + tag_n, 0 };
+		layout_lines(&line, l->width, &e->w, &e->h);
+
+		e->hash = hash;
+		e->width = l->width;
+		e->size = l->size;
+		e->edge = l->edge;
+		e->space_w = l->space_w;
+		e->space_h = l->space_h;
+		e->text_sz = sz;
+		e->tag_n = tag_n;
+		e->n = tag_n + line.lf_n;
+	}
+	e->last = ++LayoutClock;
+	*n = e->n;
+	*width = e->w;
+	*height = e->h;
+	return e->fields;
+}
+
 uint32_t
 label_get_color(struct pack_label * l, const struct sprite_trans *arg) {
     uint32_t color;
@@ -518,7 +1350,6 @@ raw_width(const char * str,  struct pack_label * l) {
 
 void
 label_rawdraw(const char * str, float fx, float y, struct pack_label * l) {
-	shader_texture(Tex, 0);
 	uint32_t color = l->color;
 	int edge = l->edge;
 	int size = l->size;
@@ -539,28 +1370,36 @@ label_rawdraw(const char * str, float fx, float y, struct pack_label * l) {
 	char utf8[7];
 	int i;
 	struct matrix mat = {{ 1024,0,0,1024,0,y * SCREEN_SCALE}};
+	struct label_quad q;
 	for (i=0; str[i];) {
 		int len = unicode_len(str[i]);
 		int unicode = copystr(utf8, str+i, len);
 		i+=len;
-		const struct dfont_rect * rect = dfont_lookup(Dfont, unicode, FONT_SIZE, edge);
+		const struct dfont_rect * rect = load_char(unicode, utf8, edge);
 		if (rect == NULL) {
-			rect = gen_char(unicode,utf8,FONT_SIZE,edge);
-			if (rect == NULL)
-				continue;
+			if (Async.budget > 0) {
+				x += char_size(unicode, utf8, size, edge).w + l->space_w;
+			}
+			continue;
 		}
-		mat.m[4]=x*SCREEN_SCALE;
-		draw_rect(rect,size,&mat,color,0);
+		init_quad(&q, rect, size, x*SCREEN_SCALE, 0);
+		shader_texture(Tex[rect->page], 0);
+		draw_quad(&q, &mat, color, 0);
 
-		x += (rect->w-1) * size / FONT_SIZE + l->space_w;
+		x += (glyph_w(rect)-1) * size / FONT_SIZE + l->space_w;
 	}
 }
 
-void
-label_draw(const struct rich_text *rich, struct pack_label * l, struct srt *srt, const struct sprite_trans *arg) {
-	shader_texture(Tex, 0);
-	uint32_t color = label_get_color(l, arg);
+static void
+build_mesh(const struct rich_text *rich, struct pack_label * l, struct label_mesh *mesh) {
 	const char *str = rich->text;
+	mesh->n = 0;
+	mesh->pages = 0;
+	mesh->valid = true;
+	mesh->generation = Generation;
+	mesh->label = *l;
+	// the glyphs generated for a later line may evict the rects of the quads built before
+	mesh->evict = dfont_evict(Dfont);
 
 	char utf8[7];
 	int i;
@@ -578,14 +1417,99 @@ label_draw(const struct rich_text *rich, struct pack_label * l, struct srt *srt,
 		float space_scale=1.0;
 		uint32_t lf = get_rich_filed_lf(rich, idx, &space_scale);
 		if((l->auto_scale == 0 && lf) || unicode == '\n') {
-				draw_line(rich, l, srt, arg, color, cy, w, pre, i, &char_cnt, space_scale);
+				build_line(rich, l, mesh, cy, w, pre, i, &char_cnt, space_scale);
 				cy += ch;
 				pre = i;
 				w = 0; ch = 0;
 		}
 		idx++;
 	}
-    
-	draw_line(rich, l, srt, arg, color, cy, w, pre, i, &char_cnt, 1.0);
+	build_line(rich, l, mesh, cy, w, pre, i, &char_cnt, 1.0);
+	if (mesh->evict != dfont_evict(Dfont)) {
+		// build again next time
+		mesh->valid = false;
+	}
+}
+
+static inline bool
+mesh_valid(const struct label_mesh *mesh, const struct pack_label *l) {
+	return mesh->valid && mesh->generation == Generation &&
+		mesh->evict == dfont_evict(Dfont) &&
+		memcmp(&mesh->label, l, sizeof(*l)) == 0;
+}
+
+// for the rich text without its own mesh
+static struct label_mesh *
+temp_mesh(int cap) {
+	static struct label_mesh *tmp = NULL;
+	if (tmp == NULL || tmp->cap < cap) {
+		free(tmp);
+		tmp = (struct label_mesh *)malloc(label_mesh_size(cap));
+		if (tmp == NULL)
+			return NULL;
+		tmp->cap = cap;
+	}
+	return tmp;
+}
+
+size_t
+label_mesh_size(int n) {
+	return sizeof(struct label_mesh) + (n > 0 ? n - 1 : 0) * sizeof(struct label_quad);
+}
+
+struct label_mesh *
+label_mesh_init(void *buffer, int n) {
+	struct label_mesh *mesh = (struct label_mesh *)buffer;
+	mesh->cap = n;
+	mesh->n = 0;
+	mesh->pages = 0;
+	mesh->valid = false;
+	return mesh;
+}
+
+void
+label_draw(const struct rich_text *rich, struct pack_label * l, struct srt *srt, const struct sprite_trans *arg) {
+	uint32_t color = label_get_color(l, arg);
+
+	struct label_mesh *mesh = rich->mesh;
+	if (mesh == NULL) {
+		mesh = temp_mesh(rich->text ? (int)strlen(rich->text) : 0);
+		if (mesh == NULL)
+			return;
+		build_mesh(rich, l, mesh);
+	} else if (!mesh_valid(mesh, l)) {
+		build_mesh(rich, l, mesh);
+	}
+
+	struct matrix mat;
+	if (arg->mat) {
+		mat = *arg->mat;
+	} else {
+		matrix_identity(&mat);
+	}
+	matrix_srt(&mat, srt);
+
+	// the quads of a page are drawn together, in one batch
+	uint32_t pages = mesh->pages;
+	int page;
+	for (page=0; pages; page++, pages >>= 1) {
+		if ((pages & 1) == 0)
+			continue;
+		shader_texture(Tex[page], 0);
+		uint32_t last = 0, field_color = color;
+		int i;
+		for (i=0;i<mesh->n;i++) {
+			const struct label_quad *q = &mesh->q[i];
+			if (q->page != page)
+				continue;
+			// keep the glyphs in use from eviction, as a lookup does
+			dfont_touch(Dfont, q->rect);
+			if (q->color != last) {
+				last = q->color;
+				field_color = last ? color_mul(last, color | 0xffffff) : color;
+			}
+			draw_quad(q, &mat, field_color, arg->additive);
+		}
+	}
 }
 
@@ -4,6 +4,8 @@
 #include "spritepack.h"
 #include "matrix.h"
 
+#include <stddef.h>
+
 #define LABEL_ALIGN_LEFT 0
 #define LABEL_ALIGN_RIGHT 1
 #define LABEL_ALIGN_CENTER 2
@@ -24,26 +26,57 @@ struct label_field {
 	};
 };
 
+struct label_mesh;
+
+// the fields applied to a char, compiled by label_rich_compile
+struct rich_char {
+	uint32_t color;	// 0 for the label color
+	int width;	// fixed x, 0 for none
+	int lf_scale;	// space scale of the line in 1/1000
+	bool lf;
+};
+
 struct rich_text {
 	int count;
 	int width;
 	int height;
   const char *text;
 	struct label_field *fields;
+	struct rich_char *chars;
+	int char_n;
+	struct label_mesh *mesh;	// glyph quads cache, NULL to build them every draw
 };
 
 struct render;
 void label_initrender(struct render *R);
 void label_load();
 void label_unload();
+// glyph atlas pages are created up to budget bytes
+void label_atlas(int budget);
 void label_flush();
+// glyphs in atlas are signed distance fields, one glyph serves all sizes and edge. it flushes the atlas
+void label_sdf(bool enable);
+// rasterize missing glyphs in a worker thread, and upload at most budget bytes of them per frame (in label_flush).
+// labels leave a blank advance for glyphs not ready. budget 0 (default) rasterizes in place
+void label_async(int budget);
+// rasterize the glyphs of str missing in the atlas ahead of drawing, and upload them together.
+// with label_async they are queued to the worker instead. it returns the number of glyphs not ready yet
+int label_prewarm(const char *str, int edge);
 
 void label_rawdraw(const char * str, float x, float y, struct pack_label * l);
 int label_rawline(const char * str, struct pack_label *l);
+// compile the fields of rich into chars, n is the char count of the text plus one
+void label_rich_compile(struct rich_text *rich, struct rich_char *chars, int n);
+// the glyph quads of a rich text are cached in a label_mesh of n chars, built in buffer of label_mesh_size(n) bytes
+size_t label_mesh_size(int n);
+struct label_mesh * label_mesh_init(void *buffer, int n);
 void label_draw(const struct rich_text *rich, struct pack_label * l, struct srt *srt, const struct sprite_trans *arg);
 void label_size(const char * str, struct pack_label * l, int* width, int* height);
 int label_char_size(struct pack_label* l, const char* chr, int* width, int* height, int* unicode);
 uint32_t label_get_color(struct pack_label * l, const struct sprite_trans *arg);
+// break str (sz bytes) into lines of label l. it returns the tags followed by the RL_LINEFEED fields for the line breaks,
+// and the text size. the result is cached by text, tags and label settings, and valid until the next call
+const struct label_field * label_layout(const char *str, int sz, struct pack_label *l, const struct label_field *tags, int tag_n, int *n, int *width, int *height);
 
 struct font_context {
 	int w;
@@ -0,0 +1,179 @@
+#include "linstancebuffer.h"
+#include "instancebuffer.h"
+#include "spritepack.h"
+
+#include <lua.h>
+#include <lauxlib.h>
+
+static struct instance_buffer *
+check_buffer(lua_State *L) {
+	return (struct instance_buffer *)luaL_checkudata(L, 1, "instancebuffer");
+}
+
+static int
+check_index(lua_State *L, struct instance_buffer *ib, int arg) {
+	int index = (int)luaL_checkinteger(L, arg);
+	if (index < 1 || index > ib->n) {
+		return luaL_error(L, "out of range([1, %d]):%d", ib->n, index);
+	}
+	return index - 1;
+}
+
+static int
+ldelbuffer(lua_State *L) {
+	struct instance_buffer *ib = (struct instance_buffer *)lua_touserdata(L, 1);
+	instancebuffer_exit(ib);
+	return 0;
+}
+
+static int
+lsize(lua_State *L) {
+	struct instance_buffer *ib = check_buffer(L);
+	lua_pushinteger(L, ib->n);
+	return 1;
+}
+
+static int
+lresize(lua_State *L) {
+	struct instance_buffer *ib = check_buffer(L);
+	int n = (int)luaL_checkinteger(L, 2);
+	if (n < 0) {
+		return luaL_error(L, "Invalid size %d", n);
+	}
+	instancebuffer_resize(ib, n);
+	return 0;
+}
+
+// ib:srt(index, x, y, [sx, sy, rot])
+static int
+lsrt(lua_State *L) {
+	struct instance_buffer *ib = check_buffer(L);
+	int index = check_index(L, ib, 2);
+	double x = luaL_checknumber(L, 3);
+	double y = luaL_checknumber(L, 4);
+	double sx = luaL_optnumber(L, 5, 1.0);
+	double sy = luaL_optnumber(L, 6, sx);
+	double rot = luaL_optnumber(L, 7, 0);
+	instancebuffer_srt(ib, index, x * SCREEN_SCALE, y * SCREEN_SCALE, sx * 1024, sy * 1024, rot * (EJMAT_R_FACTOR / 360.0));
+	return 0;
+}
+
+static int
+ltrans(lua_State *L) {
+	struct instance_buffer *ib = check_buffer(L);
+	int index = check_index(L, ib, 2);
+	double x = luaL_checknumber(L, 3);
+	double y = luaL_checknumber(L, 4);
+	instancebuffer_trans(ib, index, x * SCREEN_SCALE, y * SCREEN_SCALE);
+	return 0;
+}
+
+// ib:position({ x1, y1, x2, y2, ... }, [first])
+static int
+lposition(lua_State *L) {
+	struct instance_buffer *ib = check_buffer(L);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	int first = (int)luaL_optinteger(L, 3, 1) - 1;
+	int n = (int)lua_rawlen(L, 2) / 2;
+	if (first < 0 || first + n > ib->n) {
+		return luaL_error(L, "out of range([1, %d]):%d", ib->n, first + n);
+	}
+	int i;
+	for (i=0;i<n;i++) {
+		lua_rawgeti(L, 2, i*2+1);
+		lua_rawgeti(L, 2, i*2+2);
+		double x = lua_tonumber(L, -2);
+		double y = lua_tonumber(L, -1);
+		lua_pop(L, 2);
+		instancebuffer_trans(ib, first + i, x * SCREEN_SCALE, y * SCREEN_SCALE);
+	}
+	return 0;
+}
+
+// ib:matrix(index, [mat]) , copy the matrix in, or get a copy out
+static int
+lmatrix(lua_State *L) {
+	struct instance_buffer *ib = check_buffer(L);
+	int index = check_index(L, ib, 2);
+	if (lua_isnoneornil(L, 3)) {
+		struct matrix *m = (struct matrix *)lua_newuserdata(L, sizeof(struct matrix));
+		*m = ib->mat[index];
+		return 1;
+	}
+	struct matrix *m = (struct matrix *)lua_touserdata(L, 3);
+	if (m == NULL) {
+		return luaL_error(L, "Need a matrix");
+	}
+	ib->mat[index] = *m;
+	return 0;
+}
+
+// ib:color(index, color, [additive])
+static int
+lcolor(lua_State *L) {
+	struct instance_buffer *ib = check_buffer(L);
+	int index = check_index(L, ib, 2);
+	ib->color[index] = (uint32_t)luaL_checkinteger(L, 3);
+	if (!lua_isnoneornil(L, 4)) {
+		ib->additive[index] = (uint32_t)luaL_checkinteger(L, 4);
+	}
+	return 0;
+}
+
+// ib:fill(color, [additive]) , set all the instances
+static int
+lfill(lua_State *L) {
+	struct instance_buffer *ib = check_buffer(L);
+	uint32_t color = (uint32_t)luaL_checkinteger(L, 2);
+	int i;
+	for (i=0;i<ib->n;i++) {
+		ib->color[i] = color;
+	}
+	if (!lua_isnoneornil(L, 3)) {
+		uint32_t additive = (uint32_t)luaL_checkinteger(L, 3);
+		for (i=0;i<ib->n;i++) {
+			ib->additive[i] = additive;
+		}
+	}
+	return 0;
+}
+
+static int
+lnewbuffer(lua_State *L) {
+	int n = (int)luaL_optinteger(L, 1, 0);
+	if (n < 0) {
+		return luaL_error(L, "Invalid size %d", n);
+	}
+	struct instance_buffer *ib = (struct instance_buffer *)lua_newuserdata(L, sizeof(*ib));
+	instancebuffer_init(ib, n);
+	if (luaL_newmetatable(L, "instancebuffer")) {
+		luaL_Reg l[] = {
+			{ "size", lsize },
+			{ "resize", lresize },
+			{ "srt", lsrt },
+			{ "trans", ltrans },
+			{ "position", lposition },
+			{ "matrix", lmatrix },
+			{ "color", lcolor },
+			{ "fill", lfill },
+			{ NULL, NULL },
+		};
+		luaL_newlib(L, l);
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, ldelbuffer);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+int
+ejoy2d_instancebuffer(lua_State *L) {
+	luaL_Reg l[] ={
+		{ "new", lnewbuffer },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L,l);
+
+	return 1;
+}
@@ -0,0 +1,8 @@
+#ifndef ejoy2d_lua_instancebuffer_h
+#define ejoy2d_lua_instancebuffer_h
+
+#include <lua.h>
+
+int ejoy2d_instancebuffer(lua_State *L);
+
+#endif
@@ -55,8 +55,9 @@ _init_from_table(struct particle_config *ps, struct lua_State *L) {
 	ps->endSize = dict_float(L, "finishParticleSize");
 	ps->endSizeVar = dict_float(L, "finishParticleSizeVariance");
 
-	ps->sourcePosition.x = dict_float(L, "sourcePositionx");
-	ps->sourcePosition.y = dict_float(L, "sourcePositiony");
+	// particle.update puts the emitter at the origin of its matrix
+	ps->sourcePosition.x = 0;
+	ps->sourcePosition.y = 0;
 
 	ps->posVar.x = dict_float(L, "sourcePositionVariancex");
 	ps->posVar.y = dict_float(L, "sourcePositionVariancey");
@@ -103,40 +104,124 @@ _init_from_table(struct particle_config *ps, struct lua_State *L) {
 	return 1;
 }
 
-static struct particle_system *
-_new(struct lua_State *L) {
-	int maxParticles = dict_int(L,"maxParticles");
-	int totalsize = sizeof(struct particle_system) + maxParticles * (sizeof(struct particle) + sizeof(struct matrix)) + sizeof(struct particle_config);
-	struct particle_system * ps = (struct particle_system *)lua_newuserdata(L, totalsize);
-	lua_insert(L, -2);
-	memset(ps, 0, totalsize);
-	init_with_particles(ps, maxParticles);
-	if (!_init_from_table(ps->config, L)) {
-		lua_pop(L,2);
+// a queued update may still use it
+static int
+ldelete(lua_State *L) {
+	struct particle_system *ps = (struct particle_system *)lua_touserdata(L, 1);
+	particle_release(ps);
+	return 0;
+}
+
+// a config of 1 reference from the table at the top, NULL if the emitter mode is unknown
+static struct particle_config *
+_compile(lua_State *L, int totalParticles) {
+	struct particle_config *config = particle_config_new();
+	if (config == NULL) {
+		luaL_error(L, "no memory for particle config");
+	}
+	config->totalParticles = totalParticles;
+	if (!_init_from_table(config, L)) {
+		particle_config_release(config);
 		return NULL;
 	}
-	lua_pop(L,1);
-	return ps;
+	return config;
+}
+
+#define PARTICLE_CONFIG "particle.config"
+
+static struct particle_config *
+_toconfig(lua_State *L, int index) {
+	struct particle_config **c = (struct particle_config **)luaL_testudata(L, index, PARTICLE_CONFIG);
+	if (c == NULL)
+		return NULL;
+	return *c;
 }
 
 static int
-lnew(lua_State *L) {
+lconfig_delete(lua_State *L) {
+	struct particle_config **c = (struct particle_config **)lua_touserdata(L, 1);
+	particle_config_release(*c);
+	*c = NULL;
+	return 0;
+}
+
+// compile the config table once, for the systems to share
+static int
+lcompile(lua_State *L) {
 	luaL_checktype(L,1,LUA_TTABLE);
-	struct particle_system * ps = _new(L);
-	if (ps == NULL)
+	lua_settop(L,1);
+	struct particle_config **c = (struct particle_config **)lua_newuserdata(L, sizeof(*c));
+	*c = NULL;
+	if (luaL_newmetatable(L, PARTICLE_CONFIG)) {
+		lua_pushcfunction(L, lconfig_delete);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+	lua_pushvalue(L, 1);
+	*c = _compile(L, dict_int(L, "maxParticles"));
+	lua_pop(L, 1);
+	if (*c == NULL)
 		return 0;
 	return 1;
 }
 
+// new(config) : config is compiled (shared) or a table (a config of its own)
+static int
+lnew(lua_State *L) {
+	struct particle_config *config = _toconfig(L, 1);
+	int maxParticles;
+	if (config) {
+		maxParticles = config->totalParticles;
+	} else {
+		luaL_checktype(L,1,LUA_TTABLE);
+		lua_settop(L,1);
+		maxParticles = dict_int(L, "maxParticles");
+	}
+	int totalsize = (int)particle_system_size(maxParticles);
+	struct particle_system * ps = (struct particle_system *)lua_newuserdata(L, totalsize);
+	memset(ps, 0, totalsize);
+	if (luaL_newmetatable(L, "particle")) {
+		lua_pushcfunction(L, ldelete);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+	if (config) {
+		init_with_particles(ps, maxParticles, config);
+	} else {
+		lua_pushvalue(L, 1);
+		config = _compile(L, maxParticles);
+		lua_pop(L, 1);
+		if (config == NULL)
+			return 0;
+		init_with_particles(ps, maxParticles, config);
+		particle_config_release(config);
+	}
+	return 1;
+}
+
 static int
 lreset(lua_State *L) {
 	luaL_checktype(L,1,LUA_TUSERDATA);
 	struct particle_system *ps = (struct particle_system *)lua_touserdata(L, 1);
+	particle_wait(ps);
 	particle_system_reset(ps);
 
 	if (!lua_isnoneornil(L, 2))	{
-		if (!_init_from_table(ps->config, L))
-			luaL_error(L, "reset particle error");
+		struct particle_config *config = _toconfig(L, 2);
+		if (config) {
+			if (config->totalParticles > ps->allocatedParticles)
+				return luaL_error(L, "reset particle error : %d particles in %d", config->totalParticles, ps->allocatedParticles);
+			particle_system_config(ps, config);
+		} else {
+			luaL_checktype(L,2,LUA_TTABLE);
+			lua_pushvalue(L, 2);
+			config = _compile(L, ps->config->totalParticles);
+			lua_pop(L, 1);
+			if (config == NULL)
+				luaL_error(L, "reset particle error");
+			particle_system_config(ps, config);
+			particle_config_release(config);
+		}
 	}
 
 	return 1;
@@ -159,7 +244,8 @@ lupdate(lua_State *L) {
 		ps->config->sourcePosition.y = 0;
 	}*/
 
-	bool ok = particle_update(ps, dt, anchor);
+	// with particle workers, the update runs in the background until the system is drawn
+	bool ok = particle_update_async(ps, dt, anchor);
 	lua_pushboolean(L, ok);
 	return 1;
 }
@@ -171,16 +257,16 @@ ldata(lua_State *L) {
 	luaL_checktype(L,3,LUA_TTABLE);
 	struct particle_system *ps = (struct particle_system *)lua_touserdata(L, 1);
 	int edge = (int)luaL_checkinteger(L,4);
+	particle_wait(ps);
 	int n = ps->particleCount;
 	int i;
 	for (i=0;i<n;i++) {
-		struct particle *p = &ps->particles[i];
-		calc_particle_system_mat(p,&ps->matrix[i], edge);
+		calc_particle_system_mat(ps, i, &ps->matrix[i], edge);
 
 		lua_pushlightuserdata(L, &ps->matrix[i]);
 		lua_rawseti(L, 2, i+1);
 
-		uint32_t c = color4f(&p->color);
+		uint32_t c = particle_color(ps, i);
 		lua_pushinteger(L, c);
 		lua_rawseti(L, 3, i+1);
 	}
@@ -210,13 +296,100 @@ lgetuserdata(lua_State *L){
 static int
 ldeactive(lua_State *L){
 	struct particle_system *ps = (struct particle_system *)lua_touserdata(L, 1);
+	particle_wait(ps);
 	ps->isActive = false;
 	return 0;
 }
 
+static int
+lseed(lua_State *L){
+	luaL_checktype(L,1,LUA_TUSERDATA);
+	struct particle_system *ps = (struct particle_system *)lua_touserdata(L, 1);
+	lua_Integer seed = luaL_checkinteger(L, 2);
+	particle_wait(ps);
+	particle_system_seed(ps, (uint64_t)seed);
+	return 0;
+}
+
+static int
+lworkers(lua_State *L) {
+	if (!lua_isnoneornil(L, 1)) {
+		particle_workers((int)luaL_checkinteger(L, 1));
+	}
+	lua_pushinteger(L, particle_getworkers());
+	return 1;
+}
+
+static int
+lsync(lua_State *L) {
+	particle_sync();
+	return 0;
+}
+
+static void
+budget_number(lua_State *L, const char *key, float *v) {
+	if (lua_getfield(L, 1, key) != LUA_TNIL) {
+		*v = (float)luaL_checknumber(L, -1);
+	}
+	lua_pop(L, 1);
+}
+
+// budget { cap = particles, time = ms, lod = scale, cull = bool }, the fields not given are kept
+static int
+lbudget(lua_State *L) {
+	struct particle_budget b;
+	particle_getbudget(&b);
+	if (!lua_isnoneornil(L, 1)) {
+		luaL_checktype(L, 1, LUA_TTABLE);
+		if (lua_getfield(L, 1, "cap") != LUA_TNIL) {
+			b.cap = (int)luaL_checkinteger(L, -1);
+		}
+		lua_pop(L, 1);
+		budget_number(L, "time", &b.time);
+		budget_number(L, "lod", &b.lod);
+		if (lua_getfield(L, 1, "cull") != LUA_TNIL) {
+			b.cull = lua_toboolean(L, -1);
+		}
+		lua_pop(L, 1);
+		particle_budget(&b);
+		particle_getbudget(&b);
+	}
+	lua_createtable(L, 0, 4);
+	lua_pushinteger(L, b.cap);
+	lua_setfield(L, -2, "cap");
+	lua_pushnumber(L, b.time);
+	lua_setfield(L, -2, "time");
+	lua_pushnumber(L, b.lod);
+	lua_setfield(L, -2, "lod");
+	lua_pushboolean(L, b.cull);
+	lua_setfield(L, -2, "cull");
+	return 1;
+}
+
+static int
+lstat(lua_State *L) {
+	struct particle_stat stat;
+	particle_stat(&stat);
+	lua_createtable(L, 0, 6);
+	lua_pushinteger(L, (lua_Integer)stat.spawned);
+	lua_setfield(L, -2, "spawned");
+	lua_pushinteger(L, (lua_Integer)stat.culled);
+	lua_setfield(L, -2, "culled");
+	lua_pushinteger(L, (lua_Integer)stat.throttled);
+	lua_setfield(L, -2, "throttled");
+	lua_pushinteger(L, stat.alive);
+	lua_setfield(L, -2, "alive");
+	lua_pushnumber(L, stat.time);
+	lua_setfield(L, -2, "time");
+	lua_pushnumber(L, stat.emit);
+	lua_setfield(L, -2, "emit");
+	return 1;
+}
+
 static int
 lconfig(lua_State *L){
 	struct particle_system *ps = (struct particle_system *)lua_touserdata(L, 1);
+	particle_wait(ps);
 
 	if (lua_isnoneornil(L, 2)){
 		size_t sz = sizeof(struct particle_config);
@@ -230,8 +403,18 @@ lconfig(lua_State *L){
 		if (sz != pack_sz)
 			return luaL_error(L, "string size err(%d, %d)", pack_sz, sz);
 		
-		struct particle_config* input = (struct particle_config*)p;
-		memcpy(ps->config, input, sz);
+		// the config may be shared, the system gets a new one
+		struct particle_config *config = particle_config_new();
+		if (config == NULL)
+			return luaL_error(L, "no memory for particle config");
+		memcpy(config, p, sz);
+		if (config->totalParticles > ps->allocatedParticles) {
+			int n = config->totalParticles;
+			particle_config_release(config);
+			return luaL_error(L, "particle config error : %d particles in %d", n, ps->allocatedParticles);
+		}
+		particle_system_config(ps, config);
+		particle_config_release(config);
 		return 0;
 	}
 }
@@ -240,12 +423,18 @@ int
 ejoy2d_particle(lua_State *L) {
 	luaL_Reg l[] = {
 		{ "new", lnew },
+		{ "compile", lcompile },
 		{ "reset", lreset },
 		{ "deactive", ldeactive },
 		{ "update", lupdate },
 		{ "data", ldata },
 		{ "usr_data", lgetuserdata },
 		{ "config", lconfig },
+		{ "seed", lseed },
+		{ "workers", lworkers },
+		{ "sync", lsync },
+		{ "budget", lbudget },
+		{ "stat", lstat },
 		{ NULL, NULL },
 	};
 
@@ -9,7 +9,7 @@
 static int
 ldelbuffer(lua_State *L) {
 	struct render_buffer *rb = (struct render_buffer *)lua_touserdata(L, 1);
-	renderbuffer_unload(rb);
+	renderbuffer_exit(rb);
 	return 0;
 }
 
@@ -49,8 +49,12 @@ ldrawbuffer(lua_State *L) {
 
 static int
 lnewbuffer(lua_State *L) {
+	int capacity = (int)luaL_optinteger(L, 1, MAX_COMMBINE);
+	if (capacity <= 0) {
+		return luaL_error(L, "Invalid capacity %d", capacity);
+	}
 	struct render_buffer *rb = (struct render_buffer *)lua_newuserdata(L, sizeof(*rb));
-	renderbuffer_init(rb);
+	renderbuffer_init(rb, capacity, 1);
 	if (luaL_newmetatable(L, "renderbuffer")) {
 		luaL_Reg l[] = {
 			{ "add", laddsprite },
@@ -10,6 +10,7 @@
 #include "render.h"
 #include "material.h"
 #include "fault.h"
+#include "label.h"
 
 static int
 lload(lua_State *L) {
@@ -114,6 +115,55 @@ lversion(lua_State *L) {
 	return 1;
 }
 
+static int
+lstat(lua_State *L) {
+	struct render_stat stat;
+	shader_getstat(&stat);
+	lua_createtable(L, 0, 8);
+	lua_pushinteger(L, drawcall_count());
+	lua_setfield(L, -2, "batch");
+	lua_pushinteger(L, drawcall_saved());
+	lua_setfield(L, -2, "saved");
+	lua_pushinteger(L, stat.drawcall);
+	lua_setfield(L, -2, "drawcall");
+	lua_pushinteger(L, stat.primitive);
+	lua_setfield(L, -2, "primitive");
+	lua_pushinteger(L, stat.state_change);
+	lua_setfield(L, -2, "state_change");
+	lua_pushinteger(L, stat.buffer_upload);
+	lua_setfield(L, -2, "buffer_upload");
+	lua_pushinteger(L, stat.texture_upload);
+	lua_setfield(L, -2, "texture_upload");
+	lua_pushinteger(L, stat.fence_wait);
+	lua_setfield(L, -2, "fence_wait");
+	return 1;
+}
+
+static int
+ldeferred(lua_State *L) {
+	shader_deferred(lua_toboolean(L, 1));
+	return 0;
+}
+
+static int
+lmultitexture(lua_State *L) {
+	shader_multitexture(lua_toboolean(L, 1));
+	return 0;
+}
+
+static int
+lbatch(lua_State *L) {
+	if (!lua_isnoneornil(L, 1)) {
+		int n = (int)luaL_checkinteger(L, 1);
+		if (n <= 0) {
+			return luaL_error(L, "Invalid batch size %d", n);
+		}
+		shader_setbatch(n);
+	}
+	lua_pushinteger(L, shader_getbatch());
+	return 1;
+}
+
 static int
 lclear(lua_State *L) {
 	uint32_t c = luaL_optinteger(L, 1, 0xff000000);
@@ -207,6 +257,24 @@ lshader_texture(lua_State *L) {
 	return 0;
 }
 
+static int
+ltext_sdf(lua_State *L) {
+	label_sdf(lua_toboolean(L, 1));
+	return 0;
+}
+
+static int
+ltext_async(lua_State *L) {
+	label_async(luaL_optinteger(L, 1, 0));
+	return 0;
+}
+
+static int
+ltext_atlas(lua_State *L) {
+	label_atlas(luaL_checkinteger(L, 1));
+	return 0;
+}
+
 int 
 ejoy2d_shader(lua_State *L) {
 	luaL_Reg l[] = {
@@ -216,11 +284,18 @@ ejoy2d_shader(lua_State *L) {
 		{"blend", lblend},
 		{"clear", lclear},
 		{"version", lversion},
+		{"stat", lstat},
+		{"deferred", ldeferred},
+		{"multitexture", lmultitexture},
+		{"batch", lbatch},
 		{"uniform_bind", luniform_bind },
 		{"uniform_set", luniform_set },
 		{"material_setuniform", lmaterial_setuniform },
 		{"material_settexture", lmaterial_settexture },
 		{"shader_texture", lshader_texture },
+		{"text_sdf", ltext_sdf },
+		{"text_async", ltext_async },
+		{"text_atlas", ltext_atlas },
 		{NULL,NULL},
 	};
 	luaL_newlib(L,l);
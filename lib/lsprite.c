@@ -8,10 +8,13 @@
 #include "render.h"
 #include "texture.h"
 #include "lutls.h"
+#include "instancebuffer.h"
+#include "array.h"
 
 #include <lua.h>
 #include <lauxlib.h>
 #include <string.h>
+#include <stdlib.h>
 
 #define SRT_X 1
 #define SRT_Y 2
@@ -41,7 +44,10 @@ newlabel(lua_State *L, struct pack_label *label) {
 	s->t.color = 0xffffffff;
 	s->t.additive = 0;
 	s->t.program = PROGRAM_DEFAULT;
+	s->t.mirror_x = false;
+	s->t.mirror_y = false;
 	s->flags = 0;
+	sprite_world_init(s);
 	s->name = NULL;
 	s->id = 0;
 	s->type = TYPE_LABEL;
@@ -127,7 +133,10 @@ newanchor(lua_State *L) {
 	s->t.color = 0xffffffff;
 	s->t.additive = 0;
 	s->t.program = PROGRAM_DEFAULT;
+	s->t.mirror_x = false;
+	s->t.mirror_y = false;
 	s->flags = SPRFLAG_INVISIBLE;  // anchor is invisible by default
+	sprite_world_init(s);
 	s->name = NULL;
 	s->id = ANCHOR_ID;
 	s->type = TYPE_ANCHOR;
@@ -305,6 +314,10 @@ lsetvisible(lua_State *L) {
 	struct sprite *s = self(L);
 	if (lua_toboolean(L, 2)) {
 		s->flags &= ~SPRFLAG_INVISIBLE;
+		if (s->type == TYPE_ANCHOR) {
+			// a visible anchor updates its matrix, the parent can't be culled
+			sprite_unbound(s);
+		}
 	} else {
 		s->flags |= SPRFLAG_INVISIBLE;
 	}
@@ -319,6 +332,8 @@ lsetmirrorx(lua_State *L) {
 	} else {
 		s->t.mirror_x = false;
 	}
+	sprite_dirty(s);
+	sprite_unbound(s->parent);
 	return 0;
 }
 
@@ -330,6 +345,8 @@ lsetmirrory(lua_State *L) {
 	} else {
 		s->t.mirror_y = false;
 	}
+	sprite_dirty(s);
+	sprite_unbound(s->parent);
 	return 0;
 }
 
@@ -377,6 +394,8 @@ lsetmat(lua_State *L) {
 		return luaL_error(L, "Need a matrix");
 	s->t.mat = &s->mat;
 	s->mat = *m;
+	sprite_dirty(s);
+	sprite_unbound(s->parent);
 
 	return 0;
 }
@@ -388,6 +407,9 @@ lgetmat(lua_State *L) {
 		s->t.mat = &s->mat;
 		matrix_identity(&s->mat);
 	}
+	// the matrix may be changed through the pointer
+	s->flags |= SPRFLAG_VOLATILE;
+	sprite_unbound(s->parent);
 	lua_pushlightuserdata(L, s->t.mat);
 	return 1;
 }
@@ -453,6 +475,7 @@ lsetprogram(lua_State *L) {
 	} else {
 		s->t.program = (int)luaL_checkinteger(L,2);
 	}
+	sprite_dirty(s);
 	if (s->material) {
 		s->material = NULL;
 		get_reftable(L, 1);
@@ -517,6 +540,97 @@ lhasparent(lua_State *L) {
 	return 1;
 }
 
+// read cnt fields {start, end, type, val} from the table at index
+static void
+read_fields(lua_State *L, int index, struct label_field *fields, int cnt) {
+	int i;
+	for (i=0; i<cnt; i++) {
+		lua_rawgeti(L, index, i+1);
+		if (!lua_istable(L,-1)) {
+			luaL_error(L, "rich text unit must be table");
+		}
+
+		lua_rawgeti(L, -1, 1);  //start
+		((struct label_field*)(fields+i))->start = (uint32_t)luaL_checkinteger(L, -1);
+		lua_pop(L, 1);
+
+    lua_rawgeti(L, -1, 2);  //end
+		((struct label_field*)(fields+i))->end = (uint32_t)luaL_checkinteger(L, -1);
+    lua_pop(L, 1);
+
+		lua_rawgeti(L, -1, 3);  //type
+		uint32_t type = (uint32_t)luaL_checkinteger(L, -1);
+		((struct label_field*)(fields+i))->type = type;
+		lua_pop(L, 1);
+		
+		lua_rawgeti(L, -1, 4); //val
+		if (type == RL_COLOR) {
+			((struct label_field*)(fields+i))->color = (uint32_t)luaL_checkinteger(L, -1);
+		} else {
+			((struct label_field*)(fields+i))->val = (int)luaL_checkinteger(L, -1);
+		}
+		lua_pop(L, 1);
+
+		//extend here
+
+		lua_pop(L, 1);
+	}
+}
+
+static int
+utf8_chars(const char *str, size_t sz) {
+	int n = 0;
+	size_t i;
+	for (i=0;i<sz;i++) {
+		if ((str[i] & 0xc0) != 0x80)
+			++n;
+	}
+	return n;
+}
+
+// sprite, text, tags : the line breaks are added by label_layout
+static int
+settext_layout(lua_State *L, struct sprite *s) {
+	size_t sz;
+	const char *txt = lua_tolstring(L, 2, &sz);
+	int tag_n = 0;
+	if (lua_istable(L, 3)) {
+		tag_n = lua_rawlen(L, 3);
+	}
+	ARRAY(struct label_field, tags, tag_n + 1);
+	read_fields(L, 3, tags, tag_n);
+
+	int n, width, height;
+	const struct label_field *fields = label_layout(txt, (int)sz, s->s.label, tags, tag_n, &n, &width, &height);
+
+	// one quad per char at most
+	int chars = utf8_chars(txt, sz);
+	size_t chars_offset = sizeof(struct rich_text) + n * sizeof(struct label_field);
+	size_t mesh_offset = chars_offset + (chars + 1) * sizeof(struct rich_char);
+	mesh_offset = (mesh_offset + 15) & ~(size_t)15;
+
+	struct rich_text *rich = (struct rich_text*)lua_newuserdata(L, mesh_offset + label_mesh_size(chars));
+	rich->text = txt;
+	rich->count = n;
+	rich->width = width;
+	rich->height = height;
+	rich->fields = (struct label_field*)(rich + 1);
+	memcpy(rich->fields, fields, n * sizeof(struct label_field));
+	label_rich_compile(rich, (struct rich_char *)((char *)rich + chars_offset), chars + 1);
+	rich->mesh = label_mesh_init((char *)rich + mesh_offset, chars);
+
+	get_reftable(L, 1);
+	lua_createtable(L, 2, 0);	//sprite, text, tags, userdata, uservalue, table
+	lua_pushvalue(L, -3);
+	lua_rawseti(L, -2, 1);
+	lua_pushvalue(L, 2);
+	lua_rawseti(L, -2, 2);
+	lua_setfield(L, -2, "richtext");
+
+	s->data.rich_text = rich;
+	return 0;
+}
+
 static int
 lsettext(lua_State *L) {
 	struct sprite *s = self(L);
@@ -531,6 +645,9 @@ lsettext(lua_State *L) {
 		lua_setfield(L, -2, "richtext");
 		return 0;
 	}
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		return settext_layout(L, s);
+	}
 /*  if (lua_isstring(L, 2)) {
     s->data.rich_text = (struct rich_text*)lua_newuserdata(L, sizeof(struct rich_text));
     s->data.rich_text->text = lua_tostring(L, 2);
@@ -565,6 +682,7 @@ lsettext(lua_State *L) {
 
 	rich->text = txt;
   rich->count = cnt;
+	rich->mesh = NULL;
 	lua_rawgeti(L, 2, 3);
 	rich->width = (int)luaL_checkinteger(L, -1);
 	lua_pop(L, 1);
@@ -573,44 +691,15 @@ lsettext(lua_State *L) {
 	rich->height = (int)luaL_checkinteger(L, -1);
 	lua_pop(L, 1);
 	
-	int size = cnt * sizeof(struct label_field);
+	// the fields, followed by the compiled chars
+	int chars = utf8_chars(txt, strlen(txt));
+	size_t size = cnt * sizeof(struct label_field) + (chars + 1) * sizeof(struct rich_char);
 	rich->fields = (struct label_field*)lua_newuserdata(L, size);
 
-	struct label_field *fields = rich->fields;
-	int i;
   lua_rawgeti(L, 2, 2);
-	for (i=0; i<cnt; i++) {
-		lua_rawgeti(L, -1, i+1);
-		if (!lua_istable(L,-1)) {
-			return luaL_error(L, "rich text unit must be table");
-		}
-
-		lua_rawgeti(L, -1, 1);  //start
-		((struct label_field*)(fields+i))->start = (uint32_t)luaL_checkinteger(L, -1);
-		lua_pop(L, 1);
-
-    lua_rawgeti(L, -1, 2);  //end
-		((struct label_field*)(fields+i))->end = (uint32_t)luaL_checkinteger(L, -1);
-    lua_pop(L, 1);
-
-		lua_rawgeti(L, -1, 3);  //type
-		uint32_t type = (uint32_t)luaL_checkinteger(L, -1);
-		((struct label_field*)(fields+i))->type = type;
-		lua_pop(L, 1);
-		
-		lua_rawgeti(L, -1, 4); //val
-		if (type == RL_COLOR) {
-			((struct label_field*)(fields+i))->color = (uint32_t)luaL_checkinteger(L, -1);
-		} else {
-			((struct label_field*)(fields+i))->val = (int)luaL_checkinteger(L, -1);
-		}
-		lua_pop(L, 1);
-
-		//extend here
-
-		lua_pop(L, 1);
-	}
+	read_fields(L, lua_gettop(L), rich->fields, cnt);
   lua_pop(L, 1);
+	label_rich_compile(rich, (struct rich_char *)(rich->fields + cnt), chars + 1);
 
 	get_reftable(L, 1);
 
@@ -777,6 +866,7 @@ lsetcolor(lua_State *L) {
 	struct sprite *s = self(L);
 	uint32_t color = (uint32_t)luaL_checkinteger(L,2);
 	s->t.color = color;
+	sprite_dirty(s);
 	return 0;
 }
 
@@ -785,6 +875,7 @@ lsetalpha(lua_State *L) {
 	struct sprite *s = self(L);
 	uint8_t alpha = (uint8_t)luaL_checkinteger(L, 2);
 	s->t.color = (s->t.color & 0x00ffffff) | (alpha << 24);
+	sprite_dirty(s);
 	return 0;
 }
 
@@ -807,6 +898,7 @@ lsetadditive(lua_State *L) {
 	struct sprite *s = self(L);
 	uint32_t additive = (uint32_t)luaL_checkinteger(L,2);
 	s->t.additive = additive;
+	sprite_dirty(s);
 	return 0;
 }
 
@@ -1188,11 +1280,14 @@ lset_particle(lua_State *L) {
 		s->data.ps = NULL;
 	} else {
 		s->data.ps = (struct particle_system*)lua_touserdata(L, 2);
+		// particles fly out of the picture
+		sprite_unbound(s);
 	
 		int aabb[4];
 		sprite_aabb(s, NULL, false, true, aabb);
 		int width = abs(aabb[2] - aabb[0]);
 		int height = abs(aabb[3] - aabb[1]);
+		particle_wait(s->data.ps);
 		s->data.ps->edge = width > height ? width : height;
 	}
 
@@ -1220,20 +1315,130 @@ lset_anchor_particle(lua_State *L) {
 	return 0;
 }
 
+// the instance shader draws plain pictures : no program, material nor mirror in the sprite and its children
+static int
+instance_plain(struct sprite *s) {
+	if (s->material || s->t.program != PROGRAM_DEFAULT || s->t.mirror_x || s->t.mirror_y)
+		return 0;
+	if (s->type == TYPE_ANIMATION) {
+		int i;
+		for (i=0;i<s->s.ani->component_number;i++) {
+			struct sprite *child = s->data.children[i];
+			if (child && !instance_plain(child))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+// Instanced path of multi_draw : the sprite is flattened into local quads once,
+// and each draw only sends a matrix, color and additive per instance.
+// returns NULL if the sprite can't be drawn in this way (more than one texture, labels, particles, etc.)
+static struct render_buffer *
+instance_mesh(struct sprite *s) {
+	static struct render_buffer mesh;
+	if (!shader_instance_support() || !instance_plain(s))
+		return NULL;
+	if (mesh.vb == NULL) {
+		renderbuffer_init(&mesh, 64, 1);
+	}
+	renderbuffer_clear(&mesh);
+	struct sprite_trans t = s->t;
+	s->t.mat = NULL;
+	s->t.color = 0xffffffff;
+	s->t.additive = 0;
+	int r = renderbuffer_drawsprite(&mesh, s);
+	s->t = t;
+	if (r != 0 || mesh.object == 0)
+		return NULL;
+	return &mesh;
+}
+
+static struct instance *
+instance_buffer(int n) {
+	static struct instance *buffer = NULL;
+	static int cap = 0;
+	if (n > cap) {
+		cap = n;
+		buffer = (struct instance *)realloc(buffer, cap * sizeof(struct instance));
+	}
+	return buffer;
+}
+
+// Instances come from an instancebuffer, or from the tables of matrix, color and additive
+// (additive index is 0 if there is no additive table).
+struct instance_source {
+	struct instance_buffer *ib;
+	int mat;
+	int color;
+	int additive;
+};
+
+static int
+instance_source(lua_State *L, struct instance_source *src, int cnt, int index, int color, int additive) {
+	src->ib = (struct instance_buffer *)luaL_testudata(L, index, "instancebuffer");
+	if (src->ib) {
+		if (src->ib->n < cnt) {
+			return luaL_error(L, "instance buffer size less then particle count");
+		}
+		return 0;
+	}
+	src->mat = index;
+	src->color = color;
+	src->additive = additive;
+	luaL_checktype(L, index, LUA_TTABLE);
+	if (lua_rawlen(L, index) < cnt) {
+		return luaL_error(L, "matrix length less then particle count");
+	}
+	if (color) {
+		luaL_checktype(L, color, LUA_TTABLE);
+		if (lua_rawlen(L, color) < cnt) {
+			return luaL_error(L, "color length less then particle count");
+		}
+	}
+	if (additive) {
+		luaL_checktype(L, additive, LUA_TTABLE);
+		if (lua_rawlen(L, additive) < cnt) {
+			return luaL_error(L, "additive length less then particle count");
+		}
+	}
+	return 0;
+}
+
+// fill the matrix, color and additive of instance i into t, keep the fields the source doesn't have.
+static inline void
+instance_read(lua_State *L, struct instance_source *src, int i, struct sprite_trans *t) {
+	struct instance_buffer *ib = src->ib;
+	if (ib) {
+		t->mat = &ib->mat[i];
+		t->color = ib->color[i];
+		t->additive = ib->additive[i];
+		return;
+	}
+	lua_rawgeti(L, src->mat, i+1);
+	t->mat = (struct matrix *)lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	if (src->color) {
+		lua_rawgeti(L, src->color, i+1);
+		t->color = (uint32_t)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+	}
+	if (src->additive) {
+		lua_rawgeti(L, src->additive, i+1);
+		t->additive = (uint32_t)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+	}
+}
+
+// sprite:matrix_multi_draw(mat, cnt, matrixs, colors) or sprite:matrix_multi_draw(mat, cnt, instancebuffer)
 static int
 lmatrix_multi_draw(lua_State *L) {
 	struct sprite *s = self(L);
 	int cnt = (int)luaL_checkinteger(L,3);
 	if (cnt == 0)
 		return 0;
-	luaL_checktype(L,4,LUA_TTABLE);
-	luaL_checktype(L,5,LUA_TTABLE);
-	if (lua_rawlen(L, 4) < cnt) {
-		return luaL_error(L, "matrix length must less then particle count");
-	}
-	if (lua_rawlen(L, 5) < cnt) {
-		return luaL_error(L, "color length must less then particle count");
-	}
+	struct instance_source src;
+	instance_source(L, &src, cnt, 4, 5, 0);
 
 	struct matrix *mat = (struct matrix *)lua_touserdata(L, 2);
 
@@ -1241,52 +1446,55 @@ lmatrix_multi_draw(lua_State *L) {
 		s->t.mat = &s->mat;
 		matrix_identity(&s->mat);
 	}
-	struct matrix *parent_mat = s->t.mat;
-	uint32_t parent_color = s->t.color;
+	struct sprite_trans parent = s->t;
 
 	int i;
-	if (mat) {
+	struct render_buffer *mesh = instance_mesh(s);
+	if (mesh) {
+		struct instance *inst = instance_buffer(cnt);
+		struct sprite_trans t = parent;
 		struct matrix tmp;
 		for (i = 0; i < cnt; i++) {
-			lua_rawgeti(L, 4, i+1);
-			lua_rawgeti(L, 5, i+1);
-			struct matrix *m = (struct matrix *)lua_touserdata(L, -2);
-			matrix_mul(&tmp, m, mat);
-			s->t.mat = &tmp;
-			s->t.color = (uint32_t)lua_tointeger(L, -1);
-			lua_pop(L, 2);
-
-			sprite_draw(s, NULL);
+			instance_read(L, &src, i, &t);
+			struct matrix *m = t.mat;
+			if (mat && m) {
+				matrix_mul(&tmp, m, mat);
+				m = &tmp;
+			} else if (m == NULL) {
+				m = mat;
+			}
+			shader_instance(&inst[i], m, t.color, t.additive);
 		}
-	} else {
-		for (i = 0; i < cnt; i++) {
-			lua_rawgeti(L, 4, i+1);
-			lua_rawgeti(L, 5, i+1);
-			struct matrix *m = (struct matrix *)lua_touserdata(L, -2);
-			s->t.mat = m;
-			s->t.color = (uint32_t)lua_tointeger(L, -1);
-			lua_pop(L, 2);
+		shader_drawinstance(mesh, cnt, inst);
+		return 0;
+	}
 
-			sprite_draw(s, NULL);
+	struct matrix tmp;
+	for (i = 0; i < cnt; i++) {
+		instance_read(L, &src, i, &s->t);
+		sprite_dirty(s);
+		if (mat) {
+			matrix_mul(&tmp, s->t.mat, mat);
+			s->t.mat = &tmp;
 		}
+		sprite_draw(s, NULL);
 	}
 
-	s->t.mat = parent_mat;
-	s->t.color = parent_color;
+	s->t = parent;
+	sprite_dirty(s);
 
 	return 0;
 }
 
+// sprite:multi_draw_test(srt, cnt, matrixs, x, y) or sprite:multi_draw_test(srt, cnt, instancebuffer, x, y)
 static int
 lmulti_draw_test(lua_State *L) {
 	struct sprite *s = self(L);
 	int cnt = (int)luaL_checkinteger(L,3);
 	if (cnt == 0)
 		return 0;
-	luaL_checktype(L,4,LUA_TTABLE);
-	if (lua_rawlen(L, 4) < cnt) {
-		return luaL_error(L, "matrix length less then fixed count");
-	}
+	struct instance_source src;
+	instance_source(L, &src, cnt, 4, 0, 0);
 	float x = luaL_checknumber(L, 5);
 	float y = luaL_checknumber(L, 6);
 
@@ -1297,21 +1505,21 @@ lmulti_draw_test(lua_State *L) {
 		s->t.mat = &s->mat;
 		matrix_identity(&s->mat);
 	}
-	struct matrix *parent_mat = s->t.mat;
+	struct sprite_trans parent = s->t;
 
 	int i;
 	int hit_x=0, hit_y=0;
 	struct sprite* touched = NULL;
 	for (i=0; i<cnt; i++) {
-		lua_rawgeti(L, 4, i+1);
-		s->t.mat = (struct matrix *)lua_touserdata(L, -1);
-		lua_pop(L, 1);
+		instance_read(L, &src, i, &s->t);
+		sprite_dirty(s);
 
 		touched = sprite_test(s, &srt, x*SCREEN_SCALE, y*SCREEN_SCALE, &hit_x, &hit_y);
 		if (touched) break;
 	}
 
-	s->t.mat = parent_mat;
+	s->t = parent;
+	sprite_dirty(s);
 
 	if (touched){
 		lua_settop(L,1);
@@ -1321,24 +1529,15 @@ lmulti_draw_test(lua_State *L) {
 	return 0;
 }
 
+// sprite:multi_draw(srt, cnt, matrixs, colors, [additives]) or sprite:multi_draw(srt, cnt, instancebuffer)
 static int
 lmulti_draw(lua_State *L) {
 	struct sprite *s = self(L);
 	int cnt = (int)luaL_checkinteger(L,3);
 	if (cnt == 0)
 		return 0;
-	int n = lua_gettop(L);
-	luaL_checktype(L,4,LUA_TTABLE);
-	luaL_checktype(L,5,LUA_TTABLE);
-	if (lua_rawlen(L, 4) < cnt) {
-		return luaL_error(L, "matrix length less then particle count");
-	}
-    if (n == 6) {
-        luaL_checktype(L,6,LUA_TTABLE);
-        if (lua_rawlen(L, 6) < cnt) {
-            return luaL_error(L, "additive length less then particle count");
-        }
-    }
+	struct instance_source src;
+	instance_source(L, &src, cnt, 4, 5, lua_gettop(L) == 6 ? 6 : 0);
 	struct srt srt;
 	fill_srt(L, &srt, 2);
 
@@ -1346,36 +1545,44 @@ lmulti_draw(lua_State *L) {
 		s->t.mat = &s->mat;
 		matrix_identity(&s->mat);
 	}
+	struct sprite_trans self_trans = s->t;
 	struct matrix *parent_mat = s->t.mat;
 	uint32_t parent_color = s->t.color;
 
 	int i;
-    if (n == 5) {
-        for (i = 0; i < cnt; i++) {
-            lua_rawgeti(L, 4, i+1);
-            lua_rawgeti(L, 5, i+1);
-            s->t.mat = (struct matrix *)lua_touserdata(L, -2);
-            s->t.color = (uint32_t)lua_tointeger(L, -1);
-            lua_pop(L, 2);
-
-            sprite_draw_as_child(s, &srt, parent_mat, parent_color);
-        }
-    }else {
-        for (i = 0; i < cnt; i++) {
-            lua_rawgeti(L, 4, i+1);
-            lua_rawgeti(L, 5, i+1);
-            lua_rawgeti(L, 6, i+1);
-            s->t.mat = (struct matrix *)lua_touserdata(L, -3);
-            s->t.color = (uint32_t)lua_tointeger(L, -2);
-            s->t.additive = (uint32_t)lua_tointeger(L, -1);
-            lua_pop(L, 3);
-
-            sprite_draw_as_child(s, &srt, parent_mat, parent_color);
-        }
-    }
+	struct render_buffer *mesh = instance_mesh(s);
+	if (mesh) {
+		struct instance *inst = instance_buffer(cnt);
+		struct sprite_trans parent;
+		parent.mat = parent_mat;
+		parent.color = parent_color;
+		parent.additive = 0;
+		parent.program = PROGRAM_DEFAULT;
+		parent.mirror_x = 0;
+		parent.mirror_y = 0;
+		struct sprite_trans st = s->t;
+		struct sprite_trans temp;
+		struct matrix temp_matrix;
+		struct matrix m;
+		for (i = 0; i < cnt; i++) {
+			instance_read(L, &src, i, &st);
+			struct sprite_trans *t = sprite_trans_mul(&st, &parent, &temp, &temp_matrix);
+			m = *t->mat;
+			matrix_srt(&m, &srt);
+			shader_instance(&inst[i], &m, t->color, t->additive);
+		}
+		shader_drawinstance(mesh, cnt, inst);
+		return 0;
+	}
 
-	s->t.mat = parent_mat;
-	s->t.color = parent_color;
+	for (i = 0; i < cnt; i++) {
+		instance_read(L, &src, i, &s->t);
+		sprite_dirty(s);
+		sprite_draw_as_child(s, &srt, parent_mat, parent_color);
+	}
+
+	s->t = self_trans;
+	sprite_dirty(s);
 
 	return 0;
 }
@@ -1465,6 +1672,8 @@ lps(lua_State *L) {
 		matrix_identity(m);
 		s->t.mat = m;
 	}
+	sprite_dirty(s);
+	sprite_unbound(s->parent);
 	int *mat = m->m;
 	int n = lua_gettop(L);
 	int x,y,scale;
@@ -1510,6 +1719,8 @@ lps2(lua_State *L) {
 		matrix_identity(m);
 		s->t.mat = m;
 	}
+	sprite_dirty(s);
+	sprite_unbound(s->parent);
 	int *mat = m->m;
 	int n = lua_gettop(L);
 	int x,y,scale;
@@ -1555,6 +1766,8 @@ lsr(lua_State *L) {
 		matrix_identity(m);
 		s->t.mat = m;
 	}
+	sprite_dirty(s);
+	sprite_unbound(s->parent);
 	int sx=1024,sy=1024,r=0;
 	int n = lua_gettop(L);
 	switch (n) {
@@ -1588,10 +1801,19 @@ lrecursion_frame(lua_State *L) {
 
 static int
 lenable_visible_test(lua_State *L) {
-	// todo: remove this api
+	sprite_enable_visible_test(lua_isnoneornil(L, 1) || lua_toboolean(L, 1));
 	return 0;
 }
 
+static int
+lvisible_stat(lua_State *L) {
+	int test, culled;
+	sprite_visible_stat(&test, &culled);
+	lua_pushinteger(L, test);
+	lua_pushinteger(L, culled);
+	return 2;
+}
+
 static int
 lcalc_matrix(lua_State *L) {
 	struct sprite * s = self(L);
@@ -1728,7 +1950,10 @@ lnewproxy(lua_State *L) {
 	s->t.color = 0xffffffff;
 	s->t.additive = 0;
 	s->t.program = PROGRAM_DEFAULT;
-	s->flags = SPRFLAG_MULTIMOUNT;
+	s->t.mirror_x = false;
+	s->t.mirror_y = false;
+	s->flags = SPRFLAG_MULTIMOUNT | SPRFLAG_UNBOUND;	// dummy pack has no bound
+	sprite_world_init(s);
 	s->name = NULL;
 	s->id = 0;
 	s->type = TYPE_ANIMATION;
@@ -1789,9 +2014,9 @@ lnewdfont(lua_State *L) {
 	int id = (int)luaL_checkinteger(L, 4);
 	
 	lua_createtable(L, 0, 1);
-	size_t size = dfont_data_size(width, height);
+	size_t size = dfont_data_size(width, height, 1);
 	void * d = lua_newuserdata(L, size);
-	dfont_init(d, width, height);
+	dfont_init(d, width, height, 1);
 	lua_setfield(L, -2, "__obj");
 	
 	const char* err = texture_load(id, (enum TEXTURE_FORMAT)format, width, height, NULL, 0);
@@ -1908,6 +2133,33 @@ ldfont_insert(lua_State *L) {
 	}
 }
 
+static int
+ldfont_stat(lua_State *L) {
+	struct dfont *df = get_dfont(L);
+	if (!df) {
+		return luaL_error(L, "invalid dfont table");
+	}
+
+	struct dfont_stat stat;
+	dfont_stat(df, &stat);
+	lua_createtable(L, 0, 7);
+	lua_pushinteger(L, stat.chars);
+	lua_setfield(L, -2, "chars");
+	lua_pushinteger(L, stat.area);
+	lua_setfield(L, -2, "area");
+	lua_pushinteger(L, stat.shelf);
+	lua_setfield(L, -2, "shelf");
+	lua_pushinteger(L, stat.insert);
+	lua_setfield(L, -2, "insert");
+	lua_pushinteger(L, stat.evict);
+	lua_setfield(L, -2, "evict");
+	lua_pushinteger(L, stat.fail);
+	lua_setfield(L, -2, "fail");
+	lua_pushinteger(L, stat.page);
+	lua_setfield(L, -2, "page");
+	return 1;
+}
+
 static void
 ldfont_mothod(lua_State *L) {
 	luaL_Reg l[] = {
@@ -1915,11 +2167,41 @@ ldfont_mothod(lua_State *L) {
 		{"lookup", ldfont_lookup},
 		{"remove", ldfont_remove},
 		{"flush", ldfont_flush},
+		{"stat", ldfont_stat},
 		{NULL,NULL},
 	};
 	luaL_newlib(L, l);
 }
 
+/*
+	string text / table { text ... }
+	boolean edge
+
+	return
+		integer missing (glyphs not in atlas yet)
+ */
+static int
+lprewarm(lua_State *L) {
+	int edge = lua_toboolean(L, 2);
+	int missing = 0;
+	if (lua_type(L, 1) == LUA_TTABLE) {
+		int i, n = (int)lua_rawlen(L, 1);
+		for (i=1;i<=n;i++) {
+			lua_rawgeti(L, 1, i);
+			const char * str = lua_tostring(L, -1);
+			if (str == NULL) {
+				return luaL_error(L, "Need a string at [%d]", i);
+			}
+			missing += label_prewarm(str, edge);
+			lua_pop(L, 1);
+		}
+	} else {
+		missing = label_prewarm(luaL_checkstring(L, 1), edge);
+	}
+	lua_pushinteger(L, missing);
+	return 1;
+}
+
 /*
 	string text
 	number x
@@ -1996,11 +2278,13 @@ ejoy2d_sprite(lua_State *L) {
 		{ "label", lnewlabel },
 		{ "drawtext", ldrawtext },
 		{ "splittext", lsplittext },
+		{ "prewarm", lprewarm },
 		{ "proxy", lnewproxy },
 		{ "dfont", lnewdfont },
 		{ "delete_dfont", ldeldfont },
 		{ "new_material", lnewmaterial },
 		{ "enable_visible_test", lenable_visible_test },
+		{ "visible_stat", lvisible_stat },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L,l);
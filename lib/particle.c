@@ -10,10 +10,17 @@
 
 #include "particle.h"
 #include "spritepack.h"
+#include "renderbuffer.h"
+#include "thread.h"
 
+#include <limits.h>
 #include <math.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#ifndef _WIN32
+#include <time.h>
+#endif
 
 static inline float
 clampf(float x) {
@@ -24,29 +31,278 @@ clampf(float x) {
 	return x;
 }
 
-inline static float
-RANDOM_M11(unsigned int *seed) {
-	*seed = *seed * 134775813 + 1;
-	union {
-		uint32_t d;
-		float f;
-	} u;
-	u.d = (((uint32_t)(*seed) & 0x7fff) << 8) | 0x40000000;
-	return u.f - 3.0f;
+// PCG32 (XSH RR) on the state of each system : no shared state with rand(), so the systems can be
+// updated on any thread, and a seeded system replays the same particles.
+static inline uint32_t
+_random(uint64_t *state) {
+	uint64_t old = *state;
+	*state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+	uint32_t x = (uint32_t)(((old >> 18) ^ old) >> 27);
+	uint32_t rot = (uint32_t)(old >> 59);
+	return (x >> rot) | (x << ((-rot) & 31));
 }
 
+// the variances of a particle, drawn at once by _random_m11
+enum particle_random {
+	PR_LIFE,
+	PR_POS_X,
+	PR_POS_Y,
+	PR_START_R,
+	PR_START_G,
+	PR_START_B,
+	PR_START_A,
+	PR_END_R,
+	PR_END_G,
+	PR_END_B,
+	PR_END_A,
+	PR_START_SIZE,
+	PR_END_SIZE,
+	PR_START_SPIN,
+	PR_END_SPIN,
+	PR_ANGLE,
+	PR_MODE0,	// speed / start radius
+	PR_MODE1,	// radial accel / end radius
+	PR_MODE2,	// tangential accel / degrees per second
+	PR_COUNT,
+};
+
+// PR_COUNT floats in [-1, 1)
 static void
-_initParticle(struct particle_system *ps, struct particle* particle) {
-	uint32_t RANDSEED = rand();
+_random_m11(uint64_t *state, float r[PR_COUNT]) {
+	uint32_t bits[PR_COUNT];
+	int i;
+	for (i=0;i<PR_COUNT;i++) {
+		bits[i] = _random(state);
+	}
+	for (i=0;i<PR_COUNT;i++) {
+		union {
+			uint32_t d;
+			float f;
+		} u;
+		u.d = (bits[i] >> 9) | 0x40000000;
+		r[i] = u.f - 3.0f;
+	}
+}
+
+// Vector layer of the particle kernels : PV_N particles at a time, with SSE2 or NEON (AArch64, it needs
+// vdivq and vsqrtq). Define PARTICLE_SCALAR to use plain C, one particle at a time.
+
+#if !defined(PARTICLE_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define PARTICLE_SSE2
+#include <emmintrin.h>
+#elif !defined(PARTICLE_SCALAR) && (defined(__aarch64__) || defined(_M_ARM64))
+#define PARTICLE_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(PARTICLE_SSE2)
+
+#define PV_N 4
+typedef __m128 pv;	// floats
+typedef __m128 pm;	// masks
+typedef __m128i pi;	// ints
+
+#define pv_load(p) _mm_load_ps(p)
+#define pv_store(p, v) _mm_store_ps((p), (v))
+#define pv_set(f) _mm_set1_ps(f)
+#define pv_add(a, b) _mm_add_ps((a), (b))
+#define pv_sub(a, b) _mm_sub_ps((a), (b))
+#define pv_mul(a, b) _mm_mul_ps((a), (b))
+#define pv_div(a, b) _mm_div_ps((a), (b))
+#define pv_sqrt(a) _mm_sqrt_ps(a)
+#define pv_max(a, b) _mm_max_ps((a), (b))
+#define pv_neg(a) _mm_xor_ps((a), _mm_set1_ps(-0.0f))
+#define pv_abs(a) _mm_andnot_ps(_mm_set1_ps(-0.0f), (a))
+#define pm_eq(a, b) _mm_cmpeq_ps((a), (b))
+#define pm_ne(a, b) _mm_cmpneq_ps((a), (b))
+#define pm_gt(a, b) _mm_cmpgt_ps((a), (b))
+#define pm_or(a, b) _mm_or_ps((a), (b))
+#define pm_and(a, b) _mm_and_ps((a), (b))
+#define pm_bits(m) _mm_movemask_ps(m)
+#define pv_select(m, a, b) _mm_or_ps(_mm_and_ps((m), (a)), _mm_andnot_ps((m), (b)))
+#define pv_toint(a) _mm_cvttps_epi32(a)
+#define pi_set(i) _mm_set1_epi32(i)
+#define pi_and(a, b) _mm_and_si128((a), (b))
+#define pi_or(a, b) _mm_or_si128((a), (b))
+#define pi_shl(a, n) _mm_slli_epi32((a), (n))
+#define pi_store(p, v) _mm_store_si128((__m128i *)(p), (v))
+
+// sin and cos of the cephes library (as sse_mathfun), |x| < 8192
+static inline void
+pv_sincos(pv x, pv *s, pv *c) {
+	__m128 sign_sin = _mm_and_ps(x, _mm_set1_ps(-0.0f));
+	x = _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+	// octant
+	__m128i j = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.27323954473516f)));
+	j = _mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+	__m128 y = _mm_cvtepi32_ps(j);
+	sign_sin = _mm_xor_ps(sign_sin, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(j, _mm_set1_epi32(4)), 29)));
+	__m128 sign_cos = _mm_castsi128_ps(_mm_slli_epi32(_mm_andnot_si128(_mm_sub_epi32(j, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29));
+	__m128 poly = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, _mm_set1_epi32(2)), _mm_setzero_si128()));
+
+	// x - y * pi/4, in 3 parts
+	x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(0.78515625f)));
+	x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(2.4187564849853515625e-4f)));
+	x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(3.77489497744594108e-8f)));
+	__m128 z = _mm_mul_ps(x, x);
+
+	__m128 yc = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.443315711809948e-5f), z), _mm_set1_ps(-1.388731625493765e-3f));
+	yc = _mm_add_ps(_mm_mul_ps(yc, z), _mm_set1_ps(4.166664568298827e-2f));
+	yc = _mm_mul_ps(_mm_mul_ps(yc, z), z);
+	yc = _mm_add_ps(_mm_sub_ps(yc, _mm_mul_ps(z, _mm_set1_ps(0.5f))), _mm_set1_ps(1.0f));
+
+	__m128 ys = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-1.9515295891e-4f), z), _mm_set1_ps(8.3321608736e-3f));
+	ys = _mm_add_ps(_mm_mul_ps(ys, z), _mm_set1_ps(-1.6666654611e-1f));
+	ys = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(ys, z), x), x);
+
+	*s = _mm_xor_ps(pv_select(poly, ys, yc), sign_sin);
+	*c = _mm_xor_ps(pv_select(poly, yc, ys), sign_cos);
+}
+
+#elif defined(PARTICLE_NEON)
+
+#define PV_N 4
+typedef float32x4_t pv;
+typedef uint32x4_t pm;
+typedef int32x4_t pi;
+
+#define pv_load(p) vld1q_f32(p)
+#define pv_store(p, v) vst1q_f32((p), (v))
+#define pv_set(f) vdupq_n_f32(f)
+#define pv_add(a, b) vaddq_f32((a), (b))
+#define pv_sub(a, b) vsubq_f32((a), (b))
+#define pv_mul(a, b) vmulq_f32((a), (b))
+#define pv_div(a, b) vdivq_f32((a), (b))
+#define pv_sqrt(a) vsqrtq_f32(a)
+#define pv_max(a, b) vmaxq_f32((a), (b))
+#define pv_neg(a) vnegq_f32(a)
+#define pv_abs(a) vabsq_f32(a)
+#define pm_eq(a, b) vceqq_f32((a), (b))
+#define pm_ne(a, b) vmvnq_u32(vceqq_f32((a), (b)))
+#define pm_gt(a, b) vcgtq_f32((a), (b))
+#define pm_or(a, b) vorrq_u32((a), (b))
+#define pm_and(a, b) vandq_u32((a), (b))
+#define pv_select(m, a, b) vbslq_f32((m), (a), (b))
+#define pv_toint(a) vcvtq_s32_f32(a)
+#define pi_set(i) vdupq_n_s32(i)
+#define pi_and(a, b) vandq_s32((a), (b))
+#define pi_or(a, b) vorrq_s32((a), (b))
+#define pi_shl(a, n) vshlq_n_s32((a), (n))
+#define pi_store(p, v) vst1q_s32((int32_t *)(p), (v))
+
+// a bit for each lane
+static inline int
+pm_bits(pm m) {
+	static const uint32_t bit[4] = { 1, 2, 4, 8 };
+	return (int)vaddvq_u32(vandq_u32(m, vld1q_u32(bit)));
+}
+
+static inline void
+pv_sincos(pv x, pv *s, pv *c) {
+	uint32x4_t sign_sin = vandq_u32(vreinterpretq_u32_f32(x), vdupq_n_u32(0x80000000));
+	x = vabsq_f32(x);
+	int32x4_t j = vcvtq_s32_f32(vmulq_f32(x, vdupq_n_f32(1.27323954473516f)));
+	j = vandq_s32(vaddq_s32(j, vdupq_n_s32(1)), vdupq_n_s32(~1));
+	float32x4_t y = vcvtq_f32_s32(j);
+	sign_sin = veorq_u32(sign_sin, vreinterpretq_u32_s32(vshlq_n_s32(vandq_s32(j, vdupq_n_s32(4)), 29)));
+	uint32x4_t sign_cos = vreinterpretq_u32_s32(vshlq_n_s32(vbicq_s32(vdupq_n_s32(4), vsubq_s32(j, vdupq_n_s32(2))), 29));
+	uint32x4_t poly = vceqq_s32(vandq_s32(j, vdupq_n_s32(2)), vdupq_n_s32(0));
+
+	x = vsubq_f32(x, vmulq_f32(y, vdupq_n_f32(0.78515625f)));
+	x = vsubq_f32(x, vmulq_f32(y, vdupq_n_f32(2.4187564849853515625e-4f)));
+	x = vsubq_f32(x, vmulq_f32(y, vdupq_n_f32(3.77489497744594108e-8f)));
+	float32x4_t z = vmulq_f32(x, x);
+
+	float32x4_t yc = vaddq_f32(vmulq_f32(vdupq_n_f32(2.443315711809948e-5f), z), vdupq_n_f32(-1.388731625493765e-3f));
+	yc = vaddq_f32(vmulq_f32(yc, z), vdupq_n_f32(4.166664568298827e-2f));
+	yc = vmulq_f32(vmulq_f32(yc, z), z);
+	yc = vaddq_f32(vsubq_f32(yc, vmulq_f32(z, vdupq_n_f32(0.5f))), vdupq_n_f32(1.0f));
+
+	float32x4_t ys = vaddq_f32(vmulq_f32(vdupq_n_f32(-1.9515295891e-4f), z), vdupq_n_f32(8.3321608736e-3f));
+	ys = vaddq_f32(vmulq_f32(ys, z), vdupq_n_f32(-1.6666654611e-1f));
+	ys = vaddq_f32(vmulq_f32(vmulq_f32(ys, z), x), x);
+
+	*s = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(vbslq_f32(poly, ys, yc)), sign_sin));
+	*c = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(vbslq_f32(poly, yc, ys)), sign_cos));
+}
+
+#else
+
+#define PV_N 1
+typedef float pv;
+typedef int pm;
+typedef int pi;
+
+#define pv_load(p) (*(p))
+#define pv_store(p, v) (*(p) = (v))
+#define pv_set(f) (f)
+#define pv_add(a, b) ((a) + (b))
+#define pv_sub(a, b) ((a) - (b))
+#define pv_mul(a, b) ((a) * (b))
+#define pv_div(a, b) ((a) / (b))
+#define pv_sqrt(a) sqrtf(a)
+#define pv_max(a, b) ((a) < (b) ? (b) : (a))
+#define pv_neg(a) (-(a))
+#define pv_abs(a) fabsf(a)
+#define pm_eq(a, b) ((a) == (b))
+#define pm_ne(a, b) ((a) != (b))
+#define pm_gt(a, b) ((a) > (b))
+#define pm_or(a, b) ((a) | (b))
+#define pm_and(a, b) ((a) & (b))
+#define pm_bits(m) (m)
+#define pv_select(m, a, b) ((m) ? (a) : (b))
+#define pv_toint(a) ((int)(a))
+#define pi_set(i) (i)
+#define pi_and(a, b) ((a) & (b))
+#define pi_or(a, b) ((a) | (b))
+#define pi_shl(a, n) ((int)((uint32_t)(a) << (n)))
+#define pi_store(p, v) (*(p) = (uint32_t)(v))
 
-	particle->timeToLive = ps->config->life + ps->config->lifeVar * RANDOM_M11(&RANDSEED);
-	if (particle->timeToLive <= 0) {
+static inline void
+pv_sincos(pv x, pv *s, pv *c) {
+	*s = sinf(x);
+	*c = cosf(x);
+}
+
+#endif
+
+static inline int
+particle_cap(int n) {
+	return (n + PARTICLE_LANE - 1) / PARTICLE_LANE * PARTICLE_LANE;
+}
+
+// the larger scale of the axes of a matrix
+static inline float
+_max_scale(const int *m) {
+	float sx = (float)m[0] * m[0] + (float)m[1] * m[1];
+	float sy = (float)m[2] * m[2] + (float)m[3] * m[3];
+	return sqrtf(sx > sy ? sx : sy) / 1024;
+}
+
+static void
+_initParticle(struct particle_system *ps, int idx, const struct matrix *emitter) {
+	float **attrib = ps->attrib;
+	struct particle_config *config = ps->config;
+	float r[PR_COUNT];
+	_random_m11(&ps->seed, r);
+
+	float timeToLive = config->life + config->lifeVar * r[PR_LIFE];
+	attrib[PA_TIME_TO_LIVE][idx] = timeToLive;
+	if (timeToLive <= 0) {
 		return;
 	}
 
-	int *mat = particle->emitMatrix.m;
-	if (ps->config->emitterMatrix) {
-		memcpy(mat, ps->config->emitterMatrix->m, 6 * sizeof(int));
+	int *mat = ps->emitMatrix[idx].m;
+	if (emitter) {
+		memcpy(mat, emitter->m, 6 * sizeof(int));
+		int *box = ps->emitBox[0];
+		if (mat[4] < box[0]) box[0] = mat[4];
+		if (mat[5] < box[1]) box[1] = mat[5];
+		if (mat[4] > box[2]) box[2] = mat[4];
+		if (mat[5] > box[3]) box[3] = mat[5];
+		float scale = _max_scale(mat);
+		if (scale > ps->emitScale[0])
+			ps->emitScale[0] = scale;
 	} else {
 		mat[0] = 1024;
 		mat[1] = 0;
@@ -55,105 +311,111 @@ _initParticle(struct particle_system *ps, struct particle* particle) {
 		mat[4] = 0;
 		mat[5] = 0;
 	}
-	particle->startPos = ps->config->sourcePosition;
-	particle->pos.x = ps->config->posVar.x * RANDOM_M11(&RANDSEED);
-	particle->pos.y = ps->config->posVar.y * RANDOM_M11(&RANDSEED);
+	attrib[PA_START_X][idx] = config->sourcePosition.x;
+	attrib[PA_START_Y][idx] = config->sourcePosition.y;
+	attrib[PA_X][idx] = config->posVar.x * r[PR_POS_X];
+	attrib[PA_Y][idx] = config->posVar.y * r[PR_POS_Y];
 
-	struct color4f *start = &particle->color;
-	start->r = clampf(ps->config->startColor.r + ps->config->startColorVar.r * RANDOM_M11(&RANDSEED));
-	start->g = clampf(ps->config->startColor.g + ps->config->startColorVar.g * RANDOM_M11(&RANDSEED));
-	start->b = clampf(ps->config->startColor.b + ps->config->startColorVar.b * RANDOM_M11(&RANDSEED));
-	start->a = clampf(ps->config->startColor.a + ps->config->startColorVar.a * RANDOM_M11(&RANDSEED));
+	struct color4f start;
+	start.r = clampf(config->startColor.r + config->startColorVar.r * r[PR_START_R]);
+	start.g = clampf(config->startColor.g + config->startColorVar.g * r[PR_START_G]);
+	start.b = clampf(config->startColor.b + config->startColorVar.b * r[PR_START_B]);
+	start.a = clampf(config->startColor.a + config->startColorVar.a * r[PR_START_A]);
 
 	struct color4f end;
-	end.r = clampf(ps->config->endColor.r + ps->config->endColorVar.r * RANDOM_M11(&RANDSEED));
-	end.g = clampf(ps->config->endColor.g + ps->config->endColorVar.g * RANDOM_M11(&RANDSEED));
-	end.b = clampf(ps->config->endColor.b + ps->config->endColorVar.b * RANDOM_M11(&RANDSEED));
-	end.a = clampf(ps->config->endColor.a + ps->config->endColorVar.a * RANDOM_M11(&RANDSEED));
+	end.r = clampf(config->endColor.r + config->endColorVar.r * r[PR_END_R]);
+	end.g = clampf(config->endColor.g + config->endColorVar.g * r[PR_END_G]);
+	end.b = clampf(config->endColor.b + config->endColorVar.b * r[PR_END_B]);
+	end.a = clampf(config->endColor.a + config->endColorVar.a * r[PR_END_A]);
 
-	particle->deltaColor.r = (end.r - start->r) / particle->timeToLive;
-	particle->deltaColor.g = (end.g - start->g) / particle->timeToLive;
-	particle->deltaColor.b = (end.b - start->b) / particle->timeToLive;
-	particle->deltaColor.a = (end.a - start->a) / particle->timeToLive;
+	attrib[PA_R][idx] = start.r;
+	attrib[PA_G][idx] = start.g;
+	attrib[PA_B][idx] = start.b;
+	attrib[PA_A][idx] = start.a;
+	attrib[PA_DELTA_R][idx] = (end.r - start.r) / timeToLive;
+	attrib[PA_DELTA_G][idx] = (end.g - start.g) / timeToLive;
+	attrib[PA_DELTA_B][idx] = (end.b - start.b) / timeToLive;
+	attrib[PA_DELTA_A][idx] = (end.a - start.a) / timeToLive;
 
-	float startS = ps->config->startSize + ps->config->startSizeVar * RANDOM_M11(&RANDSEED);
+	float startS = config->startSize + config->startSizeVar * r[PR_START_SIZE];
 	if (startS < 0) {
 		startS = 0;
 	}
 
-	particle->size = startS;
+	attrib[PA_SIZE][idx] = startS;
 
-	if (ps->config->endSize == START_SIZE_EQUAL_TO_END_SIZE) {
-		particle->deltaSize = 0;
+	if (config->endSize == START_SIZE_EQUAL_TO_END_SIZE) {
+		attrib[PA_DELTA_SIZE][idx] = 0;
 	} else {
-		float endS = ps->config->endSize + ps->config->endSizeVar * RANDOM_M11(&RANDSEED);
+		float endS = config->endSize + config->endSizeVar * r[PR_END_SIZE];
 		if (endS < 0) {
 			endS = 0;
 		}
-		particle->deltaSize = (endS - startS) / particle->timeToLive;
+		attrib[PA_DELTA_SIZE][idx] = (endS - startS) / timeToLive;
 	}
 
 
 	// rotation
-	float startA = ps->config->startSpin + ps->config->startSpinVar * RANDOM_M11(&RANDSEED);
-	float endA = ps->config->endSpin + ps->config->endSpinVar * RANDOM_M11(&RANDSEED);
-	particle->rotation = startA;
-	particle->deltaRotation = (endA - startA) / particle->timeToLive;
+	float startA = config->startSpin + config->startSpinVar * r[PR_START_SPIN];
+	float endA = config->endSpin + config->endSpinVar * r[PR_END_SPIN];
+	attrib[PA_ROTATION][idx] = startA;
+	attrib[PA_DELTA_ROTATION][idx] = (endA - startA) / timeToLive;
 
 	// direction
-	float a = CC_DEGREES_TO_RADIANS( ps->config->angle + ps->config->angleVar * RANDOM_M11(&RANDSEED) );
+	float a = CC_DEGREES_TO_RADIANS( config->angle + config->angleVar * r[PR_ANGLE] );
 
 	// Mode Gravity: A
-	if (ps->config->emitterMode == PARTICLE_MODE_GRAVITY) {
+	if (config->emitterMode == PARTICLE_MODE_GRAVITY) {
 		struct point v;
 		v.x = cosf(a);
 		v.y = sinf(a);
-		float s = ps->config->mode.A.speed + ps->config->mode.A.speedVar * RANDOM_M11(&RANDSEED);
+		float s = config->mode.A.speed + config->mode.A.speedVar * r[PR_MODE0];
 
 		// direction
-		particle->mode.A.dir.x = v.x * s ;
-		particle->mode.A.dir.y = v.y * s ;
+		struct point dir;
+		dir.x = v.x * s ;
+		dir.y = v.y * s ;
+		attrib[PA_DIR_X][idx] = dir.x;
+		attrib[PA_DIR_Y][idx] = dir.y;
 
 		// radial accel
-		particle->mode.A.radialAccel = ps->config->mode.A.radialAccel + ps->config->mode.A.radialAccelVar * RANDOM_M11(&RANDSEED);
+		attrib[PA_RADIAL_ACCEL][idx] = config->mode.A.radialAccel + config->mode.A.radialAccelVar * r[PR_MODE1];
 
 
 		// tangential accel
-		particle->mode.A.tangentialAccel = ps->config->mode.A.tangentialAccel + ps->config->mode.A.tangentialAccelVar * RANDOM_M11(&RANDSEED);
+		attrib[PA_TANGENTIAL_ACCEL][idx] = config->mode.A.tangentialAccel + config->mode.A.tangentialAccelVar * r[PR_MODE2];
 
 		// rotation is dir
-		if(ps->config->mode.A.rotationIsDir) {
-			struct point *p = &(particle->mode.A.dir);
-			particle->rotation = -CC_RADIANS_TO_DEGREES(atan2f(p->y,p->x));
+		if(config->mode.A.rotationIsDir) {
+			attrib[PA_ROTATION][idx] = -CC_RADIANS_TO_DEGREES(atan2f(dir.y,dir.x));
 		}
 	}
 	// Mode Radius: B
 	else {
 		// Set the default diameter of the particle from the source position
-		float startRadius = ps->config->mode.B.startRadius + ps->config->mode.B.startRadiusVar * RANDOM_M11(&RANDSEED);
-		float endRadius = ps->config->mode.B.endRadius + ps->config->mode.B.endRadiusVar * RANDOM_M11(&RANDSEED);
+		float startRadius = config->mode.B.startRadius + config->mode.B.startRadiusVar * r[PR_MODE0];
+		float endRadius = config->mode.B.endRadius + config->mode.B.endRadiusVar * r[PR_MODE1];
 
-		particle->mode.B.radius = startRadius;
+		attrib[PA_RADIUS][idx] = startRadius;
 
-		if (ps->config->mode.B.endRadius == START_RADIUS_EQUAL_TO_END_RADIUS) {
-			particle->mode.B.deltaRadius = 0;
+		if (config->mode.B.endRadius == START_RADIUS_EQUAL_TO_END_RADIUS) {
+			attrib[PA_DELTA_RADIUS][idx] = 0;
 		} else {
-			particle->mode.B.deltaRadius = (endRadius - startRadius) / particle->timeToLive;
+			attrib[PA_DELTA_RADIUS][idx] = (endRadius - startRadius) / timeToLive;
 		}
 
-		particle->mode.B.angle = a;
-		particle->mode.B.degreesPerSecond = CC_DEGREES_TO_RADIANS(ps->config->mode.B.rotatePerSecond + ps->config->mode.B.rotatePerSecondVar * RANDOM_M11(&RANDSEED));
+		attrib[PA_ANGLE][idx] = a;
+		attrib[PA_DEGREES_PER_SECOND][idx] = CC_DEGREES_TO_RADIANS(config->mode.B.rotatePerSecond + config->mode.B.rotatePerSecondVar * r[PR_MODE2]);
 	}
 }
 
 static void
-_addParticle(struct particle_system *ps) {
+_addParticle(struct particle_system *ps, const struct matrix *emitter) {
 	if (ps->particleCount == ps->config->totalParticles) {
 		return;
 	}
 
-	struct particle * particle = &ps->particles[ ps->particleCount ];
-	_initParticle(ps, particle);
+	_initParticle(ps, ps->particleCount, emitter);
 	++ps->particleCount;
 }
 
@@ -164,198 +426,928 @@ _stopSystem(struct particle_system *ps) {
 	ps->emitCounter = 0;
 }
 
-static void
-_normalize_point(struct point *p, struct point *out) {
-	float l2 = p->x * p->x + p->y *p->y;
-	if (l2 == 0) {
-		out->x = 1.0f;
-		out->y = 0;
-	} else {
-		float len = sqrtf(l2);
-		out->x = p->x/len;
-		out->y = p->y/len;
+// the attributes every mode updates
+struct particle_common {
+	float *ttl;
+	float *size;
+	float *delta_size;
+	float *color[4];
+	float *delta_color[4];
+	float *rotation;
+	float *delta_rotation;
+};
+
+static inline struct particle_common
+_common(struct particle_system *ps) {
+	struct particle_common c;
+	float **attrib = ps->attrib;
+	int k;
+	c.ttl = attrib[PA_TIME_TO_LIVE];
+	c.size = attrib[PA_SIZE];
+	c.delta_size = attrib[PA_DELTA_SIZE];
+	for (k=0;k<4;k++) {
+		c.color[k] = attrib[PA_R + k];
+		c.delta_color[k] = attrib[PA_DELTA_R + k];
 	}
+	c.rotation = attrib[PA_ROTATION];
+	c.delta_rotation = attrib[PA_DELTA_ROTATION];
+	return c;
 }
 
-static void
-_update_particle(struct particle_system *ps, struct particle *p, float dt) {
-	if (ps->config->positionType != POSITION_TYPE_GROUPED) {
-		p->startPos = ps->config->sourcePosition;
+// time to live, size, color and rotation of the particles at i.
+// it appends the dead ones to dead, and returns the new dead count
+static inline int
+_update_common(struct particle_common c, int i, pv dt, int *dead, int dead_n) {
+	pv ttl = pv_sub(pv_load(c.ttl+i), dt);
+	pv size = pv_max(pv_add(pv_load(c.size+i), pv_mul(pv_load(c.delta_size+i), dt)), pv_set(0));
+	pv_store(c.ttl+i, ttl);
+	pv_store(c.size+i, size);
+	pv_store(c.color[0]+i, pv_add(pv_load(c.color[0]+i), pv_mul(pv_load(c.delta_color[0]+i), dt)));
+	pv_store(c.color[1]+i, pv_add(pv_load(c.color[1]+i), pv_mul(pv_load(c.delta_color[1]+i), dt)));
+	pv_store(c.color[2]+i, pv_add(pv_load(c.color[2]+i), pv_mul(pv_load(c.delta_color[2]+i), dt)));
+	pv_store(c.color[3]+i, pv_add(pv_load(c.color[3]+i), pv_mul(pv_load(c.delta_color[3]+i), dt)));
+	pv_store(c.rotation+i, pv_add(pv_load(c.rotation+i), pv_mul(pv_load(c.delta_rotation+i), dt)));
+
+	int alive = pm_bits(pm_and(pm_gt(ttl, pv_set(0)), pm_gt(size, pv_set(0))));
+	int k;
+	for (k=0;k<PV_N;k++) {
+		dead[dead_n] = i + k;
+		dead_n += !((alive >> k) & 1);
 	}
-	// Mode A: gravity, direction, tangential accel & radial accel
-	if (ps->config->emitterMode == PARTICLE_MODE_GRAVITY) {
-		struct point tmp, radial, tangential;
+	return dead_n;
+}
 
-		radial.x = 0;
-		radial.y = 0;
-		// radial acceleration
-		if (p->pos.x || p->pos.y) {
-			_normalize_point(&p->pos, &radial);
-		}
-		tangential = radial;
-		radial.x *= p->mode.A.radialAccel;
-		radial.y *= p->mode.A.radialAccel;
+// the extent of the particles around the source : max(|x|, |y|) + size, for the culling
+static inline pv
+_extent(pv ext, pv x, pv y, const float *size) {
+	return pv_max(pv_add(pv_max(pv_abs(x), pv_abs(y)), pv_load(size)), ext);
+}
+
+static inline float
+_hmax(pv v) {
+	union { pv v; float f[PV_N]; } u;
+	u.v = v;
+	float m = u.f[0];
+	int k;
+	for (k=1;k<PV_N;k++) {
+		if (u.f[k] > m)
+			m = u.f[k];
+	}
+	return m;
+}
+
+// Mode A: gravity, direction, tangential accel & radial accel
+static int
+_update_gravity(struct particle_system *ps, int n, float delta) {
+	float **attrib = ps->attrib;
+	struct particle_common common = _common(ps);
+	float *x = attrib[PA_X];
+	float *y = attrib[PA_Y];
+	float *dir_x = attrib[PA_DIR_X];
+	float *dir_y = attrib[PA_DIR_Y];
+	float *radial = attrib[PA_RADIAL_ACCEL];
+	float *tangential = attrib[PA_TANGENTIAL_ACCEL];
+	int *dead = ps->dead;
+	int dead_n = 0;
+	pv dt = pv_set(delta);
+	pv zero = pv_set(0);
+	pv one = pv_set(1.0f);
+	pv gravity_x = pv_set(ps->config->mode.A.gravity.x);
+	pv gravity_y = pv_set(ps->config->mode.A.gravity.y);
+	pv ext = zero;
+	int i;
+	for (i=0;i<n;i+=PV_N) {
+		pv px = pv_load(x+i);
+		pv py = pv_load(y+i);
+
+		// radial acceleration, (1,0) if the length underflows
+		pv l2 = pv_add(pv_mul(px, px), pv_mul(py, py));
+		pm moved = pm_or(pm_ne(px, zero), pm_ne(py, zero));
+		pm underflow = pm_eq(l2, zero);
+		pv len = pv_sqrt(l2);
+		pv radial_x = pv_select(moved, pv_select(underflow, one, pv_div(px, len)), zero);
+		pv radial_y = pv_select(moved, pv_select(underflow, zero, pv_div(py, len)), zero);
 
 		// tangential acceleration
-		float newy = tangential.x;
-		tangential.x = -tangential.y * p->mode.A.tangentialAccel;
-		tangential.y = newy * p->mode.A.tangentialAccel;
+		pv tangential_accel = pv_load(tangential+i);
+		pv tangential_x = pv_mul(pv_neg(radial_y), tangential_accel);
+		pv tangential_y = pv_mul(radial_x, tangential_accel);
+		pv radial_accel = pv_load(radial+i);
+		radial_x = pv_mul(radial_x, radial_accel);
+		radial_y = pv_mul(radial_y, radial_accel);
 
 		// (gravity + radial + tangential) * dt
-		tmp.x = radial.x + tangential.x + ps->config->mode.A.gravity.x;
-		tmp.y = radial.y + tangential.y + ps->config->mode.A.gravity.y;
-		tmp.x *= dt;
-		tmp.y *= dt;
-		p->mode.A.dir.x += tmp.x;
-		p->mode.A.dir.y += tmp.y;
-		tmp.x = p->mode.A.dir.x * dt;
-		tmp.y = p->mode.A.dir.y * dt;
-		p->pos.x += tmp.x;
-		p->pos.y += tmp.y;
-	}
-	// Mode B: radius movement
-	else {
-		// Update the angle and radius of the particle.
-		p->mode.B.angle += p->mode.B.degreesPerSecond * dt;
-		p->mode.B.radius += p->mode.B.deltaRadius * dt;
+		pv dx = pv_add(pv_load(dir_x+i), pv_mul(pv_add(pv_add(radial_x, tangential_x), gravity_x), dt));
+		pv dy = pv_add(pv_load(dir_y+i), pv_mul(pv_add(pv_add(radial_y, tangential_y), gravity_y), dt));
+		pv_store(dir_x+i, dx);
+		pv_store(dir_y+i, dy);
+		px = pv_add(px, pv_mul(dx, dt));
+		py = pv_add(py, pv_mul(dy, dt));
+		pv_store(x+i, px);
+		pv_store(y+i, py);
 
-		p->pos.x = - cosf(p->mode.B.angle) * p->mode.B.radius;
-		p->pos.y = - sinf(p->mode.B.angle) * p->mode.B.radius;
+		dead_n = _update_common(common, i, dt, dead, dead_n);
+		ext = _extent(ext, px, py, common.size+i);
 	}
+	ps->bound = _hmax(ext);
+	return dead_n;
+}
 
-	p->size += (p->deltaSize * dt);
-	if (p->size < 0)
-		p->size = 0;
+// Mode B: radius movement
+static int
+_update_radius(struct particle_system *ps, int n, float delta) {
+	float **attrib = ps->attrib;
+	struct particle_common common = _common(ps);
+	float *x = attrib[PA_X];
+	float *y = attrib[PA_Y];
+	float *angle = attrib[PA_ANGLE];
+	float *degrees_per_second = attrib[PA_DEGREES_PER_SECOND];
+	float *radius = attrib[PA_RADIUS];
+	float *delta_radius = attrib[PA_DELTA_RADIUS];
+	int *dead = ps->dead;
+	int dead_n = 0;
+	pv dt = pv_set(delta);
+	pv ext = pv_set(0);
+	int i;
+	for (i=0;i<n;i+=PV_N) {
+		// Update the angle and radius of the particle.
+		pv a = pv_add(pv_load(angle+i), pv_mul(pv_load(degrees_per_second+i), dt));
+		pv r = pv_add(pv_load(radius+i), pv_mul(pv_load(delta_radius+i), dt));
+		pv_store(angle+i, a);
+		pv_store(radius+i, r);
 
-	p->color.r += (p->deltaColor.r * dt);
-	p->color.g += (p->deltaColor.g * dt);
-	p->color.b += (p->deltaColor.b * dt);
-	p->color.a += (p->deltaColor.a * dt);
+		pv s, c;
+		pv_sincos(a, &s, &c);
+		pv px = pv_mul(pv_neg(c), r);
+		pv py = pv_mul(pv_neg(s), r);
+		pv_store(x+i, px);
+		pv_store(y+i, py);
 
-	p->rotation += (p->deltaRotation * dt);
+		dead_n = _update_common(common, i, dt, dead, dead_n);
+		ext = _extent(ext, px, py, common.size+i);
+	}
+	ps->bound = _hmax(ext);
+	return dead_n;
 }
 
-static void
-_remove_particle(struct particle_system *ps, int idx) {
-	if ( idx != ps->particleCount-1) {
-		ps->particles[idx] = ps->particles[ps->particleCount-1];
+// the particles of a culled system only grow old, their positions are frozen
+static int
+_update_age(struct particle_system *ps, int n, float delta) {
+	struct particle_common common = _common(ps);
+	int *dead = ps->dead;
+	int dead_n = 0;
+	pv dt = pv_set(delta);
+	int i;
+	for (i=0;i<n;i+=PV_N) {
+		dead_n = _update_common(common, i, dt, dead, dead_n);
 	}
-	--ps->particleCount;
+	return dead_n;
+}
+
+static inline int
+_alive(struct particle_system *ps, int i) {
+	return (ps->attrib[PA_TIME_TO_LIVE][i] > 0) & (ps->attrib[PA_SIZE][i] > 0);
+}
+
+// Remove the dead particles (listed by the update) without branches : the live ones at the tail
+// move to the holes before it. It returns the new particle count.
+static int
+_remove_dead(struct particle_system *ps, int n, int dead_n) {
+	int *dead = ps->dead;
+	int *move = ps->move;
+	int i,j;
+	// the padding of the last lanes
+	while (dead_n > 0 && dead[dead_n-1] >= n) {
+		--dead_n;
+	}
+	if (dead_n == 0)
+		return n;
+	int count = n - dead_n;
+	// the holes before count are dead[0, move_n)
+	int move_n = 0;
+	for (i=count;i<n;i++) {
+		move[move_n] = i;
+		move_n += _alive(ps, i);
+	}
+	for (j=0;j<PA_COUNT;j++) {
+		float *a = ps->attrib[j];
+		for (i=0;i<move_n;i++) {
+			a[dead[i]] = a[move[i]];
+		}
+	}
+	for (i=0;i<move_n;i++) {
+		ps->emitMatrix[dead[i]] = ps->emitMatrix[move[i]];
+	}
+	return count;
+}
+
+size_t
+particle_system_size(int numberOfParticles) {
+	int cap = particle_cap(numberOfParticles);
+	size_t particle = PA_COUNT * sizeof(float) + 2 * sizeof(int) + 2 * sizeof(struct matrix);
+	// 15 bytes for the alignment
+	return sizeof(struct particle_system) + 15 + cap * particle;
 }
 
 void
-init_with_particles(struct particle_system *ps, int numberOfParticles) {
-	ps->particles = (struct particle *)(ps+1);
-	ps->matrix = (struct matrix *)(ps->particles + numberOfParticles);
-	ps->config = (struct particle_config*)(ps->matrix + numberOfParticles);
+init_with_particles(struct particle_system *ps, int numberOfParticles, struct particle_config *config) {
+	int cap = particle_cap(numberOfParticles);
+	char *ptr = (char *)(((uintptr_t)(ps+1) + 15) & ~(uintptr_t)15);
+	int i;
+	for (i=0;i<PA_COUNT;i++) {
+		ps->attrib[i] = (float *)ptr;
+		ptr += cap * sizeof(float);
+	}
+	ps->dead = (int *)ptr;
+	ptr += cap * sizeof(int);
+	ps->move = (int *)ptr;
+	ptr += cap * sizeof(int);
+	ps->emitMatrix = (struct matrix *)ptr;
+	ptr += cap * sizeof(struct matrix);
+	ps->matrix = (struct matrix *)ptr;
+	ps->config = NULL;
+	particle_system_config(ps, config);
 	ps->allocatedParticles = numberOfParticles;
 	ps->isActive = false;
-	ps->config->totalParticles = numberOfParticles;
-	ps->config->positionType = POSITION_TYPE_RELATIVE;
-	ps->config->emitterMode = PARTICLE_MODE_GRAVITY;
 	ps->particleCount = 0;
 	ps->edge = 1;
+	// every system gets its own stream, in the order they are created
+	static uint64_t serial = 0;
+	particle_system_seed(ps, ++serial);
+}
+
+// a config is shared by the systems with a reference count
+struct particle_shared {
+	int ref;
+	struct particle_config config;
+};
+
+static inline struct particle_shared *
+_shared(struct particle_config *config) {
+	return (struct particle_shared *)((char *)config - offsetof(struct particle_shared, config));
+}
+
+struct particle_config *
+particle_config_new() {
+	struct particle_shared *s = (struct particle_shared *)malloc(sizeof(*s));
+	if (s == NULL)
+		return NULL;
+	memset(s, 0, sizeof(*s));
+	s->ref = 1;
+	s->config.positionType = POSITION_TYPE_RELATIVE;
+	s->config.emitterMode = PARTICLE_MODE_GRAVITY;
+	return &s->config;
+}
+
+void
+particle_config_grab(struct particle_config *config) {
+	++_shared(config)->ref;
+}
+
+void
+particle_config_release(struct particle_config *config) {
+	if (config == NULL)
+		return;
+	struct particle_shared *s = _shared(config);
+	if (--s->ref == 0) {
+		free(s);
+	}
+}
+
+void
+particle_system_config(struct particle_system *ps, struct particle_config *config) {
+	if (config) {
+		particle_config_grab(config);
+	}
+	particle_config_release(ps->config);
+	ps->config = config;
+}
+
+void
+particle_system_seed(struct particle_system *ps, uint64_t seed) {
+	ps->seed = 0;
+	_random(&ps->seed);
+	ps->seed += seed;
+	_random(&ps->seed);
 }
 
 void
 particle_system_reset(struct particle_system *ps) {
 	ps->isActive = true;
 	ps->emitCounter = 0.0;
+	ps->throttleCounter = 0.0;
 	ps->elapsed = 0.0;
 }
 
 void
-calc_particle_system_mat(struct particle * p, struct matrix *m, int edge) {
+calc_particle_system_mat(struct particle_system *ps, int index, struct matrix *m, int edge) {
+	float **attrib = ps->attrib;
+	struct point start;
+	if (ps->config->positionType != POSITION_TYPE_GROUPED) {
+		start = ps->config->sourcePosition;
+	} else {
+		start.x = attrib[PA_START_X][index];
+		start.y = attrib[PA_START_Y][index];
+	}
 	matrix_identity(m);
 	struct srt srt;
-	srt.rot = p->rotation * (EJMAT_R_FACTOR / 360.0);
-	srt.scalex = p->size * 1024 / edge;
+	srt.rot = attrib[PA_ROTATION][index] * (EJMAT_R_FACTOR / 360.0);
+	srt.scalex = attrib[PA_SIZE][index] * 1024 / edge;
 	srt.scaley = srt.scalex;
-	srt.offx = (p->pos.x + p->startPos.x) * SCREEN_SCALE;
-	srt.offy = (p->pos.y + p->startPos.y) * SCREEN_SCALE;
+	srt.offx = (attrib[PA_X][index] + start.x) * SCREEN_SCALE;
+	srt.offy = (attrib[PA_Y][index] + start.y) * SCREEN_SCALE;
 	matrix_srt(m, &srt);
 
 	struct matrix tmp;
 	memcpy(tmp.m, m, sizeof(int) * 6);
-	matrix_mul(m, &tmp, &p->emitMatrix);
+	matrix_mul(m, &tmp, &ps->emitMatrix[index]);
 }
 
-void
-particle_system_update(struct particle_system *ps, float dt) {
+static struct {
+	struct particle_budget b;
+	int view[4];
+	// emission scale of this frame, and its part from the time
+	float emit;
+	float timeScale;
+	// counters of this frame, with lock
+	struct thread_mutex lock;
+	int alive;
+	int updates;
+	int spawned;
+	int throttled;
+	double time;
+	struct particle_stat stat;
+} Budget = { { 0, 0, 0, false }, { 0, 0, 0, 0 }, 1.0f, 1.0f, THREAD_MUTEX_INIT };
+
+// milliseconds from a monotonic clock
+static double
+_now() {
+#ifdef _WIN32
+	LARGE_INTEGER freq, counter;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart * 1000.0 / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#endif
+}
+
+// emitters scaled under the lod emit less
+static float
+_lod(const struct matrix *m) {
+	if (Budget.b.lod <= 0 || m == NULL)
+		return 1.0f;
+	const int *mm = m->m;
+	float scale = sqrtf(fabsf((float)mm[0] * mm[3] - (float)mm[1] * mm[2])) / 1024;
+	if (scale >= Budget.b.lod)
+		return 1.0f;
+	return scale / Budget.b.lod;
+}
+
+// the particles are drawn within bound pixels (in its scale) of the emitter,
+// or of the emitters they were emitted by for the grouped ones
+static bool
+_offscreen(struct particle_system *ps, const struct matrix *m) {
+	const int *v = Budget.view;
+	if (!Budget.b.cull || m == NULL || v[2] <= v[0])
+		return false;
+	const int *mm = m->m;
+	float scale = _max_scale(mm);
+	float x0 = mm[4], y0 = mm[5], x1 = mm[4], y1 = mm[5];
+	if (ps->config->positionType == POSITION_TYPE_GROUPED && ps->particleCount > 0) {
+		int i;
+		for (i=0;i<2;i++) {
+			const int *box = ps->emitBox[i];
+			if (box[0] < x0) x0 = box[0];
+			if (box[1] < y0) y0 = box[1];
+			if (box[2] > x1) x1 = box[2];
+			if (box[3] > y1) y1 = box[3];
+			if (ps->emitScale[i] > scale)
+				scale = ps->emitScale[i];
+		}
+	}
+	struct point *source = &ps->config->sourcePosition;
+	float r = (ps->bound + fabsf(source->x) + fabsf(source->y)) * scale * SCREEN_SCALE;
+	return x1 + r < v[0] || x0 - r > v[2] || y1 + r < v[1] || y0 - r > v[3];
+}
+
+static void
+_count(int alive, int spawned, int culled, int throttled, double time) {
+	thread_mutex_lock(&Budget.lock);
+	Budget.alive += alive;
+	++Budget.updates;
+	Budget.spawned += spawned;
+	Budget.throttled += throttled;
+	Budget.time += time;
+	Budget.stat.spawned += spawned;
+	Budget.stat.culled += culled;
+	Budget.stat.throttled += throttled;
+	thread_mutex_unlock(&Budget.lock);
+}
+
+static inline void
+_empty_box(struct particle_system *ps, int i) {
+	ps->emitBox[i][0] = ps->emitBox[i][1] = INT_MAX;
+	ps->emitBox[i][2] = ps->emitBox[i][3] = INT_MIN;
+	ps->emitScale[i] = 0;
+}
+
+// the particles not emitted in dt seconds
+static int
+_hold(struct particle_system *ps, float dt) {
+	float rate = ps->config->emissionRate;
+	int n = 0;
+	if (rate > 0) {
+		ps->throttleCounter += dt;
+		while (ps->throttleCounter > rate) {
+			ps->throttleCounter -= rate;
+			++n;
+		}
+	}
+	return n;
+}
+
+// the system stops at the end of its duration
+static inline void
+_elapse(struct particle_system *ps, float dt) {
+	ps->elapsed += dt;
+	if (ps->config->duration != DURATION_INFINITY && ps->config->duration < ps->elapsed) {
+		_stopSystem(ps);
+	}
+}
+
+// the system only writes itself, its config is read only.
+// the emission is scaled by scale, it returns the particles emitted and held back
+static int
+_system_update(struct particle_system *ps, float dt, const struct matrix *emitter, float scale, int *throttled) {
+	int spawned = 0;
+	*throttled = 0;
+	// the particles emitted before the last life time are dead
+	ps->emitAge += dt;
+	if (ps->particleCount == 0 || ps->emitAge > ps->config->life + ps->config->lifeVar) {
+		if (ps->particleCount == 0) {
+			_empty_box(ps, 1);
+		} else {
+			memcpy(ps->emitBox[1], ps->emitBox[0], sizeof(ps->emitBox[0]));
+			ps->emitScale[1] = ps->emitScale[0];
+		}
+		_empty_box(ps, 0);
+		ps->emitAge = 0;
+	}
 	if (ps->isActive) {
 		float rate = ps->config->emissionRate;
 
 		// emitCounter should not increase where ps->particleCount == ps->totalParticles
 		if (ps->particleCount < ps->config->totalParticles)	{
-			ps->emitCounter += dt;
+			ps->emitCounter += dt * scale;
+			*throttled = _hold(ps, dt * (1.0f - scale));
 		}
 
 		while (ps->particleCount < ps->config->totalParticles && ps->emitCounter > rate) {
-			_addParticle(ps);
+			_addParticle(ps, emitter);
 			ps->emitCounter -= rate;
+			++spawned;
 		}
 
-		ps->elapsed += dt;
-		if (ps->config->duration != DURATION_INFINITY && ps->config->duration < ps->elapsed) {
-			_stopSystem(ps);
-		}
+		_elapse(ps, dt);
 	}
 
-	int i = 0;
-
-	while (i < ps->particleCount) {
-		struct particle *p = &ps->particles[i];
-		p->timeToLive -= dt;
-		if (p->timeToLive > 0) {
-			_update_particle(ps,p,dt);
-			if (p->size <= 0) {
-				_remove_particle(ps, i);
-			} else {
-				++i;
-			}
-		} else {
-			_remove_particle(ps, i);
-		}
+	int n = ps->particleCount;
+	int dead_n;
+	if (ps->config->emitterMode == PARTICLE_MODE_GRAVITY) {
+		dead_n = _update_gravity(ps, n, dt);
+	} else {
+		dead_n = _update_radius(ps, n, dt);
 	}
+	ps->particleCount = _remove_dead(ps, n, dead_n);
 
 	ps->isAlive = ps->particleCount > 0;
+	return spawned;
+}
+
+void
+particle_system_update(struct particle_system *ps, float dt) {
+	int throttled;
+	_system_update(ps, dt, ps->config->emitterMatrix, 1.0f, &throttled);
 }
 
 bool particle_update(struct particle_system *ps, float dt, struct matrix *m) {
-	if (ps->config->positionType == POSITION_TYPE_GROUPED) {
-		ps->config->emitterMatrix = m;
+	double start = _now();
+	int n = ps->particleCount;
+	ps->culled = _offscreen(ps, m);
+	if (ps->culled) {
+		// it doesn't emit and its particles don't move, but they still die and the duration runs out
+		int culled = n;
+		if (ps->isActive) {
+			if (n < ps->config->totalParticles) {
+				culled += _hold(ps, dt);
+			}
+			_elapse(ps, dt);
+		}
+		ps->particleCount = _remove_dead(ps, n, _update_age(ps, n, dt));
+		ps->isAlive = ps->particleCount > 0;
+		_count(ps->particleCount - n, 0, culled, 0, _now() - start);
+		return ps->isActive || ps->isAlive;
+	}
+	// the grouped particles keep the matrix they are emitted with
+	int throttled;
+	int spawned = _system_update(ps, dt, ps->config->positionType == POSITION_TYPE_GROUPED ? m : NULL,
+		Budget.emit * _lod(m), &throttled);
+	// the matrices are built with the vertices (particle_vertex)
+	if (m) {
+		ps->worldMatrix = *m;
 	} else {
-		ps->config->emitterMatrix = NULL;
+		matrix_identity(&ps->worldMatrix);
 	}
-	ps->config->sourcePosition.x = 0;
-	ps->config->sourcePosition.y = 0;
-	particle_system_update(ps, dt);
-	float edge = ps->edge;
+	_count(ps->particleCount - n, spawned, 0, throttled, _now() - start);
 
-	if (ps->isActive || ps->isAlive) {
-		int n = ps->particleCount;
-		int i;
-		struct matrix tmp;
-		for (i=0;i<n;i++) {
-			struct particle *p = &ps->particles[i];
-			calc_particle_system_mat(p,&ps->matrix[i], edge);
-			if (ps->config->positionType != POSITION_TYPE_GROUPED) {
-				memcpy(tmp.m, &ps->matrix[i], sizeof(int) * 6);
-				matrix_mul(&ps->matrix[i], &tmp, m);
+	return ps->isActive || ps->isAlive;
+}
+
+void
+particle_world_mat(struct particle_system *ps, int index, struct matrix *m) {
+	calc_particle_system_mat(ps, index, m, ps->edge);
+	if (ps->config->positionType != POSITION_TYPE_GROUPED) {
+		struct matrix tmp = *m;
+		matrix_mul(m, &tmp, &ps->worldMatrix);
+	}
+}
+
+// fixed point matrix to float, with the screen transform
+static inline void
+_screen_mat(const int *m, const struct particle_quad *pq, float f[6]) {
+	f[0] = m[0] * pq->sx / 1024;
+	f[1] = m[1] * pq->sy / 1024;
+	f[2] = m[2] * pq->sx / 1024;
+	f[3] = m[3] * pq->sy / 1024;
+	f[4] = m[4] * pq->sx;
+	f[5] = m[5] * pq->sy;
+}
+
+// The particle matrix (size / edge, rotation, position, as calc_particle_system_mat) times the world
+// (or emitter) matrix is built in float for PV_N particles at once, and the corners go through it.
+void
+particle_vertex(struct particle_system *ps, const struct particle_quad *pq, int from, int n, struct quad *q) {
+	float **attrib = ps->attrib;
+	bool grouped = ps->config->positionType == POSITION_TYPE_GROUPED;
+	pv start_x = pv_set(ps->config->sourcePosition.x);
+	pv start_y = pv_set(ps->config->sourcePosition.y);
+	pv inv_edge = pv_set(1.0f / ps->edge);
+	pv radian = pv_set(0.01745329252f);
+	pv screen_scale = pv_set(SCREEN_SCALE);
+	pv s255 = pv_set(255);
+	pi mask = pi_set(0xff);
+	union {
+		pv v;
+		float f[PV_N];
+	} a[6], x[4], y[4];
+	union {
+		pi v;
+		uint32_t u[PV_N];
+	} color;
+	int k;
+	if (!grouped) {
+		float w[6];
+		_screen_mat(ps->worldMatrix.m, pq, w);
+		for (k=0;k<6;k++) {
+			a[k].v = pv_set(w[k]);
+		}
+	}
+	int last = from + n;
+	int i;
+	for (i=from - from % PV_N; i<last; i+=PV_N) {
+		int j;
+		if (grouped) {
+			for (j=0;j<PV_N;j++) {
+				float w[6];
+				_screen_mat(ps->emitMatrix[i+j].m, pq, w);
+				for (k=0;k<6;k++) {
+					a[k].f[j] = w[k];
+				}
+			}
+			start_x = pv_load(attrib[PA_START_X]+i);
+			start_y = pv_load(attrib[PA_START_Y]+i);
+		}
+		pv scale = pv_mul(pv_load(attrib[PA_SIZE]+i), inv_edge);
+		pv sn, cs;
+		pv_sincos(pv_mul(pv_load(attrib[PA_ROTATION]+i), radian), &sn, &cs);
+		sn = pv_mul(sn, scale);
+		cs = pv_mul(cs, scale);
+		pv tx = pv_mul(pv_add(pv_load(attrib[PA_X]+i), start_x), screen_scale);
+		pv ty = pv_mul(pv_add(pv_load(attrib[PA_Y]+i), start_y), screen_scale);
+		pv m0 = pv_add(pv_mul(cs, a[0].v), pv_mul(sn, a[2].v));
+		pv m1 = pv_add(pv_mul(cs, a[1].v), pv_mul(sn, a[3].v));
+		pv m2 = pv_sub(pv_mul(cs, a[2].v), pv_mul(sn, a[0].v));
+		pv m3 = pv_sub(pv_mul(cs, a[3].v), pv_mul(sn, a[1].v));
+		pv m4 = pv_add(pv_add(pv_mul(tx, a[0].v), pv_mul(ty, a[2].v)), a[4].v);
+		pv m5 = pv_add(pv_add(pv_mul(tx, a[1].v), pv_mul(ty, a[3].v)), a[5].v);
+		for (k=0;k<4;k++) {
+			pv cx = pv_set(pq->corner[k*2]);
+			pv cy = pv_set(pq->corner[k*2+1]);
+			x[k].v = pv_add(pv_add(pv_mul(cx, m0), pv_mul(cy, m2)), m4);
+			y[k].v = pv_add(pv_add(pv_mul(cx, m1), pv_mul(cy, m3)), m5);
+		}
+		pi r = pi_and(pv_toint(pv_mul(pv_load(attrib[PA_R]+i), s255)), mask);
+		pi g = pi_and(pv_toint(pv_mul(pv_load(attrib[PA_G]+i), s255)), mask);
+		pi b = pi_and(pv_toint(pv_mul(pv_load(attrib[PA_B]+i), s255)), mask);
+		pi al = pi_and(pv_toint(pv_mul(pv_load(attrib[PA_A]+i), s255)), mask);
+		color.v = pi_or(pi_or(pi_shl(al, 24), pi_shl(r, 16)), pi_or(pi_shl(g, 8), b));
+
+		for (j=0;j<PV_N;j++) {
+			if (i + j < from || i + j >= last)
+				continue;
+			uint32_t c = color.u[j];
+			struct vertex *v = q[i + j - from].p;
+			for (k=0;k<4;k++) {
+				v[k].vp.vx = x[k].f[j];
+				v[k].vp.vy = y[k].f[j];
+				v[k].vp.tx = pq->texcoord[k*2];
+				v[k].vp.ty = pq->texcoord[k*2+1];
+				v[k].rgba[0] = (c >> 16) & 0xff;
+				v[k].rgba[1] = (c >> 8) & 0xff;
+				v[k].rgba[2] = c & 0xff;
+				v[k].rgba[3] = c >> 24;
+				v[k].add[0] = (pq->additive >> 16) & 0xff;
+				v[k].add[1] = (pq->additive >> 8) & 0xff;
+				v[k].add[2] = pq->additive & 0xff;
+				v[k].add[3] = pq->additive >> 24;
 			}
-			p->color_val = color4f(&p->color);
 		}
-		return true;
-	} else {
-		return false;
 	}
 }
 
 uint32_t
-color4f(struct color4f *c4f) {
-	uint8_t rr = (int)(c4f->r*255);
-	uint8_t gg = (int)(c4f->g*255);
-	uint8_t bb = (int)(c4f->b*255);
-	uint8_t aa = (int)(c4f->a*255);
+particle_color(struct particle_system *ps, int index) {
+	float **attrib = ps->attrib;
+	uint8_t rr = (int)(attrib[PA_R][index]*255);
+	uint8_t gg = (int)(attrib[PA_G][index]*255);
+	uint8_t bb = (int)(attrib[PA_B][index]*255);
+	uint8_t aa = (int)(attrib[PA_A][index]*255);
 	return (uint32_t)aa << 24 | (uint32_t)rr << 16 | (uint32_t)gg << 8 | bb;
-}
\ No newline at end of file
+}
+
+// Particle jobs : particle_update_async queues the update to a pool of worker threads. A job is taken
+// in submit order by the first free worker, or by the main thread when it waits for that system.
+
+#define MAX_WORKER 16
+
+enum particle_job_state {
+	JOB_NONE = 0,
+	JOB_QUEUED,
+	JOB_RUNNING,
+};
+
+struct particle_job {
+	struct particle_system *ps;
+	float dt;
+	bool world;
+	struct matrix m;
+};
+
+static struct {
+	int workers;
+	bool quit;
+	int n;
+	int cap;
+	int next;
+	int running;
+	struct particle_job *job;
+	struct thread_mutex lock;
+	struct thread_cond cond;	// to the workers : new job or quit
+	struct thread_cond done;	// to the waiters : a job is done
+	struct thread thread[MAX_WORKER];
+} Pool = { 0, false, 0, 0, 0, 0, NULL, THREAD_MUTEX_INIT, THREAD_COND_INIT, THREAD_COND_INIT };
+
+static void
+_run_job(struct particle_job *job) {
+	particle_update(job->ps, job->dt, job->world ? &job->m : NULL);
+}
+
+// take the next job, with Pool.lock
+static bool
+_take_job(struct particle_job *job) {
+	while (Pool.next < Pool.n) {
+		*job = Pool.job[Pool.next++];
+		// taken by particle_wait
+		if (job->ps == NULL)
+			continue;
+		job->ps->job = JOB_RUNNING;
+		++Pool.running;
+		return true;
+	}
+	return false;
+}
+
+// with Pool.lock
+static void
+_finish_job(struct particle_job *job) {
+	job->ps->job = JOB_NONE;
+	--Pool.running;
+	thread_cond_broadcast(&Pool.done);
+}
+
+static void
+_worker(void *ud) {
+	struct particle_job job;
+	thread_mutex_lock(&Pool.lock);
+	while (!Pool.quit) {
+		if (!_take_job(&job)) {
+			thread_cond_wait(&Pool.cond, &Pool.lock);
+			continue;
+		}
+		thread_mutex_unlock(&Pool.lock);
+		_run_job(&job);
+		thread_mutex_lock(&Pool.lock);
+		_finish_job(&job);
+	}
+	thread_mutex_unlock(&Pool.lock);
+}
+
+void
+particle_workers(int n) {
+	if (n < 0)
+		n = 0;
+	if (n > MAX_WORKER)
+		n = MAX_WORKER;
+	if (n == Pool.workers)
+		return;
+	particle_sync();
+	int i;
+	if (Pool.workers > 0) {
+		thread_mutex_lock(&Pool.lock);
+		Pool.quit = true;
+		thread_cond_broadcast(&Pool.cond);
+		thread_mutex_unlock(&Pool.lock);
+		for (i=0;i<Pool.workers;i++) {
+			thread_join(&Pool.thread[i]);
+		}
+		Pool.workers = 0;
+		Pool.quit = false;
+	}
+	for (i=0;i<n;i++) {
+		if (thread_create(&Pool.thread[i], _worker, NULL))
+			break;
+		++Pool.workers;
+	}
+}
+
+int
+particle_getworkers() {
+	return Pool.workers;
+}
+
+bool
+particle_update_async(struct particle_system *ps, float dt, struct matrix *m) {
+	if (Pool.workers == 0) {
+		return particle_update(ps, dt, m);
+	}
+	particle_wait(ps);
+	bool active = ps->isActive || ps->isAlive;
+	thread_mutex_lock(&Pool.lock);
+	if (Pool.next >= Pool.n) {
+		Pool.n = Pool.next = 0;
+	}
+	if (Pool.n >= Pool.cap) {
+		int cap = Pool.cap * 2;
+		if (cap == 0)
+			cap = 64;
+		struct particle_job *job = (struct particle_job *)realloc(Pool.job, cap * sizeof(*job));
+		if (job == NULL) {
+			thread_mutex_unlock(&Pool.lock);
+			return particle_update(ps, dt, m);
+		}
+		Pool.job = job;
+		Pool.cap = cap;
+	}
+	struct particle_job *job = &Pool.job[Pool.n];
+	job->ps = ps;
+	job->dt = dt;
+	job->world = m != NULL;
+	if (m) {
+		job->m = *m;
+	}
+	ps->job = JOB_QUEUED;
+	ps->jobIndex = Pool.n++;
+	thread_cond_signal(&Pool.cond);
+	thread_mutex_unlock(&Pool.lock);
+	return active;
+}
+
+void
+particle_wait(struct particle_system *ps) {
+	if (Pool.workers == 0)
+		return;
+	thread_mutex_lock(&Pool.lock);
+	if (ps->job == JOB_QUEUED) {
+		// run it here rather than wait for a worker
+		struct particle_job job = Pool.job[ps->jobIndex];
+		Pool.job[ps->jobIndex].ps = NULL;
+		ps->job = JOB_NONE;
+		thread_mutex_unlock(&Pool.lock);
+		_run_job(&job);
+		return;
+	}
+	while (ps->job == JOB_RUNNING) {
+		thread_cond_wait(&Pool.done, &Pool.lock);
+	}
+	thread_mutex_unlock(&Pool.lock);
+}
+
+void
+particle_sync() {
+	if (Pool.workers == 0)
+		return;
+	struct particle_job job;
+	thread_mutex_lock(&Pool.lock);
+	for (;;) {
+		if (_take_job(&job)) {
+			thread_mutex_unlock(&Pool.lock);
+			_run_job(&job);
+			thread_mutex_lock(&Pool.lock);
+			_finish_job(&job);
+		} else if (Pool.running > 0) {
+			thread_cond_wait(&Pool.done, &Pool.lock);
+		} else {
+			break;
+		}
+	}
+	thread_mutex_unlock(&Pool.lock);
+}
+
+void
+particle_budget(const struct particle_budget *b) {
+	// the updates in the background read it
+	particle_sync();
+	Budget.b = *b;
+	if (Budget.b.cap < 0)
+		Budget.b.cap = 0;
+	if (Budget.b.time <= 0) {
+		Budget.b.time = 0;
+		Budget.timeScale = 1.0f;
+	}
+	if (Budget.b.cap == 0 && Budget.b.time == 0) {
+		Budget.emit = 1.0f;
+	}
+}
+
+void
+particle_getbudget(struct particle_budget *b) {
+	*b = Budget.b;
+}
+
+void
+particle_frame(const int viewbox[4]) {
+	particle_sync();
+	memcpy(Budget.view, viewbox, sizeof(Budget.view));
+	// keep the budget of the frames without update
+	if (Budget.updates == 0)
+		return;
+	float emit = 1.0f;
+	if (Budget.b.cap > 0) {
+		// the demand is what is emitted and held back in this frame
+		int room = Budget.b.cap - Budget.alive;
+		int demand = Budget.spawned + Budget.throttled;
+		if (room <= 0) {
+			emit = 0;
+		} else if (demand > room) {
+			emit = (float)room / demand;
+		}
+	}
+	if (Budget.b.time > 0 && Budget.time > 0) {
+		// it follows the time of the frames, and comes back to 1 under the budget
+		float f = Budget.b.time / Budget.time;
+		if (f > 2.0f)
+			f = 2.0f;
+		f *= Budget.timeScale;
+		if (f > 1.0f)
+			f = 1.0f;
+		if (f < 1.0f / 64)
+			f = 1.0f / 64;
+		Budget.timeScale = f;
+		emit *= f;
+	}
+	Budget.stat.alive = Budget.alive;
+	Budget.stat.time = (float)Budget.time;
+	Budget.emit = emit;
+	Budget.updates = 0;
+	Budget.spawned = 0;
+	Budget.throttled = 0;
+	Budget.time = 0;
+}
+
+void
+particle_stat(struct particle_stat *st) {
+	*st = Budget.stat;
+	st->emit = Budget.emit;
+}
+
+void
+particle_release(struct particle_system *ps) {
+	particle_wait(ps);
+	thread_mutex_lock(&Budget.lock);
+	Budget.alive -= ps->particleCount;
+	thread_mutex_unlock(&Budget.lock);
+	particle_system_config(ps, NULL);
+}
@@ -40,40 +40,46 @@ struct color4f {
 	float a;
 };
 
-struct particle {
-	struct point pos;
-	struct point startPos;
-	struct matrix emitMatrix;
-
-	struct color4f color;
-	struct color4f deltaColor;
-	uint32_t color_val;
-
-	float size;
-	float deltaSize;
-
-	float rotation;
-	float deltaRotation;
+// The particles are stored as a struct of arrays, an array of floats for each attribute.
+// The arrays are 16 bytes aligned and padded to PARTICLE_LANE, they are updated 4 at a time.
+#define PARTICLE_LANE 4
+
+enum particle_attrib {
+	PA_X,	// position from the start position
+	PA_Y,
+	PA_START_X,
+	PA_START_Y,
+	PA_R,
+	PA_G,
+	PA_B,
+	PA_A,
+	PA_DELTA_R,
+	PA_DELTA_G,
+	PA_DELTA_B,
+	PA_DELTA_A,
+	PA_SIZE,
+	PA_DELTA_SIZE,
+	PA_ROTATION,
+	PA_DELTA_ROTATION,
+	PA_TIME_TO_LIVE,
+	PA_MODE0,
+	PA_MODE1,
+	PA_MODE2,
+	PA_MODE3,
+	PA_COUNT,
+};
 
-	float timeToLive;
+//! Mode A: gravity, direction, radial accel, tangential accel
+#define PA_DIR_X PA_MODE0
+#define PA_DIR_Y PA_MODE1
+#define PA_RADIAL_ACCEL PA_MODE2
+#define PA_TANGENTIAL_ACCEL PA_MODE3
 
-	union {
-		//! Mode A: gravity, direction, radial accel, tangential accel
-		struct {
-			struct point dir;
-			float radialAccel;
-			float tangentialAccel;
-		} A;
-
-		//! Mode B: radius mode
-		struct {
-			float angle;
-			float degreesPerSecond;
-			float radius;
-			float deltaRadius;
-		} B;
-	} mode;
-};
+//! Mode B: radius mode
+#define PA_ANGLE PA_MODE0
+#define PA_DEGREES_PER_SECOND PA_MODE1
+#define PA_RADIUS PA_MODE2
+#define PA_DELTA_RADIUS PA_MODE3
 
 struct particle_config {
 	/** Switch between different kind of emitter modes:
@@ -194,12 +200,31 @@ struct particle_system {
 	float elapsed;
 	float edge;
 
-	//! Array of particles
-	struct particle *particles;
+	//! Particle attributes, attrib[PA_*][index]
+	float *attrib[PA_COUNT];
+	struct matrix *emitMatrix;
+	// matrices of particle.data
 	struct matrix *matrix;
+	// world matrix of the last particle_update
+	struct matrix worldMatrix;
+	// scratch of the removing
+	int *dead;
+	int *move;
 
 	//! How many particles can be emitted per second
 	float emitCounter;
+	// emission held back by the budget, see particle_budget
+	float throttleCounter;
+	// max(|x|, |y|) + size of the particles in the last update, in pixels
+	float bound;
+	// grouped : boxes (SCREEN_SCALE units) and max scales of the emitters of the particles alive,
+	// the particles of this and the last life time, emitAge is the time of this one
+	int emitBox[2][4];
+	float emitScale[2];
+	float emitAge;
+
+	// PCG32 state of the emission
+	uint64_t seed;
 
 	//!  particle idx
 	//int particleIdx;
@@ -216,16 +241,91 @@ struct particle_system {
 	/** Quantity of particles that are being simulated at the moment */
 	int particleCount;
 
+	// out of the screen in the last particle_update, its particles only grow old and it's not drawn
+	bool culled;
+
+	// state and queue index of the update job, see particle_update_async
+	int job;
+	int jobIndex;
+
 	struct particle_config *config;
 };
 
-
-void init_with_particles(struct particle_system *ps, int numberOfParticles);
+// The configs are read only and shared by the systems, with a reference count : particle_config_new
+// returns a config of 1 reference, the systems take theirs. Change a config before it's shared.
+struct particle_config * particle_config_new();
+void particle_config_grab(struct particle_config *config);
+void particle_config_release(struct particle_config *config);
+
+// the size of a particle system with its particles, for init_with_particles.
+// config->totalParticles must be <= numberOfParticles
+size_t particle_system_size(int numberOfParticles);
+void init_with_particles(struct particle_system *ps, int numberOfParticles, struct particle_config *config);
+// the system uses config (NULL to release its own)
+void particle_system_config(struct particle_system *ps, struct particle_config *config);
 void particle_system_update(struct particle_system *ps, float dt);
-void calc_particle_system_mat(struct particle * p, struct matrix *m, int edge);
+void calc_particle_system_mat(struct particle_system *ps, int index, struct matrix *m, int edge);
 void particle_system_reset(struct particle_system *ps);
+// restart the random stream of the emission, the same seed emits the same particles
+void particle_system_seed(struct particle_system *ps, uint64_t seed);
 bool particle_update(struct particle_system *ps, float dt, struct matrix *m);
-uint32_t color4f(struct color4f *c4f);
+// Parallel update : with n > 0 workers (0 by default, at most 16), particle_update_async queues the
+// update of the system to the worker threads and returns the state of the previous update.
+// particle_wait(ps) must be called before the system is read or changed, particle_sync() waits for all.
+void particle_workers(int n);
+int particle_getworkers();
+bool particle_update_async(struct particle_system *ps, float dt, struct matrix *m);
+void particle_wait(struct particle_system *ps);
+void particle_sync();
+// The global budget of particle_update, off by default (all 0). The emission of every system is scaled
+// down to keep the particles alive under cap, and the update time of a frame (summed over the workers)
+// under time ms; an emitter of scale s < lod emits s / lod as much; with cull, a system whose particles
+// are all out of the screen doesn't emit, its particles don't move and it's not drawn, but they still die
+// and its duration runs out. particle_frame(viewbox) waits for the updates at the end of a frame, it takes
+// the screen box (SCREEN_SCALE units) and the emission scale of the next frame.
+struct particle_budget {
+	int cap;
+	float time;
+	float lod;
+	bool cull;
+};
+
+// spawned, culled and throttled particles since the start; the others are of the last frame with updates
+struct particle_stat {
+	uint64_t spawned;
+	uint64_t culled;
+	uint64_t throttled;
+	int alive;
+	float time;
+	float emit;
+};
+
+void particle_budget(const struct particle_budget *b);
+void particle_getbudget(struct particle_budget *b);
+void particle_frame(const int viewbox[4]);
+void particle_stat(struct particle_stat *st);
+// the system is deleted, its particles leave the budget and its config is released
+void particle_release(struct particle_system *ps);
+
+// matrix of the particle in the world of the last particle_update
+void particle_world_mat(struct particle_system *ps, int index, struct matrix *m);
+// ARGB of the particle
+uint32_t particle_color(struct particle_system *ps, int index);
+
+struct quad;
+
+// a picture rect to draw the particles with : the corners in SCREEN_SCALE units (mirror applied),
+// the texture coords, the additive color and the scale of screen_trans
+struct particle_quad {
+	float corner[8];
+	uint16_t texcoord[8];
+	uint32_t additive;
+	float sx;
+	float sy;
+};
+
+// the vertices of particles [from, from + n) in the world of the last particle_update, to q[0 .. n-1]
+void particle_vertex(struct particle_system *ps, const struct particle_quad *pq, int from, int n, struct quad *q);
 
 int ejoy2d_particle(lua_State *L);
 
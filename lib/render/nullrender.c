@@ -0,0 +1,623 @@
+// A render backend without GL, for headless runs and CI.
+// It keeps the same object pools and state commit logic as render.c,
+// so drawcall/state change counters match what the GL backend would issue.
+
+#include "render.h"
+#include "nullrender.h"
+#include "carray.h"
+#include "block.h"
+#include "log.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_VB_SLOT 8
+#define MAX_ATTRIB 16
+#define MAX_TEXTURE 8
+#define MAX_UNIFORM 64
+#define STREAM_SEGMENT 4
+#define CHANGE_VERTEXARRAY 0x1
+#define CHANGE_TEXTURE 0x2
+#define CHANGE_BLEND 0x4
+#define CHANGE_DEPTH 0x8
+#define CHANGE_CULL 0x10
+#define CHANGE_TARGET 0x20
+#define CHANGE_SCISSOR 0x40
+
+struct buffer {
+	enum RENDER_OBJ what;
+	int n;
+	int stride;
+	int stream;
+	int offset;
+	int head;
+};
+
+struct attrib {
+	int n;
+	struct vertex_attrib a[MAX_ATTRIB];
+};
+
+struct target {
+	RID tex;
+};
+
+struct texture {
+	int width;
+	int height;
+	int mipmap;
+	enum TEXTURE_FORMAT format;
+	enum TEXTURE_TYPE type;
+	int memsize;
+};
+
+struct shader {
+	int n;
+	int texture_n;
+	int uniform_n;
+	char uniform[MAX_UNIFORM][32];
+};
+
+struct rstate {
+	RID target;
+	enum BLEND_FORMAT blend_src;
+	enum BLEND_FORMAT blend_dst;
+	enum DEPTH_FORMAT depth;
+	enum CULL_MODE cull;
+	int depthmask;
+	int scissor;
+	RID texture[MAX_TEXTURE];
+};
+
+struct render {
+	uint32_t changeflag;
+	RID attrib_layout;
+	RID vbslot[MAX_VB_SLOT];
+	RID indexbuffer;
+	RID program;
+	struct rstate current;
+	struct rstate last;
+	struct log log;
+	FILE *cmd;
+	struct render_stat stat;
+	int index32;
+	struct array buffer;
+	struct array attrib;
+	struct array target;
+	struct array texture;
+	struct array shader;
+};
+
+static FILE * CMDLOG = NULL;
+
+void
+render_null_setlog(FILE *f) {
+	CMDLOG = f;
+}
+
+#define CMD(R, ...) if ((R)->cmd) fprintf((R)->cmd, __VA_ARGS__)
+
+static int
+calc_texture_size(enum TEXTURE_FORMAT format, int width, int height) {
+	switch( format ) {
+	case TEXTURE_RGBA8 :
+		return width * height * 4;
+	case TEXTURE_RGB565:
+	case TEXTURE_RGBA4 :
+		return width * height * 2;
+	case TEXTURE_RGB:
+		return width * height * 3;
+	case TEXTURE_A8 :
+	case TEXTURE_DEPTH :
+		return width * height;
+	case TEXTURE_PVR2 :
+		return width * height / 4;
+	case TEXTURE_PVR4 :
+	case TEXTURE_ETC1 :
+		return width * height / 2;
+	default:
+		return 0;
+	}
+}
+
+// what should be VERTEXBUFFER or INDEXBUFFER
+RID
+render_buffer_create(struct render *R, enum RENDER_OBJ what, const void *data, int n, int stride) {
+	if (what != VERTEXBUFFER && what != INDEXBUFFER && what != STREAMBUFFER)
+		return 0;
+	assert(what != INDEXBUFFER || stride != 4 || R->index32);
+	struct buffer * buf = (struct buffer *)array_alloc(&R->buffer);
+	if (buf == NULL)
+		return 0;
+	memset(buf, 0, sizeof(*buf));
+	buf->what = what;
+	buf->stride = stride;
+	if (what == STREAMBUFFER) {
+		buf->stream = n * stride;
+		buf->n = 0;
+	} else if (data && n > 0) {
+		buf->n = n;
+		R->stat.buffer_upload += n * stride;
+	} else {
+		buf->n = 0;
+	}
+	RID id = array_id(&R->buffer, buf);
+	static const char * name[] = { "", "", "vb", "ib", "", "", "", "stream" };
+	CMD(R, "buffer_create %d %s %d %d\n", id, name[what], buf->stream ? n : buf->n, stride);
+	return id;
+}
+
+void
+render_buffer_update(struct render *R, RID id, const void * data, int n) {
+	struct buffer * buf = (struct buffer *)array_ref(&R->buffer, id);
+	R->changeflag |= CHANGE_VERTEXARRAY;
+	buf->n = n;
+	int sz = n * buf->stride;
+	if (buf->stream) {
+		assert(sz <= buf->stream / STREAM_SEGMENT);
+		if (buf->head + sz > buf->stream) {
+			buf->head = 0;
+			CMD(R, "buffer_orphan %d\n", id);
+		}
+		buf->offset = buf->head;
+		buf->head += sz;
+	}
+	R->stat.buffer_upload += sz;
+	CMD(R, "buffer_update %d %d %d\n", id, buf->offset, sz);
+}
+
+RID
+render_register_vertexlayout(struct render *R, int n, struct vertex_attrib * attrib) {
+	assert(n <= MAX_ATTRIB);
+	struct attrib * a = (struct attrib*)array_alloc(&R->attrib);
+	if (a == NULL)
+		return 0;
+
+	a->n = n;
+	memcpy(a->a, attrib, n * sizeof(struct vertex_attrib));
+
+	RID id = array_id(&R->attrib, a);
+
+	R->attrib_layout = id;
+
+	return id;
+}
+
+RID
+render_shader_create(struct render *R, struct shader_init_args *args) {
+	if (R->attrib_layout == 0)
+		return 0;
+	struct shader * s = (struct shader *)array_alloc(&R->shader);
+	if (s == NULL) {
+		return 0;
+	}
+	struct attrib * a = (struct attrib *)array_ref(&R->attrib, R->attrib_layout);
+	s->n = a->n;
+	s->texture_n = args->texture;
+	s->uniform_n = 0;
+
+	RID id = array_id(&R->shader, s);
+	CMD(R, "shader_create %d\n", id);
+	return id;
+}
+
+void
+render_release(struct render *R, enum RENDER_OBJ what, RID id) {
+	struct array *A;
+	switch (what) {
+	case VERTEXBUFFER:
+	case INDEXBUFFER:
+	case STREAMBUFFER:
+		A = &R->buffer;
+		break;
+	case SHADER:
+		A = &R->shader;
+		break;
+	case TEXTURE:
+		A = &R->texture;
+		break;
+	case TARGET:
+		A = &R->target;
+		break;
+	default:
+		assert(0);
+		return;
+	}
+	void * obj = array_ref(A, id);
+	if (obj) {
+		array_free(A, obj);
+		CMD(R, "release %d %d\n", what, id);
+	}
+}
+
+void
+render_set(struct render *R, enum RENDER_OBJ what, RID id, int slot) {
+	switch (what) {
+	case VERTEXBUFFER:
+	case STREAMBUFFER:
+		assert(slot >= 0 && slot < MAX_VB_SLOT);
+		R->vbslot[slot] = id;
+		R->changeflag |= CHANGE_VERTEXARRAY;
+		break;
+	case INDEXBUFFER:
+		R->indexbuffer = id;
+		R->changeflag |= CHANGE_VERTEXARRAY;
+		break;
+	case VERTEXLAYOUT:
+		R->attrib_layout = id;
+		break;
+	case TEXTURE:
+		assert(slot >= 0 && slot < MAX_TEXTURE);
+		R->current.texture[slot] = id;
+		R->changeflag |= CHANGE_TEXTURE;
+		break;
+	case TARGET:
+		R->current.target = id;
+		R->changeflag |= CHANGE_TARGET;
+		break;
+	default:
+		assert(0);
+		break;
+	}
+}
+
+void
+render_shader_bind(struct render *R, RID id) {
+	R->program = id;
+	R->changeflag |= CHANGE_VERTEXARRAY;
+	++R->stat.state_change;
+	CMD(R, "shader_bind %d\n", id);
+}
+
+int
+render_size(struct render_init_args *args) {
+	return sizeof(struct render) +
+		array_size(args->max_buffer, sizeof(struct buffer)) +
+		array_size(args->max_layout, sizeof(struct attrib)) +
+		array_size(args->max_target, sizeof(struct target)) +
+		array_size(args->max_texture, sizeof(struct texture)) +
+		array_size(args->max_shader, sizeof(struct shader));
+}
+
+static void
+new_array(struct block *B, struct array *A, int n, int sz) {
+	int s = array_size(n, sz);
+	void * buffer = block_slice(B, s);
+	array_init(A, buffer, n, sz);
+}
+
+struct render *
+render_init(struct render_init_args *args, void * buffer, int sz) {
+	struct block B;
+	block_init(&B, buffer, sz);
+	struct render * R = (struct render *)block_slice(&B, sizeof(struct render));
+	memset(R, 0, sizeof(*R));
+	log_init(&R->log, stderr);
+	R->cmd = CMDLOG;
+	// set EJOY2D_INDEX16 to run as an OpenGL ES 2.0 device without OES_element_index_uint
+	R->index32 = getenv("EJOY2D_INDEX16") == NULL;
+	new_array(&B, &R->buffer, args->max_buffer, sizeof(struct buffer));
+	new_array(&B, &R->attrib, args->max_layout, sizeof(struct attrib));
+	new_array(&B, &R->target, args->max_target, sizeof(struct target));
+	new_array(&B, &R->texture, args->max_texture, sizeof(struct texture));
+	new_array(&B, &R->shader, args->max_shader, sizeof(struct shader));
+
+	return R;
+}
+
+void
+render_exit(struct render * R) {
+	if (R->cmd) {
+		fflush(R->cmd);
+	}
+}
+
+void
+render_setviewport(struct render *R, int x, int y, int width, int height) {
+	CMD(R, "viewport %d %d %d %d\n", x, y, width, height);
+}
+
+void
+render_setscissor(struct render *R, int x, int y, int width, int height ) {
+	CMD(R, "scissor %d %d %d %d\n", x, y, width, height);
+}
+
+// texture
+
+RID
+render_texture_create(struct render *R, int width, int height, enum TEXTURE_FORMAT format, enum TEXTURE_TYPE type, int mipmap) {
+	struct texture * tex = (struct texture *)array_alloc(&R->texture);
+	if (tex == NULL)
+		return 0;
+	tex->width = width;
+	tex->height = height;
+	tex->format = format;
+	tex->type = type;
+	assert(type == TEXTURE_2D || type == TEXTURE_CUBE);
+	tex->mipmap = mipmap;
+	int size = calc_texture_size(format, width, height);
+	if (mipmap) {
+		size += size / 3;
+	}
+	if (type == TEXTURE_CUBE) {
+		size *= 6;
+	}
+	tex->memsize = size;
+
+	RID id = array_id(&R->texture, tex);
+	CMD(R, "texture_create %d %d %d %d\n", id, width, height, format);
+	return id;
+}
+
+void
+render_texture_update(struct render *R, RID id, int width, int height, const void *pixels, int slice, int miplevel) {
+	struct texture * tex = (struct texture *)array_ref(&R->texture, id);
+	if (tex == NULL)
+		return;
+	// the GL backend binds the texture to the last slot for uploading
+	R->changeflag |= CHANGE_TEXTURE;
+	R->last.texture[MAX_TEXTURE-1] = 0;
+	int size = pixels ? calc_texture_size(tex->format, width, height) : 0;
+	R->stat.texture_upload += size;
+	CMD(R, "texture_update %d %d %d %d\n", id, slice, miplevel, size);
+}
+
+void
+render_texture_subupdate(struct render *R, RID id, const void *pixels, int x, int y, int w, int h) {
+	struct texture * tex = (struct texture *)array_ref(&R->texture, id);
+	if (tex == NULL)
+		return;
+	R->changeflag |= CHANGE_TEXTURE;
+	R->last.texture[MAX_TEXTURE-1] = 0;
+	int size = calc_texture_size(tex->format, w, h);
+	R->stat.texture_upload += size;
+	CMD(R, "texture_subupdate %d %d %d %d %d %d\n", id, x, y, w, h, size);
+}
+
+// blend mode
+void
+render_setblend(struct render *R, enum BLEND_FORMAT src, enum BLEND_FORMAT dst) {
+	R->current.blend_src = src;
+	R->current.blend_dst = dst;
+	R->changeflag |= CHANGE_BLEND;
+}
+
+// depth
+void
+render_enabledepthmask(struct render *R, int enable) {
+	R->current.depthmask = enable;
+	R->changeflag |= CHANGE_DEPTH;
+}
+
+// scissor
+void
+render_enablescissor(struct render *R, int enable) {
+	R->current.scissor = enable;
+	R->changeflag |= CHANGE_SCISSOR;
+}
+
+void
+render_setdepth(struct render *R, enum DEPTH_FORMAT d) {
+	R->current.depth = d;
+	R->changeflag |= CHANGE_DEPTH;
+}
+
+// cull
+void
+render_setcull(struct render *R, enum CULL_MODE c) {
+	R->current.cull = c;
+	R->changeflag |= CHANGE_CULL;
+}
+
+// render target
+RID
+render_target_create(struct render *R, int width, int height, enum TEXTURE_FORMAT format) {
+	RID tex = render_texture_create(R, width, height, format, TEXTURE_2D, 0);
+	if (tex == 0)
+		return 0;
+	struct target *tar = (struct target *)array_alloc(&R->target);
+	if (tar == NULL) {
+		render_release(R, TEXTURE, tex);
+		return 0;
+	}
+	tar->tex = tex;
+	R->last.target = 0;
+	R->changeflag |= CHANGE_TARGET;
+
+	RID rt = array_id(&R->target, tar);
+	CMD(R, "target_create %d %d\n", rt, tex);
+	return rt;
+}
+
+void
+render_read_pixels(struct render *R, int width, int height, enum TEXTURE_FORMAT format, void* buf) {
+	memset(buf, 0, calc_texture_size(format, width, height));
+	CMD(R, "read_pixels %d %d %d\n", width, height, format);
+}
+
+RID
+render_target_texture(struct render *R, RID rt) {
+	struct target *tar = (struct target *)array_ref(&R->target, rt);
+	if (tar) {
+		return tar->tex;
+	} else {
+		return 0;
+	}
+}
+
+// render state
+
+static void
+render_state_commit(struct render *R) {
+	if (R->changeflag & CHANGE_VERTEXARRAY) {
+		CMD(R, "vertexarray %d %d\n", R->vbslot[0], R->indexbuffer);
+	}
+
+	if (R->changeflag & CHANGE_TEXTURE) {
+		int i;
+		for (i=0;i<MAX_TEXTURE;i++) {
+			RID id = R->current.texture[i];
+			if (id != R->last.texture[i]) {
+				R->last.texture[i] = id;
+				if (array_ref(&R->texture, id)) {
+					++R->stat.state_change;
+					CMD(R, "texture %d %d\n", i, id);
+				}
+			}
+		}
+	}
+
+	if (R->changeflag & CHANGE_TARGET) {
+		RID crt = R->current.target;
+		if (R->last.target != crt) {
+			if (crt != 0 && array_ref(&R->target, crt) == NULL) {
+				crt = 0;
+			}
+			R->last.target = crt;
+			++R->stat.state_change;
+			CMD(R, "target %d\n", crt);
+		}
+	}
+
+	if (R->changeflag & CHANGE_BLEND) {
+		if (R->last.blend_src != R->current.blend_src || R->last.blend_dst != R->current.blend_dst) {
+			R->last.blend_src = R->current.blend_src;
+			R->last.blend_dst = R->current.blend_dst;
+			++R->stat.state_change;
+			CMD(R, "blend %d %d\n", R->current.blend_src, R->current.blend_dst);
+		}
+	}
+
+	if (R->changeflag & CHANGE_DEPTH) {
+		if (R->last.depth != R->current.depth) {
+			R->last.depth = R->current.depth;
+			++R->stat.state_change;
+			CMD(R, "depth %d\n", R->current.depth);
+		}
+		if (R->last.depthmask != R->current.depthmask) {
+			R->last.depthmask = R->current.depthmask;
+			++R->stat.state_change;
+			CMD(R, "depthmask %d\n", R->current.depthmask);
+		}
+	}
+
+	if (R->changeflag & CHANGE_CULL) {
+		if (R->last.cull != R->current.cull) {
+			R->last.cull = R->current.cull;
+			++R->stat.state_change;
+			CMD(R, "cull %d\n", R->current.cull);
+		}
+	}
+
+	if (R->changeflag & CHANGE_SCISSOR) {
+		if (R->last.scissor != R->current.scissor) {
+			R->last.scissor = R->current.scissor;
+			++R->stat.state_change;
+			CMD(R, "enablescissor %d\n", R->current.scissor);
+		}
+	}
+
+	R->changeflag = 0;
+}
+
+void
+render_state_reset(struct render *R) {
+	R->changeflag = ~0;
+	memset(&R->last, 0 , sizeof(R->last));
+	CMD(R, "state_reset\n");
+}
+
+// draw
+void
+render_draw(struct render *R, enum DRAW_MODE mode, int fromidx, int ni) {
+	assert(mode == DRAW_TRIANGLE || mode == DRAW_LINE);
+	render_state_commit(R);
+	struct buffer * buf = (struct buffer *)array_ref(&R->buffer, R->indexbuffer);
+	if (buf) {
+		assert(fromidx + ni <= buf->n);
+		++R->stat.drawcall;
+		R->stat.primitive += (mode == DRAW_TRIANGLE) ? ni / 3 : ni / 2;
+		CMD(R, "draw %d %d %d\n", mode, fromidx, ni);
+	}
+}
+
+int
+render_support_instance(struct render *R) {
+	return 1;
+}
+
+int
+render_support_index32(struct render *R) {
+	return R->index32;
+}
+
+void
+render_draw_instanced(struct render *R, enum DRAW_MODE mode, int fromidx, int ni, int instance) {
+	assert(mode == DRAW_TRIANGLE || mode == DRAW_LINE);
+	render_state_commit(R);
+	struct buffer * buf = (struct buffer *)array_ref(&R->buffer, R->indexbuffer);
+	if (buf) {
+		assert(fromidx + ni <= buf->n);
+		++R->stat.drawcall;
+		R->stat.primitive += ((mode == DRAW_TRIANGLE) ? ni / 3 : ni / 2) * instance;
+		CMD(R, "draw_instanced %d %d %d %d\n", mode, fromidx, ni, instance);
+	}
+}
+
+void
+render_clear(struct render *R, enum CLEAR_MASK mask, unsigned long c) {
+	render_state_commit(R);
+	CMD(R, "clear %d %08lx\n", mask, c);
+}
+
+// uniform
+
+// Locations are the index of the name in the bound shader, as GL would give a stable one.
+int
+render_shader_locuniform(struct render *R, const char * name) {
+	struct shader * s = (struct shader *)array_ref(&R->shader, R->program);
+	if (s == NULL)
+		return -1;
+	int i;
+	for (i=0;i<s->uniform_n;i++) {
+		if (strcmp(s->uniform[i], name) == 0)
+			return i;
+	}
+	if (s->uniform_n >= MAX_UNIFORM || strlen(name) >= sizeof(s->uniform[0]))
+		return -1;
+	strcpy(s->uniform[i], name);
+	++s->uniform_n;
+	return i;
+}
+
+void
+render_shader_setuniform(struct render *R, int loc, enum UNIFORM_FORMAT format, const float *v) {
+	static int n[] = { 0, 1, 2, 3, 4, 9, 16 };
+	assert(format > UNIFORM_INVALID && format <= UNIFORM_FLOAT44);
+	if (R->cmd) {
+		int i;
+		fprintf(R->cmd, "uniform %d", loc);
+		for (i=0;i<n[format];i++) {
+			fprintf(R->cmd, " %g", v[i]);
+		}
+		fprintf(R->cmd, "\n");
+	}
+}
+
+int
+render_version(struct render *R) {
+	return 2;
+}
+
+void
+render_getstat(struct render *R, struct render_stat *stat) {
+	*stat = R->stat;
+}
+
+void
+render_resetstat(struct render *R) {
+	memset(&R->stat, 0, sizeof(R->stat));
+}
@@ -0,0 +1,12 @@
+#ifndef ejoy3d_nullrender_h
+#define ejoy3d_nullrender_h
+
+#include <stdio.h>
+
+// The null backend implements render.h without any GL context.
+// Every committed command is written as one text line to the log file (NULL to disable).
+// Call it before render_init.
+
+void render_null_setlog(FILE *f);
+
+#endif
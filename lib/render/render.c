@@ -28,6 +28,19 @@
 #endif
 
 
+// Stream buffer is a ring split into segments. With sync objects (GL3), a fence is put
+// at the end of each segment, and we wait for it before writing the segment again.
+// Otherwise the storage is orphaned when the ring wraps.
+#if OPENGLES == 3
+#define STREAM_FENCE
+#endif
+#define STREAM_SEGMENT 4
+
+// Instanced draw is core in GL3/ES3; desktop GL through glew checks it at runtime.
+#if OPENGLES == 3 || OPENGLES == 0
+#define INSTANCE_API
+#endif
+
 #define MAX_VB_SLOT 8
 #define MAX_ATTRIB 16
 #define MAX_TEXTURE 8
@@ -48,6 +61,13 @@ struct buffer {
 	GLenum gltype;
 	int n;
 	int stride;
+	int stream;	// size of ring in bytes, 0 for normal buffer
+	int offset;	// where the last update begins
+	int head;
+	int segment;
+#ifdef STREAM_FENCE
+	GLsync fence[STREAM_SEGMENT];
+#endif
 };
 
 struct attrib {
@@ -76,6 +96,7 @@ struct attrib_layout {
  	GLenum type;
  	GLboolean normalized;
 	int offset;
+	int divisor;
 };
 
 struct shader {
@@ -83,7 +104,9 @@ struct shader {
 #ifdef VAO_ENABLE
 	GLuint glvao;
 	RID vbslot[MAX_VB_SLOT];
+	int vboffset[MAX_VB_SLOT];
 	RID ib;
+	int buffer_version;
 #endif
 	int n;
 	struct attrib_layout a[MAX_ATTRIB];
@@ -112,6 +135,11 @@ struct render {
 	struct rstate current;
 	struct rstate last;
 	struct log log;
+	struct render_stat stat;
+	int instance;
+	int index32;
+	// changes when a buffer is released, its RID may be reused by the next one
+	int buffer_version;
 	struct array buffer;
 	struct array attrib;
 	struct array target;
@@ -141,6 +169,7 @@ render_buffer_create(struct render *R, enum RENDER_OBJ what, const void *data, i
 	GLenum gltype;
 	switch(what) {
 	case VERTEXBUFFER:
+	case STREAMBUFFER:
 		gltype = GL_ARRAY_BUFFER;
 		break;
 	case INDEXBUFFER:
@@ -152,11 +181,18 @@ render_buffer_create(struct render *R, enum RENDER_OBJ what, const void *data, i
 	struct buffer * buf = (struct buffer *)array_alloc(&R->buffer);
 	if (buf == NULL)
 		return 0;
+	memset(buf, 0, sizeof(*buf));
 	glGenBuffers(1, &buf->glid);
 	glBindBuffer(gltype, buf->glid);
-	if (data && n > 0) {
+	if (what == STREAMBUFFER) {
+		// n is the capacity of the ring
+		buf->stream = n * stride;
+		glBufferData(gltype, buf->stream, NULL, GL_STREAM_DRAW);
+		buf->n = 0;
+	} else if (data && n > 0) {
 		glBufferData(gltype, n * stride, data, GL_STATIC_DRAW);
 		buf->n = n;
+		R->stat.buffer_upload += n * stride;
 	} else {
 		buf->n = 0;
 	}
@@ -168,6 +204,66 @@ render_buffer_create(struct render *R, enum RENDER_OBJ what, const void *data, i
 	return array_id(&R->buffer, buf);
 }
 
+#ifdef STREAM_FENCE
+
+static void
+stream_next_segment(struct render *R, struct buffer *buf) {
+	int s = buf->segment;
+	if (buf->fence[s]) {
+		glDeleteSync(buf->fence[s]);
+	}
+	buf->fence[s] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	s = (s + 1) % STREAM_SEGMENT;
+	buf->segment = s;
+	GLsync fence = buf->fence[s];
+	if (fence) {
+		GLenum r = glClientWaitSync(fence, 0, 0);
+		if (r == GL_TIMEOUT_EXPIRED) {
+			++R->stat.fence_wait;
+			do {
+				r = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			} while (r == GL_TIMEOUT_EXPIRED);
+		}
+		glDeleteSync(fence);
+		buf->fence[s] = 0;
+	}
+}
+
+#endif
+
+static void
+stream_update(struct render *R, struct buffer *buf, const void *data, int n) {
+	int sz = n * buf->stride;
+	int segsz = buf->stream / STREAM_SEGMENT;
+	assert(sz <= segsz);
+	int head = buf->head;
+#ifdef STREAM_FENCE
+	// a write never crosses a segment boundary, so the fence of its segment covers all of it
+	if (head % segsz + sz > segsz) {
+		head = (head / segsz + 1) * segsz;
+	}
+	if (head + sz > segsz * STREAM_SEGMENT) {
+		head = 0;
+	}
+	int seg = head / segsz;
+	while (buf->segment != seg) {
+		stream_next_segment(R, buf);
+	}
+	void * ptr = glMapBufferRange(GL_ARRAY_BUFFER, head, sz,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	memcpy(ptr, data, sz);
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+#else
+	if (head + sz > buf->stream) {
+		head = 0;
+		glBufferData(GL_ARRAY_BUFFER, buf->stream, NULL, GL_STREAM_DRAW);
+	}
+	glBufferSubData(GL_ARRAY_BUFFER, head, sz, data);
+#endif
+	buf->offset = head;
+	buf->head = head + sz;
+}
+
 void 
 render_buffer_update(struct render *R, RID id, const void * data, int n) {
 	struct buffer * buf = (struct buffer *)array_ref(&R->buffer, id);
@@ -177,13 +273,26 @@ render_buffer_update(struct render *R, RID id, const void * data, int n) {
 	R->changeflag |= CHANGE_VERTEXARRAY;
 	glBindBuffer(buf->gltype, buf->glid);
 	buf->n = n;
-	glBufferData(buf->gltype, n * buf->stride, data, GL_DYNAMIC_DRAW);
+	if (buf->stream) {
+		stream_update(R, buf, data, n);
+	} else {
+		glBufferData(buf->gltype, n * buf->stride, data, GL_DYNAMIC_DRAW);
+	}
+	R->stat.buffer_upload += n * buf->stride;
 	CHECK_GL_ERROR
 }
 
 static void
 close_buffer(void *p, void *R) {
 	struct buffer * buf = (struct buffer *)p;
+#ifdef STREAM_FENCE
+	int i;
+	for (i=0;i<STREAM_SEGMENT;i++) {
+		if (buf->fence[i]) {
+			glDeleteSync(buf->fence[i]);
+		}
+	}
+#endif
 	glDeleteBuffers(1,&buf->glid);
 
 	CHECK_GL_ERROR
@@ -284,6 +393,7 @@ compile_link(struct render *R, struct shader *s, const char * VS, const char *FS
 		glBindAttribLocation(s->glid, i, va->name);
 		al->vbslot = va->vbslot;
 		al->offset = va->offset;
+		al->divisor = va->divisor;
 		al->size = va->n;
 		switch (va->size) {
 		case 1:
@@ -329,8 +439,10 @@ render_shader_create(struct render *R, struct shader_init_args *args) {
 	glGenVertexArrays(1, &s->glvao);
 	for (i=0;i<MAX_VB_SLOT;i++) {
 		s->vbslot[i] = 0;
+		s->vboffset[i] = 0;
 	}
 	s->ib = 0;
+	s->buffer_version = R->buffer_version;
 #endif
 
 	CHECK_GL_ERROR
@@ -369,11 +481,13 @@ void
 render_release(struct render *R, enum RENDER_OBJ what, RID id) {
 	switch (what) {
 	case VERTEXBUFFER:
-	case INDEXBUFFER: {
+	case INDEXBUFFER:
+	case STREAMBUFFER: {
 		struct buffer * buf = (struct buffer *)array_ref(&R->buffer, id);
 		if (buf) {
 			close_buffer(buf, R);
 			array_free(&R->buffer, buf);
+			++R->buffer_version;
 		}
 		break;
 	}
@@ -411,6 +525,7 @@ void
 render_set(struct render *R, enum RENDER_OBJ what, RID id, int slot) {
 	switch (what) {
 	case VERTEXBUFFER:
+	case STREAMBUFFER:
 		assert(slot >= 0 && slot < MAX_VB_SLOT);
 		R->vbslot[slot] = id;
 		R->changeflag |= CHANGE_VERTEXARRAY;
@@ -452,6 +567,7 @@ void
 render_shader_bind(struct render *R, RID id) {
 	R->program = id;
 	R->changeflag |= CHANGE_VERTEXARRAY;
+	++R->stat.state_change;
 	struct shader * s = (struct shader *)array_ref(&R->shader, id);
 	if (s) {
 		glUseProgram(s->glid);
@@ -494,6 +610,17 @@ render_init(struct render_init_args *args, void * buffer, int sz) {
 	new_array(&B, &R->shader, args->max_shader, sizeof(struct shader));
 
 	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &R->default_framebuffer);
+#if OPENGLES == 3
+	R->instance = 1;
+#elif OPENGLES == 0
+	R->instance = glVertexAttribDivisor != NULL && glDrawElementsInstanced != NULL;
+#endif
+#if OPENGLES == 2
+	const char *ext = (const char *)glGetString(GL_EXTENSIONS);
+	R->index32 = ext && strstr(ext, "GL_OES_element_index_uint") != NULL;
+#else
+	R->index32 = 1;
+#endif
 
 	CHECK_GL_ERROR
 
@@ -521,8 +648,18 @@ render_setscissor(struct render *R, int x, int y, int width, int height ) {
 static int
 change_vb(struct render *R, struct shader * s) {
 #ifdef VAO_ENABLE
-	int change = memcmp(R->vbslot, s->vbslot, sizeof(R->vbslot));
+	int change = memcmp(R->vbslot, s->vbslot, sizeof(R->vbslot)) || s->buffer_version != R->buffer_version;
 	memcpy(s->vbslot, R->vbslot, sizeof(R->vbslot));
+	// the data of a stream buffer moves after each update
+	int i;
+	for (i=0;i<MAX_VB_SLOT;i++) {
+		struct buffer * buf = (struct buffer *)array_ref(&R->buffer, R->vbslot[i]);
+		int offset = buf ? buf->offset : 0;
+		if (offset != s->vboffset[i]) {
+			s->vboffset[i] = offset;
+			change = 1;
+		}
+	}
 	return change;
 #else
 	return 1;
@@ -534,7 +671,10 @@ change_ib(struct render *R, struct shader *s) {
 #ifdef VAO_ENABLE
 	RID ib = s->ib;
 	s->ib = R->indexbuffer;
-	return (R->indexbuffer != ib);
+	// the VAO may keep a released buffer of the same RID
+	int version = s->buffer_version;
+	s->buffer_version = R->buffer_version;
+	return (R->indexbuffer != ib) || version != R->buffer_version;
 #else
 	return 1;
 #endif
@@ -552,6 +692,7 @@ apply_va(struct render *R) {
 			int i;
 			RID last_vb = 0;
 			int stride = 0;
+			int offset = 0;
 			for (i=0;i<s->n;i++) {
 				struct attrib_layout *al = &s->a[i];
 				int vbidx = al->vbslot;
@@ -564,9 +705,15 @@ apply_va(struct render *R) {
 					glBindBuffer(GL_ARRAY_BUFFER, buf->glid);
 					last_vb = vb;
 					stride = buf->stride;
+					offset = buf->offset;
 				}
 				glEnableVertexAttribArray(i);
-				glVertexAttribPointer(i, al->size, al->type, al->normalized, stride, (const GLvoid *)(ptrdiff_t)(al->offset));
+				glVertexAttribPointer(i, al->size, al->type, al->normalized, stride, (const GLvoid *)(ptrdiff_t)(al->offset + offset));
+#ifdef INSTANCE_API
+				if (R->instance) {
+					glVertexAttribDivisor(i, al->divisor);
+				}
+#endif
 			}
 		}
 
@@ -741,6 +888,9 @@ render_texture_update(struct render *R, RID id, int width, int height, const voi
 	} else {
 		glTexImage2D(target, miplevel, format, (GLsizei)width, (GLsizei)height, 0, format, itype, pixels);
 	}
+	if (pixels) {
+		R->stat.texture_upload += calc_texture_size(tex->format, width, height);
+	}
 
 	CHECK_GL_ERROR
 }
@@ -766,6 +916,7 @@ render_texture_subupdate(struct render *R, RID id, const void *pixels, int x, in
 	} else {
 		glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, format, itype, pixels);
 	}
+	R->stat.texture_upload += calc_texture_size(tex->format, w, h);
 
 	CHECK_GL_ERROR
 }
@@ -887,6 +1038,7 @@ render_state_commit(struct render *R) {
 				if (tex) {
 					glActiveTexture(GL_TEXTURE0 + i);
 					glBindTexture(mode[tex->type], tex->glid);
+					++R->stat.state_change;
 				}
 			}
 		}
@@ -907,6 +1059,7 @@ render_state_commit(struct render *R) {
 			}
 			glBindFramebuffer(GL_FRAMEBUFFER, rt);
 			R->last.target = crt;
+			++R->stat.state_change;
 			CHECK_GL_ERROR
 		}
 	}
@@ -939,6 +1092,7 @@ render_state_commit(struct render *R) {
 
 			R->last.blend_src = src;
 			R->last.blend_dst = dst;
+			++R->stat.state_change;
 		}
 	}
 
@@ -962,10 +1116,12 @@ render_state_commit(struct render *R) {
 				glDepthFunc( depth[R->current.depth] );
 			}
 			R->last.depth = R->current.depth;
+			++R->stat.state_change;
 		}
 		if (R->last.depthmask != R->current.depthmask) {
 			glDepthMask(R->current.depthmask ? GL_TRUE : GL_FALSE);
 			R->last.depthmask = R->current.depthmask;
+			++R->stat.state_change;
 		}
 	}
 
@@ -980,6 +1136,7 @@ render_state_commit(struct render *R) {
 				glCullFace(R->current.cull == CULL_FRONT ? GL_FRONT : GL_BACK);
 			}
 			R->last.cull = R->current.cull;
+			++R->stat.state_change;
 		}
 	}
 
@@ -991,6 +1148,7 @@ render_state_commit(struct render *R) {
 				glDisable(GL_SCISSOR_TEST);
 			}
 			R->last.scissor = R->current.scissor;
+			++R->stat.state_change;
 		}
 	}
 
@@ -1014,30 +1172,76 @@ render_state_reset(struct render *R) {
 }
 
 // draw
-void 
-render_draw(struct render *R, enum DRAW_MODE mode, int fromidx, int ni) {
-	static int draw_mode[] = {
-		GL_TRIANGLES,
-		GL_LINES,
-	};
+static int draw_mode[] = {
+	GL_TRIANGLES,
+	GL_LINES,
+};
+
+static struct buffer *
+index_buffer(struct render *R, enum DRAW_MODE mode, int fromidx, int ni, GLenum *type, int *offset) {
 	assert((int)mode < sizeof(draw_mode)/sizeof(int));
 	render_state_commit(R);
 	RID ib = R->indexbuffer;
 	struct buffer * buf = (struct buffer *)array_ref(&R->buffer, ib);
 	if (buf) {
 		assert(fromidx + ni <= buf->n);
-		int offset = fromidx;
-		GLenum type = GL_UNSIGNED_SHORT;
-		if (buf->stride == 1) {
-			type = GL_UNSIGNED_BYTE;
-		} else {
-			offset *= sizeof(short);
+		*offset = fromidx * buf->stride;
+		switch (buf->stride) {
+		case 1:
+			*type = GL_UNSIGNED_BYTE;
+			break;
+		case 4:
+			// OpenGL ES 2.0 needs OES_element_index_uint, see render_support_index32
+			assert(R->index32);
+			*type = GL_UNSIGNED_INT;
+			break;
+		default:
+			*type = GL_UNSIGNED_SHORT;
+			break;
 		}
+	}
+	return buf;
+}
+
+void 
+render_draw(struct render *R, enum DRAW_MODE mode, int fromidx, int ni) {
+	GLenum type;
+	int offset;
+	if (index_buffer(R, mode, fromidx, ni, &type, &offset)) {
 		glDrawElements(draw_mode[mode], ni, type, (char *)0 + offset);
+		++R->stat.drawcall;
+		R->stat.primitive += (mode == DRAW_TRIANGLE) ? ni / 3 : ni / 2;
 		CHECK_GL_ERROR
 	}
 }
 
+int
+render_support_instance(struct render *R) {
+	return R->instance;
+}
+
+int
+render_support_index32(struct render *R) {
+	return R->index32;
+}
+
+void
+render_draw_instanced(struct render *R, enum DRAW_MODE mode, int fromidx, int ni, int instance) {
+#ifdef INSTANCE_API
+	assert(R->instance);
+	GLenum type;
+	int offset;
+	if (index_buffer(R, mode, fromidx, ni, &type, &offset)) {
+		glDrawElementsInstanced(draw_mode[mode], ni, type, (char *)0 + offset, instance);
+		++R->stat.drawcall;
+		R->stat.primitive += ((mode == DRAW_TRIANGLE) ? ni / 3 : ni / 2) * instance;
+		CHECK_GL_ERROR
+	}
+#else
+	assert(0);
+#endif
+}
+
 void
 render_clear(struct render *R, enum CLEAR_MASK mask, unsigned long c) {
 	GLbitfield m = 0;
@@ -1106,3 +1310,13 @@ int
 render_version(struct render *R) {
 	return OPENGLES;
 }
+
+void
+render_getstat(struct render *R, struct render_stat *stat) {
+	*stat = R->stat;
+}
+
+void
+render_resetstat(struct render *R) {
+	memset(&R->stat, 0, sizeof(R->stat));
+}
@@ -21,6 +21,7 @@ struct vertex_attrib {
 	int n;
 	int size;
 	int offset;
+	int divisor;	// 0 for per-vertex attrib, 1 for per-instance attrib
 };
 
 struct shader_init_args {
@@ -38,6 +39,7 @@ enum RENDER_OBJ {
 	TEXTURE = 4,
 	TARGET = 5,
 	SHADER = 6,
+	STREAMBUFFER = 7,	// vertex buffer as a ring, each update appends to a fresh region
 };
 
 enum TEXTURE_TYPE {
@@ -110,6 +112,15 @@ enum CULL_MODE {
 	CULL_BACK,
 };
 
+struct render_stat {
+	int drawcall;
+	int primitive;
+	int state_change;	// shader/texture/blend/depth/cull/scissor/target switches committed
+	int buffer_upload;	// bytes
+	int texture_upload;	// bytes
+	int fence_wait;	// stream buffer waits for gpu before reusing a region
+};
+
 int render_version(struct render *R);
 int render_size(struct render_init_args *args);
 struct render * render_init(struct render_init_args *args, void * buffer, int sz);
@@ -152,5 +163,13 @@ void render_state_reset(struct render *R);
 
 void render_clear(struct render *R, enum CLEAR_MASK mask, unsigned long argb);
 void render_draw(struct render *R, enum DRAW_MODE mode, int fromidx, int ni);
+// returns 0 if the device can't draw instanced (attrib divisor is ignored)
+int render_support_instance(struct render *R);
+// returns 0 if the index buffer can't be 32bit (OpenGL ES 2.0 without OES_element_index_uint)
+int render_support_index32(struct render *R);
+void render_draw_instanced(struct render *R, enum DRAW_MODE mode, int fromidx, int ni, int instance);
+
+void render_getstat(struct render *R, struct render_stat *stat);
+void render_resetstat(struct render *R);
 
 #endif
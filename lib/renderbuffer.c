@@ -7,6 +7,7 @@
 
 #include <assert.h>
 #include <string.h>
+#include <stdlib.h>
 
 static struct render *R = NULL;
 
@@ -15,10 +16,30 @@ renderbuffer_initrender(struct render *r) {
 	R = r;
 }
 
+// without 32bit index, the quads are limited to what 16bit index can address
+static int
+limit_capacity(int capacity) {
+	if (R && !render_support_index32(R) && capacity > MAX_QUAD_INDEX16) {
+		return MAX_QUAD_INDEX16;
+	}
+	return capacity;
+}
+
+void
+renderbuffer_reserve(struct render_buffer *rb, int capacity) {
+	assert(capacity >= rb->object);
+	rb->vb = (struct quad *)realloc(rb->vb, capacity * sizeof(struct quad));
+	rb->capacity = capacity;
+}
+
 int
 renderbuffer_add(struct render_buffer *rb, const struct vertex_pack vb[4], uint32_t color, uint32_t additive) {
-	if (rb->object >= MAX_COMMBINE) {
-		return 1;
+	if (rb->object >= rb->capacity) {
+		int capacity = limit_capacity(rb->capacity * 2);
+		if (!rb->grow || capacity <= rb->capacity) {
+			return 1;
+		}
+		renderbuffer_reserve(rb, capacity);
 	}
 
 	struct quad *q = rb->vb + rb->object;
@@ -34,7 +55,7 @@ renderbuffer_add(struct render_buffer *rb, const struct vertex_pack vb[4], uint3
 		q->p[i].add[2] = (additive) & 0xff;
 		q->p[i].add[3] = (additive >> 24) & 0xff;
 	}
-	if (++rb->object >= MAX_COMMBINE) {
+	if (++rb->object >= rb->capacity && !rb->grow) {
 		return 1;
 	}
 	return 0;
@@ -169,6 +190,10 @@ drawsprite(struct render_buffer *rb, struct sprite *s, struct sprite_trans * ts)
 	struct sprite_trans *t = sprite_trans_mul(&s->t, ts, &temp, &temp_matrix);
 	switch (s->type) {
 	case TYPE_PICTURE:
+		if (s->data.ps) {
+			// particle can't be drawn into renderbuffer
+			return -1;
+		}
 		return drawquad(rb, s->s.pic, t);
 	case TYPE_POLYGON:
 		return drawpolygon(rb, s->pack, s->s.poly, t);
@@ -247,8 +272,21 @@ renderbuffer_unload(struct render_buffer *rb) {
 }
 
 void 
-renderbuffer_init(struct render_buffer *rb) {
+renderbuffer_init(struct render_buffer *rb, int capacity, int grow) {
 	rb->object = 0;
+	rb->capacity = 0;
+	rb->grow = grow;
 	rb->texid = 0;
 	rb->vbid = 0;
+	rb->vb = NULL;
+	renderbuffer_reserve(rb, limit_capacity(capacity));
+}
+
+void
+renderbuffer_exit(struct render_buffer *rb) {
+	renderbuffer_unload(rb);
+	free(rb->vb);
+	rb->vb = NULL;
+	rb->capacity = 0;
+	rb->object = 0;
 }
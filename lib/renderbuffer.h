@@ -4,7 +4,10 @@
 #include <stdint.h>
 #include "render.h"
 
+// default batch size (quads), see shader_setbatch
 #define MAX_COMMBINE 1024
+// the most quads 16bit index can address, a batch or renderbuffer can't be larger without render_support_index32
+#define MAX_QUAD_INDEX16 (0x10000 / 4)
 
 struct vertex_pack {
 	float vx;
@@ -16,7 +19,7 @@ struct vertex_pack {
 struct vertex {
 	struct vertex_pack vp;
 	uint8_t rgba[4];
-	uint8_t add[4];
+	uint8_t add[4];	// add[3] is the texture slot for PROGRAM_PICTURE_MULTI
 };
 
 struct quad {
@@ -25,14 +28,18 @@ struct quad {
 
 struct render_buffer {
 	int object;
+	int capacity;
+	int grow;	// grow on demand instead of being full
 	int texid;
 	RID vbid;
-	struct quad vb[MAX_COMMBINE];
+	struct quad *vb;
 };
 
 
 void renderbuffer_initrender(struct render *R);
-void renderbuffer_init(struct render_buffer *rb);
+void renderbuffer_init(struct render_buffer *rb, int capacity, int grow);
+void renderbuffer_exit(struct render_buffer *rb);
+void renderbuffer_reserve(struct render_buffer *rb, int capacity);
 void renderbuffer_upload(struct render_buffer *rb);
 void renderbuffer_unload(struct render_buffer *rb);
 
@@ -44,7 +51,7 @@ static inline void renderbuffer_clear(struct render_buffer *rb) {
 
 struct sprite;
 
-// 0 : ok, 1 full, -1 error (type must be picture)
+// 0 : ok, 1 full (never for growable buffer), -1 error (type must be picture)
 int renderbuffer_drawsprite(struct render_buffer *rb, struct sprite *s);
 
 #endif
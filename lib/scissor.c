@@ -1,6 +1,7 @@
 #include "scissor.h"
 #include "screen.h"
 #include "shader.h"
+#include "spritepack.h"
 
 #include <assert.h>
 
@@ -70,3 +71,24 @@ scissor_pop() {
 	struct box * s = &S.s[S.depth-1];
 	screen_scissor(s->x,s->y,s->width,s->height);
 }
+
+void
+scissor_viewbox(int box[4]) {
+	screen_viewbox(box);
+	if (S.depth == 0) {
+		return;
+	}
+	struct box * s = &S.s[S.depth-1];
+	int minx = s->x * SCREEN_SCALE;
+	int miny = s->y * SCREEN_SCALE;
+	int maxx = (s->x + s->width) * SCREEN_SCALE;
+	int maxy = (s->y + s->height) * SCREEN_SCALE;
+	if (minx > box[0])
+		box[0] = minx;
+	if (miny > box[1])
+		box[1] = miny;
+	if (maxx < box[2])
+		box[2] = maxx;
+	if (maxy < box[3])
+		box[3] = maxy;
+}
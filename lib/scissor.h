@@ -3,5 +3,7 @@
 
 void scissor_push(int x, int y, int w, int h);
 void scissor_pop();
+// the visible box (screen clipped by the current scissor) : minx, miny, maxx, maxy in SCREEN_SCALE unit
+void scissor_viewbox(int box[4]);
 
 #endif
@@ -11,5 +11,7 @@ EJOY_API void screen_init(float w, float h, float scale);
 void screen_trans(float *x, float *y);
 void screen_scissor(int x, int y, int w, int h);
 bool screen_is_visible(float x,float y);
+// minx, miny, maxx, maxy of the screen in SCREEN_SCALE unit
+void screen_viewbox(int box[4]);
 
 #endif
@@ -20,17 +20,21 @@ _get_screenshot_pixels(int x, int y, int w, int h, unsigned char *pixels) {
 static void
 _fill_sprite_with_texure(int tex_id, struct sprite* s, int w, int h) {
 	s->parent = NULL;
+	s->pack = NULL;
 	s->type = TYPE_PICTURE;
 	s->id = 0;
 	s->t.mat = NULL;
 	s->t.color = 0xffffffff;
 	s->t.additive = 0;
 	s->t.program = PROGRAM_DEFAULT;
+	s->t.mirror_x = false;
+	s->t.mirror_y = false;
 
 	s->start_frame = 0;
 	s->total_frame = 0;
 	s->frame = 0;
-	s->flags = 0;
+	s->flags = SPRFLAG_UNBOUND;	// not in a pack, no bound for culling
+	sprite_world_init(s);
 	s->name = NULL;
 	s->material = NULL;
 	memset(&s->data, 0, sizeof(s->data));
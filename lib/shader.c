@@ -18,13 +18,24 @@
 #include <assert.h>
 #include <stdbool.h>
 
-#define MAX_PROGRAM 16
+#define MAX_PROGRAM 18	// 11 built-in programs and 7 user defined (ejoy2d/shader.lua)
 
 #define BUFFER_OFFSET(f) ((intptr_t)&(((struct vertex *)NULL)->f))
+#define INSTANCE_OFFSET(f) ((intptr_t)&(((struct instance *)NULL)->f))
 
 #define MAX_UNIFORM 16
 #define MAX_TEXTURE_CHANNEL 8
 
+// the streaming vertex buffer holds this many full batches
+#define STREAM_BATCH 8
+// instances per instanced draw call
+#define INSTANCE_BATCH 16384
+
+#define MAX_DEFERRED 4096
+#define MAX_DEFERRED_KEY 256
+// how many batches to look back for the same state
+#define DEFERRED_LOOKBACK 32
+
 struct uniform {
 	int loc;
 	int offset;
@@ -42,23 +53,116 @@ struct program {
 	float uniform_value[MAX_UNIFORM * 16];
 };
 
+// the state a quad should be drawn with in deferred mode. scissor is not here,
+// because scissor_push/pop flushes the queue.
+struct draw_key {
+	int program;
+	struct material * material;
+	RID tex[MAX_TEXTURE_CHANNEL];
+	enum BLEND_FORMAT blend_src;
+	enum BLEND_FORMAT blend_dst;
+};
+
+struct deferred_quad {
+	struct vertex_pack vb[4];
+	uint32_t color;
+	uint32_t additive;
+	int next;
+};
+
+struct deferred_batch {
+	int key;
+	int head;
+	int tail;
+	float minx, miny, maxx, maxy;
+};
+
+struct deferred_queue {
+	struct draw_key current;
+	int key_dirty;
+	int last_key;
+	int runs;
+	int n;
+	int key_n;
+	int batch_n;
+	struct draw_key key[MAX_DEFERRED_KEY];
+	struct deferred_batch batch[MAX_DEFERRED];
+	struct deferred_quad q[MAX_DEFERRED];
+};
+
 struct render_state {
 	struct render * R;
 	int current_program;
 	struct program program[MAX_PROGRAM];
 	RID tex[MAX_TEXTURE_CHANNEL];
 	int blendchange;
+	enum BLEND_FORMAT blend_src;
+	enum BLEND_FORMAT blend_dst;
 	int drawcall;
+	int drawcall_saved;
+	struct deferred_queue * dq;
+	int multi;
+	RID tex0;	// texture for channel 0 in multi-texture mode
+	int slot;
+	int slot_next;
 	RID vertex_buffer;
 	RID index_buffer;
+	int index_capacity;	// quads
 	RID layout;
 	struct render_buffer vb;
+	RID instance_layout;
+	RID instance_buffer;
+	struct render_buffer instance_mesh;	// the mesh uploaded for instanced draw
 };
 
 static struct render_state *RS = NULL;
 
+static void deferred_flush();
+static void set_blend(enum BLEND_FORMAT src, enum BLEND_FORMAT dst);
+static void material_key(struct material *m, struct draw_key *key);
+
 void lsprite_initrender(struct render *r);
 
+// The index buffer is shared by the batch and all renderbuffers, so it must cover the largest one.
+// Switch to 32bit index when the vertices are more than 16bit can address, if the device supports it.
+static void
+index_reserve(int quads) {
+	struct render_state *rs = RS;
+	if (quads <= rs->index_capacity)
+		return;
+	// grow geometrically, a growing renderbuffer doesn't rebuild it each time
+	if (quads < rs->index_capacity * 2)
+		quads = rs->index_capacity * 2;
+	if (!render_support_index32(rs->R) && quads > MAX_QUAD_INDEX16) {
+		// the batch and renderbuffers are limited to it
+		quads = MAX_QUAD_INDEX16;
+		if (quads <= rs->index_capacity)
+			return;
+	}
+	int stride = (quads * 4 > 0x10000) ? sizeof(uint32_t) : sizeof(uint16_t);
+	void * idxs = malloc(6 * quads * stride);
+	int i,j;
+	for (i=0;i<quads;i++) {
+		static const int offset[6] = { 0, 1, 2, 0, 2, 3 };
+		for (j=0;j<6;j++) {
+			uint32_t v = i*4 + offset[j];
+			if (stride == sizeof(uint16_t)) {
+				((uint16_t *)idxs)[i*6+j] = v;
+			} else {
+				((uint32_t *)idxs)[i*6+j] = v;
+			}
+		}
+	}
+	RID ib = render_buffer_create(rs->R, INDEXBUFFER, idxs, 6 * quads, stride);
+	free(idxs);
+	if (rs->index_buffer) {
+		render_release(rs->R, INDEXBUFFER, rs->index_buffer);
+	}
+	rs->index_buffer = ib;
+	rs->index_capacity = quads;
+	render_set(rs->R, INDEXBUFFER, ib, 0);
+}
+
 void
 shader_init() {
 	if (RS) return;
@@ -85,21 +189,32 @@ shader_init() {
 
 	rs->current_program = -1;
 	rs->blendchange = 0;
+	rs->blend_src = BLEND_ONE;
+	rs->blend_dst = BLEND_ONE_MINUS_SRC_ALPHA;
 	render_setblend(rs->R, BLEND_ONE, BLEND_ONE_MINUS_SRC_ALPHA);
 
-	uint16_t idxs[6 * MAX_COMMBINE];
-	int i;
-	for (i=0;i<MAX_COMMBINE;i++) {
-		idxs[i*6] = i*4;
-		idxs[i*6+1] = i*4+1;
-		idxs[i*6+2] = i*4+2;
-		idxs[i*6+3] = i*4;
-		idxs[i*6+4] = i*4+2;
-		idxs[i*6+5] = i*4+3;
-	}
-	
-	rs->index_buffer = render_buffer_create(rs->R, INDEXBUFFER, idxs, 6 * MAX_COMMBINE, sizeof(uint16_t));
-	rs->vertex_buffer = render_buffer_create(rs->R, VERTEXBUFFER, NULL,  4 * MAX_COMMBINE, sizeof(struct vertex));
+	RS = rs;
+
+	renderbuffer_init(&rs->vb, MAX_COMMBINE, 0);
+	index_reserve(MAX_COMMBINE);
+	rs->vertex_buffer = render_buffer_create(rs->R, STREAMBUFFER, NULL,  4 * MAX_COMMBINE * STREAM_BATCH, sizeof(struct vertex));
+
+	if (render_support_instance(rs->R)) {
+		struct vertex_attrib iva[8] = {
+			{ "position", 0, 2, sizeof(float), BUFFER_OFFSET(vp.vx) },
+			{ "texcoord", 0, 2, sizeof(uint16_t), BUFFER_OFFSET(vp.tx) },
+			{ "color", 0, 4, sizeof(uint8_t), BUFFER_OFFSET(rgba) },
+			{ "additive", 0, 4, sizeof(uint8_t), BUFFER_OFFSET(add) },
+			{ "inst_m", 1, 4, sizeof(float), INSTANCE_OFFSET(m[0]), 1 },
+			{ "inst_t", 1, 2, sizeof(float), INSTANCE_OFFSET(m[4]), 1 },
+			{ "inst_color", 1, 4, sizeof(uint8_t), INSTANCE_OFFSET(color), 1 },
+			{ "inst_additive", 1, 4, sizeof(uint8_t), INSTANCE_OFFSET(add), 1 },
+		};
+		rs->instance_layout = render_register_vertexlayout(rs->R, sizeof(iva)/sizeof(iva[0]), iva);
+		// each of the 4 segments of the stream ring holds a full INSTANCE_BATCH
+		rs->instance_buffer = render_buffer_create(rs->R, STREAMBUFFER, NULL, INSTANCE_BATCH * 4, sizeof(struct instance));
+		renderbuffer_init(&rs->instance_mesh, 0, 1);
+	}
 
 	struct vertex_attrib va[4] = {
 		{ "position", 0, 2, sizeof(float), BUFFER_OFFSET(vp.vx) },
@@ -111,14 +226,16 @@ shader_init() {
 	render_set(rs->R, VERTEXLAYOUT, rs->layout, 0);
 	render_set(rs->R, INDEXBUFFER, rs->index_buffer, 0);
 	render_set(rs->R, VERTEXBUFFER, rs->vertex_buffer, 0);
-
-	RS = rs;
 }
 
 void
 shader_reset() {
 	struct render_state *rs = RS;
+	shader_flush();
 	render_state_reset(rs->R);
+	rs->blendchange = 0;
+	rs->blend_src = BLEND_ONE;
+	rs->blend_dst = BLEND_ONE_MINUS_SRC_ALPHA;
 	render_setblend(rs->R, BLEND_ONE, BLEND_ONE_MINUS_SRC_ALPHA);
 	if (RS->current_program != -1) {
 		render_shader_bind(rs->R, RS->program[RS->current_program].prog);
@@ -152,7 +269,17 @@ shader_load(int prog, const char *fs, const char *vs, int texture, const char **
 		render_release(RS->R, SHADER, p->prog);
 		p->prog = 0;
 	}
-	program_init(p, fs, vs, texture, texture_uniform_name);
+	if (prog == PROGRAM_PICTURE_INSTANCE) {
+		if (rs->instance_layout == 0) {
+			// no instanced draw, shader_drawinstance is never used
+			return;
+		}
+		render_set(rs->R, VERTEXLAYOUT, rs->instance_layout, 0);
+		program_init(p, fs, vs, texture, texture_uniform_name);
+		render_set(rs->R, VERTEXLAYOUT, rs->layout, 0);
+	} else {
+		program_init(p, fs, vs, texture, texture_uniform_name);
+	}
 	p->texture_number = texture;
 	RS->current_program = -1;
 }
@@ -171,6 +298,9 @@ shader_unload() {
 
 	render_exit(R);
 	free(R);
+	renderbuffer_exit(&RS->vb);
+	free(RS->instance_mesh.vb);
+	free(RS->dq);
 	free(RS);
 	RS = NULL;
 }
@@ -179,6 +309,8 @@ void
 reset_drawcall_count() {
 	if (RS) {
 		RS->drawcall = 0;
+		RS->drawcall_saved = 0;
+		render_resetstat(RS->R);
 	}
 }
 
@@ -191,6 +323,24 @@ drawcall_count() {
 	}
 }
 
+int
+drawcall_saved() {
+	if (RS) {
+		return RS->drawcall_saved;
+	} else {
+		return 0;
+	}
+}
+
+void
+shader_getstat(struct render_stat *stat) {
+	if (RS) {
+		render_getstat(RS->R, stat);
+	} else {
+		memset(stat, 0, sizeof(*stat));
+	}
+}
+
 static void 
 renderbuffer_commit(struct render_buffer * rb) {
 	struct render *R = RS->R;
@@ -210,13 +360,243 @@ rs_commit() {
 	rb->object = 0;
 }
 
-void 
-shader_drawbuffer(struct render_buffer * rb, float tx, float ty, float scale) {
+// deferred mode
+
+static int
+key_equal(const struct draw_key *a, const struct draw_key *b) {
+	return a->program == b->program &&
+		a->material == b->material &&
+		a->blend_src == b->blend_src &&
+		a->blend_dst == b->blend_dst &&
+		memcmp(a->tex, b->tex, sizeof(a->tex)) == 0;
+}
+
+static int
+key_id(struct deferred_queue *dq) {
+	int i;
+	for (i=dq->key_n-1;i>=0;i--) {
+		if (key_equal(&dq->key[i], &dq->current))
+			return i;
+	}
+	if (dq->key_n >= MAX_DEFERRED_KEY) {
+		return -1;
+	}
+	dq->key[dq->key_n] = dq->current;
+	return dq->key_n++;
+}
+
+static inline int
+overlap(struct deferred_batch *b, float minx, float miny, float maxx, float maxy) {
+	return !(maxx <= b->minx || minx >= b->maxx || maxy <= b->miny || miny >= b->maxy);
+}
+
+static void
+deferred_add(struct deferred_queue *dq, const struct vertex_pack vb[4], uint32_t color, uint32_t additive) {
+	if (dq->n >= MAX_DEFERRED) {
+		deferred_flush();
+	}
+	if (dq->key_dirty) {
+		int key = key_id(dq);
+		if (key < 0) {
+			deferred_flush();
+			key = key_id(dq);
+		}
+		if (key != dq->last_key) {
+			dq->last_key = key;
+			++dq->runs;
+		}
+		dq->key_dirty = 0;
+	}
+	int key = dq->last_key;
+	int idx = dq->n++;
+	struct deferred_quad *q = &dq->q[idx];
+	memcpy(q->vb, vb, sizeof(q->vb));
+	q->color = color;
+	q->additive = additive;
+	q->next = -1;
+
+	float minx = vb[0].vx, maxx = vb[0].vx;
+	float miny = vb[0].vy, maxy = vb[0].vy;
+	int i;
+	for (i=1;i<4;i++) {
+		if (vb[i].vx < minx) minx = vb[i].vx;
+		if (vb[i].vx > maxx) maxx = vb[i].vx;
+		if (vb[i].vy < miny) miny = vb[i].vy;
+		if (vb[i].vy > maxy) maxy = vb[i].vy;
+	}
+
+	// Walk back to the latest batch with the same state. The quad can join it
+	// only if it doesn't overlap anything drawn after that batch.
+	struct deferred_batch *b = NULL;
+	int stop = dq->batch_n - DEFERRED_LOOKBACK;
+	for (i=dq->batch_n-1;i>=0 && i>=stop;i--) {
+		struct deferred_batch *t = &dq->batch[i];
+		if (t->key == key) {
+			b = t;
+			break;
+		}
+		if (overlap(t, minx, miny, maxx, maxy))
+			break;
+	}
+	if (b == NULL) {
+		b = &dq->batch[dq->batch_n++];
+		b->key = key;
+		b->head = idx;
+		b->minx = minx;
+		b->miny = miny;
+		b->maxx = maxx;
+		b->maxy = maxy;
+	} else {
+		dq->q[b->tail].next = idx;
+		if (minx < b->minx) b->minx = minx;
+		if (miny < b->miny) b->miny = miny;
+		if (maxx > b->maxx) b->maxx = maxx;
+		if (maxy > b->maxy) b->maxy = maxy;
+	}
+	b->tail = idx;
+}
+
+static void
+deferred_apply(struct draw_key *key) {
+	if (key->program >= 0) {
+		shader_program(key->program, key->material);
+	}
+	int i;
+	for (i=0;i<MAX_TEXTURE_CHANNEL;i++) {
+		shader_texture(key->tex[i], i);
+	}
+	set_blend(key->blend_src, key->blend_dst);
+}
+
+// replay the queue in batch order with deferred mode turned off
+static void
+deferred_flush() {
+	struct deferred_queue *dq = RS->dq;
+	if (dq == NULL || dq->n == 0)
+		return;
+	RS->dq = NULL;
+	int i;
+	for (i=0;i<dq->batch_n;i++) {
+		struct deferred_batch *b = &dq->batch[i];
+		deferred_apply(&dq->key[b->key]);
+		int idx;
+		for (idx = b->head; idx >= 0; idx = dq->q[idx].next) {
+			struct deferred_quad *q = &dq->q[idx];
+			shader_draw(q->vb, q->color, q->additive);
+		}
+	}
+	RS->drawcall_saved += dq->runs - dq->batch_n;
+	dq->n = 0;
+	dq->key_n = 0;
+	dq->batch_n = 0;
+	dq->runs = 0;
+	dq->last_key = -1;
+	dq->key_dirty = 1;
+	RS->dq = dq;
+}
+
+// take the real state as the current key
+static void
+deferred_sync() {
+	struct deferred_queue *dq = RS->dq;
+	struct draw_key *key = &dq->current;
+	key->program = RS->current_program;
+	key->material = (key->program >= 0) ? RS->program[key->program].material : NULL;
+	memcpy(key->tex, RS->tex, sizeof(key->tex));
+	if (RS->multi) {
+		key->tex[0] = RS->tex0;
+	}
+	key->blend_src = RS->blend_src;
+	key->blend_dst = RS->blend_dst;
+	dq->key_dirty = 1;
+}
+
+void
+shader_deferred(int enable) {
+	if (enable) {
+		if (RS->dq)
+			return;
+		rs_commit();
+		struct deferred_queue *dq = (struct deferred_queue *)malloc(sizeof(*dq));
+		memset(dq, 0, sizeof(*dq));
+		dq->last_key = -1;
+		RS->dq = dq;
+		deferred_sync();
+	} else if (RS->dq) {
+		deferred_flush();
+		free(RS->dq);
+		RS->dq = NULL;
+	}
+}
+
+void
+shader_setbatch(int quads) {
+	assert(quads > 0);
+	struct render_state *rs = RS;
+	if (!render_support_index32(rs->R) && quads > MAX_QUAD_INDEX16) {
+		quads = MAX_QUAD_INDEX16;
+	}
+	if (quads == rs->vb.capacity)
+		return;
+	shader_flush();
+	renderbuffer_reserve(&rs->vb, quads);
+	index_reserve(quads);
+	render_release(rs->R, STREAMBUFFER, rs->vertex_buffer);
+	rs->vertex_buffer = render_buffer_create(rs->R, STREAMBUFFER, NULL, 4 * quads * STREAM_BATCH, sizeof(struct vertex));
+	render_set(rs->R, VERTEXBUFFER, rs->vertex_buffer, 0);
+}
+
+int
+shader_getbatch() {
+	return RS->vb.capacity;
+}
+
+void
+shader_multitexture(int enable) {
+	enable = enable && RS->program[PROGRAM_PICTURE_MULTI].prog != 0;
+	if (enable == RS->multi)
+		return;
+	shader_flush();
+	if (enable) {
+		RS->tex0 = RS->tex[0];
+		RS->slot = 0;
+		RS->slot_next = 0;
+	} else if (RS->tex[0] != RS->tex0) {
+		RS->tex[0] = RS->tex0;
+		render_set(RS->R, TEXTURE, RS->tex0, 0);
+	}
+	RS->multi = enable;
+	// rebind program at next shader_program
+	RS->current_program = -1;
+}
+
+// draw other buffers in immediate mode, the deferred queue is flushed and suspended.
+static struct deferred_queue *
+deferred_suspend() {
+	struct deferred_queue * dq = RS->dq;
+	if (dq) {
+		deferred_flush();
+		RS->dq = NULL;
+	}
 	rs_commit();
+	return dq;
+}
 
+static void
+deferred_resume(struct deferred_queue *dq) {
+	if (dq) {
+		RS->dq = dq;
+		deferred_sync();
+	}
+}
+
+void 
+shader_drawbuffer(struct render_buffer * rb, float tx, float ty, float scale) {
 	RID glid = texture_glid(rb->texid);
 	if (glid == 0)
 		return;
+	struct deferred_queue * dq = deferred_suspend();
+	index_reserve(rb->object);
 	shader_texture(glid, 0);
 	render_set(RS->R, VERTEXBUFFER, rb->vbid, 0);
 
@@ -235,11 +615,127 @@ shader_drawbuffer(struct render_buffer * rb, float tx, float ty, float scale) {
 	renderbuffer_commit(rb);
 
 	render_set(RS->R, VERTEXBUFFER, RS->vertex_buffer, 0);
+	deferred_resume(dq);
+}
+
+int
+shader_instance_support() {
+	return RS->instance_layout != 0 && RS->program[PROGRAM_PICTURE_INSTANCE].prog != 0;
+}
+
+void
+shader_instance(struct instance *inst, const struct matrix *mat, uint32_t color, uint32_t additive) {
+	float *f = inst->m;
+	if (mat == NULL) {
+		f[0] = 1.0f; f[1] = 0; f[2] = 0; f[3] = 1.0f; f[4] = 0; f[5] = 0;
+	} else {
+		const int *m = mat->m;
+		f[0] = m[0] / 1024.0f;
+		f[1] = m[1] / 1024.0f;
+		f[2] = m[2] / 1024.0f;
+		f[3] = m[3] / 1024.0f;
+		f[4] = m[4];
+		f[5] = m[5];
+	}
+	screen_trans(&f[0], &f[1]);
+	screen_trans(&f[2], &f[3]);
+	screen_trans(&f[4], &f[5]);
+	inst->color[0] = (color >> 16) & 0xff;
+	inst->color[1] = (color >> 8) & 0xff;
+	inst->color[2] = (color) & 0xff;
+	inst->color[3] = (color >> 24) & 0xff;
+	inst->add[0] = (additive >> 16) & 0xff;
+	inst->add[1] = (additive >> 8) & 0xff;
+	inst->add[2] = (additive) & 0xff;
+	inst->add[3] = 0;
+}
+
+// upload the mesh only when it differs from the last one
+static void
+instance_mesh(struct render_buffer *mesh) {
+	struct render_buffer *im = &RS->instance_mesh;
+	if (im->vbid && im->texid == mesh->texid && im->object == mesh->object &&
+		memcmp(im->vb, mesh->vb, mesh->object * sizeof(struct quad)) == 0) {
+		return;
+	}
+	if (mesh->object > im->capacity) {
+		renderbuffer_reserve(im, mesh->object);
+	}
+	memcpy(im->vb, mesh->vb, mesh->object * sizeof(struct quad));
+	im->object = mesh->object;
+	im->texid = mesh->texid;
+	renderbuffer_upload(im);
+}
+
+void
+shader_drawinstance(struct render_buffer *mesh, int n, const struct instance *inst) {
+	RID glid = texture_glid(mesh->texid);
+	if (glid == 0 || mesh->object == 0 || n <= 0)
+		return;
+	assert(shader_instance_support());
+	struct render *R = RS->R;
+	struct deferred_queue * dq = deferred_suspend();
+	index_reserve(mesh->object);
+	instance_mesh(mesh);
+	shader_program(PROGRAM_PICTURE_INSTANCE, NULL);
+	shader_texture(glid, 0);
+	render_set(R, VERTEXBUFFER, RS->instance_mesh.vbid, 0);
+	render_set(R, VERTEXBUFFER, RS->instance_buffer, 1);
+	int i;
+	for (i=0;i<n;i+=INSTANCE_BATCH) {
+		int count = n - i;
+		if (count > INSTANCE_BATCH)
+			count = INSTANCE_BATCH;
+		render_buffer_update(R, RS->instance_buffer, inst + i, count);
+		render_draw_instanced(R, DRAW_TRIANGLE, 0, 6 * mesh->object, count);
+		RS->drawcall++;
+	}
+	render_set(R, VERTEXBUFFER, 0, 1);
+	render_set(R, VERTEXBUFFER, RS->vertex_buffer, 0);
+	deferred_resume(dq);
+}
+
+// find a channel for the texture in multi-texture mode
+static int
+texture_slot(RID id) {
+	int i;
+	for (i=0;i<MAX_TEXTURE_CHANNEL;i++) {
+		if (RS->tex[i] == id)
+			return i;
+	}
+	for (i=0;i<MAX_TEXTURE_CHANNEL;i++) {
+		if (RS->tex[i] == 0)
+			break;
+	}
+	if (i == MAX_TEXTURE_CHANNEL) {
+		// all channels are used by the batch
+		rs_commit();
+		i = RS->slot_next;
+		RS->slot_next = (i + 1) % MAX_TEXTURE_CHANNEL;
+	}
+	RS->tex[i] = id;
+	render_set(RS->R, TEXTURE, id, i);
+	return i;
 }
 
 void
 shader_texture(int id, int channel) {
 	assert(channel < MAX_TEXTURE_CHANNEL);
+	struct deferred_queue * dq = RS->dq;
+	if (dq) {
+		if (dq->current.tex[channel] != id) {
+			dq->current.tex[channel] = id;
+			dq->key_dirty = 1;
+		}
+		return;
+	}
+	if (channel == 0 && RS->multi) {
+		RS->tex0 = id;
+		if (RS->current_program == PROGRAM_PICTURE_MULTI) {
+			RS->slot = texture_slot(id);
+			return;
+		}
+	}
 	if (RS->tex[channel] != id) {
 		rs_commit();
 		RS->tex[channel] = id;
@@ -263,6 +759,21 @@ apply_uniform(struct program *p) {
 
 void
 shader_program(int n, struct material *m) {
+	struct deferred_queue * dq = RS->dq;
+	if (dq) {
+		if (dq->current.program != n || dq->current.material != m) {
+			dq->current.program = n;
+			dq->current.material = m;
+			dq->key_dirty = 1;
+		}
+		if (m) {
+			material_key(m, &dq->current);
+		}
+		return;
+	}
+	if (RS->multi && n == PROGRAM_PICTURE && m == NULL) {
+		n = PROGRAM_PICTURE_MULTI;
+	}
 	struct program *p = &RS->program[n];
 	if (RS->current_program != n || p->reset_uniform || m) {
 		rs_commit();
@@ -272,6 +783,14 @@ shader_program(int n, struct material *m) {
 		render_shader_bind(RS->R, p->prog);
 		p->material = NULL;
 		apply_uniform(p);
+		if (RS->multi) {
+			if (n == PROGRAM_PICTURE_MULTI) {
+				RS->slot = texture_slot(RS->tex0);
+			} else if (RS->tex[0] != RS->tex0) {
+				RS->tex[0] = RS->tex0;
+				render_set(RS->R, TEXTURE, RS->tex0, 0);
+			}
+		}
 	} else if (p->reset_uniform) {
 		apply_uniform(p);
 	}
@@ -282,11 +801,49 @@ shader_program(int n, struct material *m) {
 
 void
 shader_draw(const struct vertex_pack vb[4], uint32_t color, uint32_t additive) {
+	if (RS->dq) {
+		deferred_add(RS->dq, vb, color, additive);
+		return;
+	}
+	if (RS->multi && RS->current_program == PROGRAM_PICTURE_MULTI) {
+		additive = (additive & 0xffffff) | ((uint32_t)RS->slot << 24);
+	}
 	if (renderbuffer_add(&RS->vb, vb, color, additive)) {
 		rs_commit();
 	}
 }
 
+struct quad *
+shader_reserve(int *n) {
+	if (RS->dq)
+		return NULL;
+	struct render_buffer *rb = &RS->vb;
+	if (rb->object >= rb->capacity) {
+		rs_commit();
+	}
+	*n = rb->capacity - rb->object;
+	return rb->vb + rb->object;
+}
+
+void
+shader_commit(int n) {
+	struct render_buffer *rb = &RS->vb;
+	assert(rb->object + n <= rb->capacity);
+	if (RS->multi && RS->current_program == PROGRAM_PICTURE_MULTI) {
+		int i,j;
+		for (i=0;i<n;i++) {
+			struct quad *q = rb->vb + rb->object + i;
+			for (j=0;j<4;j++) {
+				q->p[j].add[3] = RS->slot;
+			}
+		}
+	}
+	rb->object += n;
+	if (rb->object >= rb->capacity) {
+		rs_commit();
+	}
+}
+
 static void
 draw_quad(const struct vertex_pack *vbp, uint32_t color, uint32_t additive, int max, int index) {
 	struct vertex_pack vb[4];
@@ -312,26 +869,39 @@ shader_drawpolygon(int n, const struct vertex_pack *vb, uint32_t color, uint32_t
 
 void 
 shader_flush() {
+	deferred_flush();
 	rs_commit();
 }
 
+static void
+set_blend(enum BLEND_FORMAT src, enum BLEND_FORMAT dst) {
+	struct deferred_queue * dq = RS->dq;
+	if (dq) {
+		if (dq->current.blend_src != src || dq->current.blend_dst != dst) {
+			dq->current.blend_src = src;
+			dq->current.blend_dst = dst;
+			dq->key_dirty = 1;
+		}
+		return;
+	}
+	rs_commit();
+	RS->blendchange = (src != BLEND_ONE || dst != BLEND_ONE_MINUS_SRC_ALPHA);
+	RS->blend_src = src;
+	RS->blend_dst = dst;
+	render_setblend(RS->R, src, dst);
+}
+
 void
 shader_defaultblend() {
-	if (RS->blendchange) {
-		rs_commit();
-		RS->blendchange = 0;
-		render_setblend(RS->R, BLEND_ONE, BLEND_ONE_MINUS_SRC_ALPHA);
+	if (RS->dq || RS->blendchange) {
+		set_blend(BLEND_ONE, BLEND_ONE_MINUS_SRC_ALPHA);
 	}
 }
 
 void
 shader_blend(int m1, int m2) {
 	if (m1 != BLEND_GL_ONE || m2 != BLEND_GL_ONE_MINUS_SRC_ALPHA) {
-		rs_commit();
-		RS->blendchange = 1;
-		enum BLEND_FORMAT src = blend_mode(m1);
-		enum BLEND_FORMAT dst = blend_mode(m2);
-		render_setblend(RS->R, src, dst);
+		set_blend(blend_mode(m1), blend_mode(m2));
 	}
 }
 
@@ -381,7 +951,7 @@ shader_uniformsize(enum UNIFORM_FORMAT t) {
 
 void 
 shader_setuniform(int prog, int index, enum UNIFORM_FORMAT t, float *v) {
-	rs_commit();
+	shader_flush();
 	struct program * p = &RS->program[prog];
 	assert(index >= 0 && index < p->uniform_number);
 	struct uniform *u = &p->uniform[index];
@@ -396,7 +966,13 @@ int
 shader_adduniform(int prog, const char * name, enum UNIFORM_FORMAT t) {
 	// reset current_program
 	assert(prog >=0 && prog < MAX_PROGRAM);
+	struct deferred_queue * dq = RS->dq;
+	if (dq) {
+		deferred_flush();
+		RS->dq = NULL;
+	}
 	shader_program(prog, NULL);
+	RS->dq = dq;
 	struct program * p = &RS->program[prog];
 	assert(p->uniform_number < MAX_UNIFORM);
 	int loc = render_shader_locuniform(RS->R, name);
@@ -463,6 +1039,8 @@ material_setuniform(struct material *m, int index, int n, const float *v) {
 	if (shader_uniformsize(u->type) != n) {
 		return 1;
 	}
+	// the queued quads should use the old value
+	deferred_flush();
 	memcpy(m->uniform + u->offset, v, n * sizeof(float));
 	m->uniform_enable[index] = true;
 	m->reset = true;
@@ -500,6 +1078,22 @@ material_apply(int prog, struct material *m) {
 	}
 }
 
+static void
+material_key(struct material *m, struct draw_key *key) {
+	struct program * p = m->p;
+	int i;
+	for (i=0;i<p->texture_number;i++) {
+		int tex = m->texture[i];
+		if (tex >= 0) {
+			RID glid = texture_glid(tex);
+			if (glid && key->tex[i] != glid) {
+				key->tex[i] = glid;
+				RS->dq->key_dirty = 1;
+			}
+		}
+	}
+}
+
 int
 material_settexture(struct material *m, int channel, int texture) {
 	if (channel >= MAX_TEXTURE_CHANNEL) {
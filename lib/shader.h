@@ -14,8 +14,18 @@
 #define PROGRAM_TEXT_EDGE 3
 #define PROGRAM_GUI_TEXT 4
 #define PROGRAM_GUI_EDGE 5
+#define PROGRAM_PICTURE_MULTI 9
+#define PROGRAM_PICTURE_INSTANCE 10
 
 struct material;
+struct matrix;
+
+// per-instance data of PROGRAM_PICTURE_INSTANCE, streamed in vertex buffer slot 1
+struct instance {
+	float m[6];	// 2x3 matrix in clip space (screen transform applied)
+	uint8_t color[4];
+	uint8_t add[4];
+};
 
 void shader_init();
 void shader_load(int prog, const char *fs, const char *vs, int texture, const char ** texture_uniform_name);
@@ -25,6 +35,10 @@ void shader_defaultblend();
 void shader_texture(int id, int channel);
 void shader_draw(const struct vertex_pack vb[4],uint32_t color,uint32_t additive);
 void shader_drawpolygon(int n, const struct vertex_pack *vb, uint32_t color, uint32_t additive);
+// Write quads straight into the batch : shader_reserve returns room for *n (>= 1) quads drawn with
+// the current state, shader_commit(n) adds the first n. It returns NULL in deferred mode, use shader_draw then.
+struct quad * shader_reserve(int *n);
+void shader_commit(int n);
 void shader_program(int n, struct material *);
 void shader_flush();
 void shader_clear(unsigned long argb);
@@ -35,6 +49,26 @@ int ejoy2d_shader(lua_State *L);
 
 void shader_drawbuffer(struct render_buffer * rb, float x, float y, float s);
 
+// Deferred mode records quads and reorders the ones that don't overlap,
+// so quads with the same state are drawn in one batch. It's off by default.
+void shader_deferred(int enable);
+
+// Multi-texture mode draws PROGRAM_PICTURE with PROGRAM_PICTURE_MULTI, which samples
+// from up to MAX_TEXTURE_CHANNEL textures by the slot in the vertex (the alpha of additive),
+// so quads from different atlases can share one batch.
+void shader_multitexture(int enable);
+
+// Instanced draw renders a mesh (local quads of one texture, in SCREEN_SCALE units)
+// n times with one draw call per INSTANCE_BATCH instances.
+// It needs device support and PROGRAM_PICTURE_INSTANCE loaded.
+int shader_instance_support();
+void shader_instance(struct instance *inst, const struct matrix *m, uint32_t color, uint32_t additive);
+void shader_drawinstance(struct render_buffer *mesh, int n, const struct instance *inst);
+
+// batch size in quads, MAX_COMMBINE by default
+void shader_setbatch(int quads);
+int shader_getbatch();
+
 int shader_adduniform(int prog, const char * name, enum UNIFORM_FORMAT t);
 void shader_setuniform(int prog, int index, enum UNIFORM_FORMAT t, float *v);
 int shader_uniformsize(enum UNIFORM_FORMAT t);
@@ -44,5 +78,7 @@ void shader_reset();
 void shader_mask(float x, float y);
 void reset_drawcall_count();
 int drawcall_count();
+int drawcall_saved();
+void shader_getstat(struct render_stat *stat);
 
 #endif
@@ -160,6 +160,7 @@ sprite_reset(struct sprite *s) {
 	s->t.mirror_y = false;
 //	s->flags = 0;
 	s->material = NULL;
+	sprite_dirty(s);
 
 	if (s->id == ANCHOR_ID) {
 //		s->flags = SPRFLAG_INVISIBLE;
@@ -212,6 +213,7 @@ sprite_init(struct sprite * s, struct sprite_pack * pack, int id, int sz) {
 	s->t.mirror_x = false;
 	s->t.mirror_y = false;
 	s->flags = 0;
+	sprite_world_init(s);
 	s->name = NULL;
 	s->id = id;
 	uint8_t *type_array = OFFSET_TO_POINTER(uint8_t, pack, pack->type);
@@ -262,6 +264,15 @@ sprite_mount(struct sprite *parent, int index, struct sprite *child) {
 	parent->data.children[index] = child;
 	if (child) {
 		assert(child->parent == NULL);
+		sprite_dirty(child);
+		int cid = ani->component[index].id;
+		bool same = cid == ANCHOR_ID ? child->type == TYPE_ANCHOR :
+			(child->pack == parent->pack && child->id == cid);
+		if (!same || child->t.mat || child->t.mirror_x || child->t.mirror_y ||
+			(child->flags & (SPRFLAG_UNBOUND | SPRFLAG_MULTIMOUNT))) {
+			// the bound of parent in pack doesn't include this child
+			sprite_unbound(parent);
+		}
 		if ((child->flags & SPRFLAG_MULTIMOUNT) == 0) {
 			child->name = OFFSET_TO_STRING(parent->pack, ani->component[index].name);
 			child->parent = parent;
@@ -276,6 +287,14 @@ sprite_mount(struct sprite *parent, int index, struct sprite *child) {
 	}
 }
 
+void
+sprite_unbound(struct sprite *s) {
+	while (s && (s->flags & SPRFLAG_UNBOUND) == 0) {
+		s->flags |= SPRFLAG_UNBOUND;
+		s = s->parent;
+	}
+}
+
 static inline int
 get_frame(struct sprite *s) {
 	if (s->type != TYPE_ANIMATION) {
@@ -454,6 +473,117 @@ mat_mul(struct matrix *a, struct matrix *b, struct matrix *tmp) {
 	return tmp;
 }
 
+// world transform cache
+
+static uint32_t WORLD_STAMP = 0;
+
+static inline uint32_t
+world_stamp() {
+	if (++WORLD_STAMP == 0) {
+		// 0 is reserved for never calculated
+		++WORLD_STAMP;
+	}
+	return WORLD_STAMP;
+}
+
+static inline bool
+world_valid(struct sprite *s, uint32_t parent, const struct pack_part *part) {
+	return (s->flags & (SPRFLAG_DIRTY | SPRFLAG_VOLATILE)) == 0 &&
+		s->world.stamp != 0 &&
+		s->world.parent == parent &&
+		s->world.part == part;
+}
+
+// Store the new world transform. Keep the stamp if the value doesn't change, so the children's cache is still valid.
+static struct sprite_trans *
+world_update(struct sprite *s, const struct sprite_trans *t, uint32_t parent, const struct pack_part *part) {
+	struct sprite_world *w = &s->world;
+	bool same = w->stamp != 0 &&
+		t->color == w->t.color &&
+		t->additive == w->t.additive &&
+		t->program == w->t.program &&
+		t->mirror_x == w->t.mirror_x &&
+		t->mirror_y == w->t.mirror_y &&
+		(t->mat == NULL ? w->t.mat == NULL : (w->t.mat && memcmp(t->mat, &w->mat, sizeof(w->mat)) == 0));
+	if (!same) {
+		w->t = *t;
+		if (t->mat) {
+			w->mat = *t->mat;
+			w->t.mat = &w->mat;
+		}
+		w->stamp = world_stamp();
+	}
+	w->parent = parent;
+	w->part = part;
+	s->flags &= ~SPRFLAG_DIRTY;
+	return &w->t;
+}
+
+// world transform of a sprite drawn as root, parent is 0 for no parent transform
+static struct sprite_trans *
+root_world(struct sprite *s, struct sprite_trans *ts, uint32_t parent) {
+	if (world_valid(s, parent, NULL)) {
+		return &s->world.t;
+	}
+	struct sprite_trans temp;
+	struct matrix temp_matrix;
+	struct sprite_trans *t = sprite_trans_mul(&s->t, ts, &temp, &temp_matrix);
+	return world_update(s, t, parent, NULL);
+}
+
+// world transform of the child at part pp of s, s must have a valid world
+static struct sprite_trans *
+child_world(struct sprite *s, struct sprite *child, struct pack_part *pp) {
+	if (world_valid(child, s->world.stamp, pp)) {
+		return &child->world.t;
+	}
+	struct sprite_trans temp, temp2;
+	struct matrix temp_matrix, temp_matrix2;
+	struct sprite_trans *ct = sprite_trans_mul2(s->pack, &pp->t, &s->world.t, &temp, &temp_matrix);
+	struct sprite_trans *t = sprite_trans_mul(&child->t, ct, &temp2, &temp_matrix2);
+	return world_update(child, t, s->world.stamp, pp);
+}
+
+// the first part of the child in the current frame of parent
+static const struct pack_part *
+child_part(struct sprite *parent, struct sprite *child) {
+	int frame = get_frame(parent);
+	if (frame < 0) {
+		return NULL;
+	}
+	struct pack_frame * pf = OFFSET_TO_POINTER(struct pack_frame, parent->pack, parent->s.ani->frame);
+	pf = &pf[frame];
+	struct pack_part *pp = OFFSET_TO_POINTER(struct pack_part, parent->pack, pf->part);
+	int i;
+	for (i=0;i<pf->n;i++) {
+		if (parent->data.children[pp[i].component_id] == child) {
+			return &pp[i];
+		}
+	}
+	return NULL;
+}
+
+// The cached world matrix can be used out of drawing, if it's calculated from the current transforms
+// of all the ancestors, up to a root drawn by sprite_draw. Mirror is ignored out of drawing.
+static bool
+world_uptodate(struct sprite *s) {
+	if ((s->flags & (SPRFLAG_DIRTY | SPRFLAG_VOLATILE)) || s->world.stamp == 0 ||
+		s->world.t.mirror_x || s->world.t.mirror_y) {
+		return false;
+	}
+	struct sprite *parent = s->parent;
+	if (parent == NULL) {
+		return s->world.parent == 0 && s->world.part == NULL;
+	}
+	if (s->world.parent != parent->world.stamp || s->world.part == NULL) {
+		return false;
+	}
+	if (s->world.part != child_part(parent, s)) {
+		return false;
+	}
+	return world_uptodate(parent);
+}
+
 static void
 switch_program(struct sprite_trans *t, int def, struct material *m) {
 	int prog = t->program;
@@ -546,33 +676,76 @@ picture_pos(int m[6], struct pack_picture *picture, int pos[2]) {
 	pos[1] = (int)((c_x * m[1] + c_y * m[3]) / 1024 + m[5])/SCREEN_SCALE;
 }
 
-static void
-drawparticle(struct sprite *s, struct particle_system *ps, struct pack_picture *pic) {
-	if (!ps->isActive) return;
+// particles of a one rect picture : the vertices are written into the batch by particle_vertex
+static bool
+drawparticle_quads(struct sprite *s, struct particle_system *ps, struct pack_picture *pic) {
+	struct pack_quad *q = &pic->rect[0];
+	int glid = texture_glid(q->texid);
+	if (glid == 0)
+		return true;
+	int room;
+	struct quad *out = shader_reserve(&room);
+	if (out == NULL)
+		return false;
+	shader_texture(glid, 0);
+	struct particle_quad pq;
+	int i;
+	for (i=0;i<4;i++) {
+		int xx = q->screen_coord[i*2+0];
+		int yy = q->screen_coord[i*2+1];
+		if (s->t.mirror_x)
+			xx = -xx;
+		if (s->t.mirror_y)
+			yy = -yy;
+		pq.corner[i*2+0] = xx;
+		pq.corner[i*2+1] = yy;
+		pq.texcoord[i*2+0] = q->texture_coord[i*2+0];
+		pq.texcoord[i*2+1] = q->texture_coord[i*2+1];
+	}
+	pq.additive = s->t.additive;
+	pq.sx = 1.0f;
+	pq.sy = 1.0f;
+	screen_trans(&pq.sx, &pq.sy);
 
 	int n = ps->particleCount;
-	struct matrix *old_m = s->t.mat;
-	uint32_t old_c = s->t.color;
+	for (i=0;i<n;) {
+		// shader_texture may flush the batch
+		out = shader_reserve(&room);
+		if (room > n - i)
+			room = n - i;
+		particle_vertex(ps, &pq, i, room, out);
+		shader_commit(room);
+		i += room;
+	}
+	return true;
+}
 
-	shader_blend(ps->config->srcBlend, ps->config->dstBlend);
-	int i;
-	for (i=0;i<n;i++) {
-		struct particle *p = &ps->particles[i];
-		struct matrix *mat = &ps->matrix[i];
-		uint32_t color = p->color_val;
+static void
+drawparticle(struct sprite *s, struct particle_system *ps, struct pack_picture *pic) {
+	particle_wait(ps);
+	if (!ps->isActive || ps->culled) return;
 
-		s->t.mat = mat;
-		s->t.color = color;
-		sprite_drawquad(pic, NULL, &s->t);
+	shader_blend(ps->config->srcBlend, ps->config->dstBlend);
+	if (pic->n != 1 || !drawparticle_quads(s, ps, pic)) {
+		int n = ps->particleCount;
+		struct matrix *old_m = s->t.mat;
+		uint32_t old_c = s->t.color;
+		struct matrix mat;
+		int i;
+		for (i=0;i<n;i++) {
+			particle_world_mat(ps, i, &mat);
+			s->t.mat = &mat;
+			s->t.color = particle_color(ps, i);
+			sprite_drawquad(pic, NULL, &s->t);
+		}
+		s->t.mat = old_m;
+		s->t.color = old_c;
 	}
 	shader_defaultblend();
-
-	s->t.mat = old_m;
-	s->t.color = old_c;
 }
 
 static bool
-update_particle(struct particle_system *ps, struct sprite *s, struct sprite_trans *t, struct srt *srt) {
+update_particle(struct particle_system *ps, struct sprite *s, struct sprite_trans *t, struct srt *srt, bool async) {
 	struct matrix tmp;
 	struct vertex_pack vb[4];
 	int i,j;
@@ -582,24 +755,98 @@ update_particle(struct particle_system *ps, struct sprite *s, struct sprite_tran
 		tmp = *t->mat;
 	}
 	matrix_srt(&tmp, srt);
-			
+
+	if (async) {
+		return particle_update_async(ps, 1.0/LOGIC_FRAME, &tmp);
+	}
+	// it's drawn right after, so don't queue it
+	particle_wait(ps);
 	return particle_update(ps, 1.0/LOGIC_FRAME, &tmp);
 }
 
+// visible test
+
+static struct {
+	bool disable;
+	int test;
+	int culled;
+} VT;
+
+void
+sprite_enable_visible_test(bool enable) {
+	VT.disable = !enable;
+}
+
+void
+sprite_visible_stat(int *test, int *culled) {
+	*test = VT.test;
+	*culled = VT.culled;
+}
+
+// test the bound in pack (of all frames) with the screen and the current scissor
+static bool
+culled(struct sprite *s, struct srt *srt, struct sprite_trans *t) {
+	if (VT.disable || (s->flags & SPRFLAG_UNBOUND) || t->mirror_x || t->mirror_y) {
+		return false;
+	}
+	const struct pack_bound *b = spritepack_bound(s->pack, s->id);
+	if (BOUND_INFINITE(b)) {
+		return false;
+	}
+	++VT.test;
+	if (!BOUND_EMPTY(b)) {
+		struct matrix tmp;
+		if (t->mat == NULL) {
+			matrix_identity(&tmp);
+		} else {
+			tmp = *t->mat;
+		}
+		matrix_srt(&tmp, srt);
+		int *m = tmp.m;
+		int64_t x[4] = { b->minx, b->maxx, b->minx, b->maxx };
+		int64_t y[4] = { b->miny, b->miny, b->maxy, b->maxy };
+		int64_t minx = INT64_MAX, miny = INT64_MAX, maxx = INT64_MIN, maxy = INT64_MIN;
+		int i;
+		for (i=0;i<4;i++) {
+			int64_t xx = (x[i] * m[0] + y[i] * m[2]) / 1024 + m[4];
+			int64_t yy = (x[i] * m[1] + y[i] * m[3]) / 1024 + m[5];
+			if (xx < minx) minx = xx;
+			if (xx > maxx) maxx = xx;
+			if (yy < miny) miny = yy;
+			if (yy > maxy) maxy = yy;
+		}
+		int view[4];
+		scissor_viewbox(view);
+		// one pixel margin for rounding
+		if (maxx >= view[0] - SCREEN_SCALE && minx <= view[2] + SCREEN_SCALE &&
+			maxy >= view[1] - SCREEN_SCALE && miny <= view[3] + SCREEN_SCALE) {
+			return false;
+		}
+	}
+	++VT.culled;
+	return true;
+}
+
 static int
-draw_child(struct sprite *s, struct srt *srt, struct sprite_trans * ts, struct material * material) {
-	struct sprite_trans temp;
-	struct matrix temp_matrix;
-	struct sprite_trans *t = sprite_trans_mul(&s->t, ts, &temp, &temp_matrix);
+draw_child(struct sprite *s, struct srt *srt, struct sprite_trans * t, struct material * material) {
 	if (s->material) {
 		material = s->material;
 	} 
+	if ((s->type == TYPE_PICTURE || s->type == TYPE_POLYGON || s->type == TYPE_ANIMATION) && culled(s, srt, t)) {
+		return 0;
+	}
 	switch (s->type) {
 	case TYPE_PICTURE:
 		switch_program(t, PROGRAM_PICTURE, material);
 		if (s->data.ps) {
-			if (update_particle(s->data.ps, s, t, srt))
+			if (particle_getworkers() > 0) {
+				// draw the state of the update queued by the last draw, and queue the next one :
+				// the workers run it while the rest of the frame is drawn, particle_frame waits for it
+				drawparticle(s, s->data.ps, s->s.pic);
+				update_particle(s->data.ps, s, t, srt, true);
+			} else if (update_particle(s->data.ps, s, t, srt, false)) {
 				drawparticle(s, s->data.ps, s->s.pic);
+			}
 		} else {
 			sprite_drawquad(s->s.pic, srt, t);
 		}
@@ -610,9 +857,10 @@ draw_child(struct sprite *s, struct srt *srt, struct sprite_trans * ts, struct m
 		return 0;
 	case TYPE_LABEL:
 		if (s->data.rich_text) {
-			t->program = PROGRAM_DEFAULT;	// label never set user defined program
-			switch_program(t, s->s.label->edge ? PROGRAM_TEXT_EDGE : PROGRAM_TEXT, material);
-			label_draw(s->data.rich_text, s->s.label, srt, t);
+			struct sprite_trans lt = *t;
+			lt.program = PROGRAM_DEFAULT;	// label never set user defined program
+			switch_program(&lt, s->s.label->edge ? PROGRAM_TEXT_EDGE : PROGRAM_TEXT, material);
+			label_draw(s->data.rich_text, s->s.label, srt, &lt);
 		}
 		return 0;
 	case TYPE_ANCHOR:
@@ -654,9 +902,7 @@ draw_child(struct sprite *s, struct srt *srt, struct sprite_trans * ts, struct m
 		if (child == NULL || (child->flags & SPRFLAG_INVISIBLE)) {
 			continue;
 		}
-		struct sprite_trans temp2;
-		struct matrix temp_matrix2;
-		struct sprite_trans *ct = sprite_trans_mul2(s->pack, &pp->t, t, &temp2, &temp_matrix2);
+		struct sprite_trans *ct = child_world(s, child, pp);
 		scissor += draw_child(child, srt, ct, material);
 	}
 	for (i=0;i<scissor;i++) {
@@ -690,7 +936,7 @@ sprite_child_visible(struct sprite *s, const char * childname) {
 void
 sprite_draw(struct sprite *s, struct srt *srt) {
 	if ((s->flags & SPRFLAG_INVISIBLE) == 0) {
-		draw_child(s, srt, NULL, NULL);
+		draw_child(s, srt, root_world(s, NULL, 0), NULL);
 	}
 }
 
@@ -702,7 +948,10 @@ sprite_draw_as_child(struct sprite *s, struct srt *srt, struct matrix *mat, uint
 		st.color = color;
 		st.additive = 0;
 		st.program = PROGRAM_DEFAULT;
-		draw_child(s, srt, &st, NULL);
+		st.mirror_x = false;
+		st.mirror_y = false;
+		// the parent transform is unknown, so never reuse the cache
+		draw_child(s, srt, root_world(s, &st, world_stamp()), NULL);
 	}
 }
 
@@ -734,6 +983,25 @@ sprite_matrix(struct sprite * self, struct matrix *mat) {
 	struct sprite * parent = self->parent;
 	if (parent) {
 		assert(parent->type == TYPE_ANIMATION);
+		if (world_uptodate(parent)) {
+			const struct pack_part *pp = child_part(parent, self);
+			if (pp) {
+				struct matrix *parent_world = parent->world.t.mat;
+				struct matrix *child_mat = OFFSET_TO_POINTER(struct matrix, parent->pack, pp->t.mat);
+				if (parent_world == NULL) {
+					if (child_mat) {
+						*mat = *child_mat;
+					} else {
+						matrix_identity(mat);
+					}
+				} else if (child_mat) {
+					matrix_mul(mat, child_mat, parent_world);
+				} else {
+					*mat = *parent_world;
+				}
+				return;
+			}
+		}
 		sprite_matrix(parent, mat);
 		struct matrix tmp;
 		struct matrix * parent_mat = parent->t.mat;
@@ -875,9 +1143,10 @@ panel_aabb(struct pack_pannel *panel, struct srt *srt, struct matrix *ts, int aa
 }
 
 static int
-child_aabb(struct sprite *s, struct srt *srt, struct matrix * mat, int aabb[4]) {
+child_aabb(struct sprite *s, struct srt *srt, struct matrix * mat, bool cached, int aabb[4]) {
+	// mat is the world matrix of s if cached, or the parent's
 	struct matrix temp;
-	struct matrix *t = mat_mul(s->t.mat, mat, &temp);
+	struct matrix *t = cached ? mat : mat_mul(s->t.mat, mat, &temp);
 	switch (s->type) {
 	case TYPE_PICTURE:
 		quad_aabb(s->s.pic, srt, t, aabb);
@@ -915,8 +1184,14 @@ child_aabb(struct sprite *s, struct srt *srt, struct matrix * mat, int aabb[4])
 			continue;
 		}
 		struct matrix temp2;
-		struct matrix *ct = mat_mul(OFFSET_TO_POINTER(struct matrix, s->pack, pp->t.mat), t, &temp2);
-		if (child_aabb(child, srt, ct, aabb))
+		struct matrix *ct;
+		bool cc = cached && world_valid(child, s->world.stamp, pp);
+		if (cc) {
+			ct = child->world.t.mat;
+		} else {
+			ct = mat_mul(OFFSET_TO_POINTER(struct matrix, s->pack, pp->t.mat), t, &temp2);
+		}
+		if (child_aabb(child, srt, ct, cc, aabb))
 			break;
 	}
 	return 0;
@@ -926,17 +1201,21 @@ void
 sprite_aabb(struct sprite *s, struct srt *srt, bool world_aabb, bool ignore_flag, int aabb[4]) {
 	int i;
 	if ((s->flags & SPRFLAG_INVISIBLE) == 0 || ignore_flag != 0) {
-		struct matrix tmp;
-		if (world_aabb) {
-			sprite_matrix(s, &tmp);
-		} else {
-			matrix_identity(&tmp);
-		}
 		aabb[0] = INT_MAX;
 		aabb[1] = INT_MAX;
 		aabb[2] = INT_MIN;
 		aabb[3] = INT_MIN;
-		child_aabb(s,srt,&tmp,aabb);
+		if (world_aabb ? world_uptodate(s) : world_valid(s, 0, NULL) && !s->world.t.mirror_x && !s->world.t.mirror_y) {
+			child_aabb(s, srt, s->world.t.mat, true, aabb);
+		} else {
+			struct matrix tmp;
+			if (world_aabb) {
+				sprite_matrix(s, &tmp);
+			} else {
+				matrix_identity(&tmp);
+			}
+			child_aabb(s, srt, &tmp, false, aabb);
+		}
 		for (i=0;i<4;i++)
 			aabb[i] /= SCREEN_SCALE;
 	} else {
@@ -1017,10 +1296,10 @@ test_pannel(struct pack_pannel *pannel, int x, int y) {
 	return x>=0 && x<pannel->width && y>=0 && y<pannel->height;
 }
 
-static int test_child(struct sprite *s, struct srt *srt, struct matrix * ts, int x, int y, struct sprite ** touch, int* hit_x, int* hit_y);
+static int test_child(struct sprite *s, struct srt *srt, struct matrix * ts, bool cached, int x, int y, struct sprite ** touch, int* hit_x, int* hit_y);
 
 static int
-check_child(struct sprite *s, struct srt *srt, struct matrix * t, struct pack_frame * pf, int i, int x, int y, struct sprite ** touch, int* hit_x, int* hit_y) {
+check_child(struct sprite *s, struct srt *srt, struct matrix * t, bool cached, struct pack_frame * pf, int i, int x, int y, struct sprite ** touch, int* hit_x, int* hit_y) {
 	struct pack_part *pp = OFFSET_TO_POINTER(struct pack_part, s->pack, pf->part);
 	pp = &pp[i];
 	int index = pp->component_id;
@@ -1029,9 +1308,15 @@ check_child(struct sprite *s, struct srt *srt, struct matrix * t, struct pack_fr
 		return 0;
 	}
 	struct matrix temp2;
-	struct matrix *ct = mat_mul(OFFSET_TO_POINTER(struct matrix, s->pack, pp->t.mat), t, &temp2);
+	struct matrix *ct;
+	bool cc = cached && world_valid(child, s->world.stamp, pp);
+	if (cc) {
+		ct = child->world.t.mat;
+	} else {
+		ct = mat_mul(OFFSET_TO_POINTER(struct matrix, s->pack, pp->t.mat), t, &temp2);
+	}
 	struct sprite *tmp = NULL;
-	int testin = test_child(child, srt, ct, x, y, &tmp, hit_x, hit_y);
+	int testin = test_child(child, srt, ct, cc, x, y, &tmp, hit_x, hit_y);
 	if (testin) {
 		// if child capture message, return it
 		*touch = tmp;
@@ -1049,7 +1334,7 @@ check_child(struct sprite *s, struct srt *srt, struct matrix * t, struct pack_fr
 		0 : test failed, but *touch capture the message
  */
 static int
-test_animation(struct sprite *s, struct srt *srt, struct matrix * t, int x, int y, struct sprite ** touch, int* hit_x, int* hit_y) {
+test_animation(struct sprite *s, struct srt *srt, struct matrix * t, bool cached, int x, int y, struct sprite ** touch, int* hit_x, int* hit_y) {
 	struct pack_animation *ani = s->s.ani;
 	int frame = get_frame(s);
 	if (frame < 0) {
@@ -1078,7 +1363,7 @@ test_animation(struct sprite *s, struct srt *srt, struct matrix * t, int x, int
 		}
 		if (scissor >=0) {
 			struct sprite *tmp = NULL;
-			check_child(s, srt, t, pf, scissor, x, y, &tmp, hit_x, hit_y);
+			check_child(s, srt, t, cached, pf, scissor, x, y, &tmp, hit_x, hit_y);
 			if (tmp == NULL) {
 				start = scissor - 1;
 				continue;
@@ -1087,7 +1372,7 @@ test_animation(struct sprite *s, struct srt *srt, struct matrix * t, int x, int
 			scissor = 0;
 		}
 		for (i=start;i>=scissor;i--) {
-			int hit = check_child(s, srt, t,  pf, i, x, y, touch, hit_x, hit_y);
+			int hit = check_child(s, srt, t, cached, pf, i, x, y, touch, hit_x, hit_y);
 			if (hit)
 				return 1;
 		}
@@ -1097,12 +1382,13 @@ test_animation(struct sprite *s, struct srt *srt, struct matrix * t, int x, int
 }
 
 static int
-test_child(struct sprite *s, struct srt *srt, struct matrix * ts, int x, int y, struct sprite ** touch, int* hit_x, int* hit_y) {
+test_child(struct sprite *s, struct srt *srt, struct matrix * ts, bool cached, int x, int y, struct sprite ** touch, int* hit_x, int* hit_y) {
+	// ts is the world matrix of s if cached, or the parent's
 	struct matrix temp;
-	struct matrix *t = mat_mul(s->t.mat, ts, &temp);
+	struct matrix *t = cached ? ts : mat_mul(s->t.mat, ts, &temp);
 	if (s->type == TYPE_ANIMATION) {
 		struct sprite *tmp = NULL;
-		int testin = test_animation(s , srt, t, x,y, &tmp, hit_x, hit_y);
+		int testin = test_animation(s , srt, t, cached, x,y, &tmp, hit_x, hit_y);
 		if (testin) {
 			*touch = tmp;
 			return 1;
@@ -1172,7 +1458,12 @@ test_child(struct sprite *s, struct srt *srt, struct matrix * ts, int x, int y,
 struct sprite *
 sprite_test(struct sprite *s, struct srt *srt, int x, int y, int* hit_x, int* hit_y) {
 	struct sprite *tmp = NULL;
-	int testin = test_child(s, srt, NULL, x, y, &tmp, hit_x, hit_y);
+	int testin;
+	if (world_valid(s, 0, NULL) && !s->world.t.mirror_x && !s->world.t.mirror_y) {
+		testin = test_child(s, srt, s->world.t.mat, true, x, y, &tmp, hit_x, hit_y);
+	} else {
+		testin = test_child(s, srt, NULL, false, x, y, &tmp, hit_x, hit_y);
+	}
 	if (testin) {
 		return tmp;
 	}
@@ -12,6 +12,9 @@
 #define SPRFLAG_MESSAGE             (2)
 #define SPRFLAG_MULTIMOUNT          (4)
 #define SPRFLAG_FORCE_INHERIT_FRAME (8)
+#define SPRFLAG_DIRTY               (16)	// local transform changed, the cached world transform is stale
+#define SPRFLAG_VOLATILE            (32)	// local matrix is exposed to lua, never trust the cache
+#define SPRFLAG_UNBOUND             (64)	// the subtree differs from the pack, its bound in pack can't be used for culling
 
 struct material;
 
@@ -21,6 +24,16 @@ struct anchor_data {
 	struct matrix mat;
 };
 
+// World transform (without srt) cached at the last draw.
+// It's valid while the sprite isn't dirty and it's drawn from the same parent transform (by stamp) and frame part.
+struct sprite_world {
+	struct sprite_trans t;	// t.mat points to mat, or NULL
+	struct matrix mat;
+	uint32_t stamp;	// changes when the value of t changes, 0 for never calculated
+	uint32_t parent;	// stamp of the parent transform, 0 for drawn as root
+	const struct pack_part *part;
+};
+
 struct sprite {
 	struct sprite * parent;
 	struct sprite_pack * pack;
@@ -36,6 +49,7 @@ struct sprite {
 		struct matrix *mat;
 	} s;
 	struct matrix mat;
+	struct sprite_world world;
 	int start_frame;
 	int total_frame;
 	int frame;
@@ -52,6 +66,18 @@ struct sprite {
 	} data;
 };
 
+static inline void
+sprite_dirty(struct sprite *s) {
+	s->flags |= SPRFLAG_DIRTY;
+}
+
+// call it when a sprite is created without sprite_init
+static inline void
+sprite_world_init(struct sprite *s) {
+	s->flags |= SPRFLAG_DIRTY;
+	s->world.stamp = 0;
+}
+
 struct sprite_trans * sprite_trans_mul(struct sprite_trans *a, struct sprite_trans *b, struct sprite_trans *t, struct matrix *tmp_matrix);
 struct sprite_trans * sprite_trans_mul2(struct sprite_pack *pack, struct sprite_trans_data *a, struct sprite_trans *b, struct sprite_trans *t, struct matrix *tmp_matrix);
 void sprite_drawquad(struct pack_picture *picture, const struct srt *srt, const struct sprite_trans *arg);
@@ -77,6 +103,8 @@ int sprite_component(struct sprite *, int index);
 const char * sprite_childname(struct sprite *, int index);
 int sprite_setframe(struct sprite *, int frame, bool force_child);
 void sprite_mount(struct sprite *, int index, struct sprite *);
+// s (may be NULL) and its ancestors can't be culled by the bound in pack any more
+void sprite_unbound(struct sprite *s);
 
 void sprite_aabb(struct sprite *s, struct srt *srt, bool world_aabb, bool ignore_flag, int aabb[4]);
 int sprite_pos(struct sprite *s, struct srt *srt, struct matrix *m, int pos[2]);	// todo: maybe unused, use sprite_matrix instead
@@ -85,6 +113,10 @@ void sprite_matrix(struct sprite *s, struct matrix *mat);
 void sprite_child_matrix(struct sprite * s, const char * childname, struct matrix *mat);
 
 bool sprite_child_visible(struct sprite *s, const char * childname);
+// skip drawing the sprites out of the screen (and scissor), enabled by default
+void sprite_enable_visible_test(bool enable);
+// total number of sprites tested and culled
+void sprite_visible_stat(int *test, int *culled);
 int material_size(int program);
 
 int ejoy2d_sprite(lua_State *L);
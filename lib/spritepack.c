@@ -356,6 +356,162 @@ import_sprite(struct import_stream *is) {
 	}
 }
 
+// bounds
+
+#define BOUND_TODO 0
+#define BOUND_CALC 1
+#define BOUND_DONE 2
+
+static void
+bound_empty(struct pack_bound *b) {
+	b->minx = INT32_MAX;
+	b->miny = INT32_MAX;
+	b->maxx = INT32_MIN;
+	b->maxy = INT32_MIN;
+}
+
+static void
+bound_infinite(struct pack_bound *b) {
+	b->minx = INT32_MIN;
+	b->miny = INT32_MIN;
+	b->maxx = INT32_MAX;
+	b->maxy = INT32_MAX;
+}
+
+static inline int32_t
+bound_clamp(int64_t v) {
+	if (v < INT32_MIN + 1)
+		return INT32_MIN + 1;
+	if (v > INT32_MAX)
+		return INT32_MAX;
+	return (int32_t)v;
+}
+
+static void
+bound_point(struct pack_bound *b, int64_t x, int64_t y) {
+	int32_t xx = bound_clamp(x);
+	int32_t yy = bound_clamp(y);
+	if (xx < b->minx)
+		b->minx = xx;
+	if (xx > b->maxx)
+		b->maxx = xx;
+	if (yy < b->miny)
+		b->miny = yy;
+	if (yy > b->maxy)
+		b->maxy = yy;
+}
+
+static void
+bound_points(struct pack_bound *b, int n, const int32_t *point) {
+	int i;
+	for (i=0;i<n;i++) {
+		bound_point(b, point[i*2], point[i*2+1]);
+	}
+}
+
+// merge the child bound c transformed by mat into b
+static void
+bound_merge(struct pack_bound *b, const struct pack_bound *c, const struct matrix *mat) {
+	if (BOUND_INFINITE(b) || BOUND_EMPTY(c))
+		return;
+	if (BOUND_INFINITE(c)) {
+		bound_infinite(b);
+		return;
+	}
+	if (mat == NULL) {
+		bound_point(b, c->minx, c->miny);
+		bound_point(b, c->maxx, c->maxy);
+		return;
+	}
+	const int *m = mat->m;
+	int64_t x[4] = { c->minx, c->maxx, c->minx, c->maxx };
+	int64_t y[4] = { c->miny, c->miny, c->maxy, c->maxy };
+	int i;
+	for (i=0;i<4;i++) {
+		bound_point(b,
+			(x[i] * m[0] + y[i] * m[2]) / 1024 + m[4],
+			(x[i] * m[1] + y[i] * m[3]) / 1024 + m[5]);
+	}
+}
+
+static const struct pack_bound *
+calc_bound(struct sprite_pack *pack, struct pack_bound *bound, uint8_t *state, int id) {
+	struct pack_bound *b = &bound[id];
+	if (state[id] == BOUND_DONE) {
+		return b;
+	}
+	if (state[id] == BOUND_CALC) {
+		// recursive animation, never cull it
+		bound_infinite(b);
+		return b;
+	}
+	state[id] = BOUND_CALC;
+	bound_empty(b);
+	uint8_t *type = OFFSET_TO_POINTER(uint8_t, pack, pack->type);
+	offset_t *data = OFFSET_TO_POINTER(offset_t, pack, pack->data);
+	int i,j;
+	switch (type[id]) {
+	case TYPE_PICTURE: {
+		struct pack_picture *pp = OFFSET_TO_POINTER(struct pack_picture, pack, data[id]);
+		for (i=0;i<pp->n;i++) {
+			bound_points(b, 4, pp->rect[i].screen_coord);
+		}
+		break;
+	}
+	case TYPE_POLYGON: {
+		struct pack_polygon_data *pp = OFFSET_TO_POINTER(struct pack_polygon_data, pack, data[id]);
+		for (i=0;i<pp->n;i++) {
+			int32_t *sc = OFFSET_TO_POINTER(int32_t, pack, pp->poly[i].screen_coord);
+			bound_points(b, pp->poly[i].n, sc);
+		}
+		break;
+	}
+	case TYPE_LABEL:
+		// the text may be larger than the label box
+		bound_infinite(b);
+		break;
+	case TYPE_ANIMATION: {
+		struct pack_animation *pa = OFFSET_TO_POINTER(struct pack_animation, pack, data[id]);
+		struct pack_frame *pf = OFFSET_TO_POINTER(struct pack_frame, pack, pa->frame);
+		for (i=0;i<pa->frame_number && !BOUND_INFINITE(b);i++) {
+			struct pack_part *part = OFFSET_TO_POINTER(struct pack_part, pack, pf[i].part);
+			for (j=0;j<pf[i].n;j++) {
+				int cid = pa->component[part[j].component_id].id;
+				if (cid == ANCHOR_ID || cid == EXTERNAL_ID) {
+					// draw nothing until something is mounted, see sprite_mount
+					continue;
+				}
+				const struct pack_bound *c = calc_bound(pack, bound, state, cid);
+				bound_merge(b, c, OFFSET_TO_POINTER(struct matrix, pack, part[j].t.mat));
+			}
+		}
+		break;
+	}
+	default:
+		// empty and pannel draw nothing
+		break;
+	}
+	state[id] = BOUND_DONE;
+	return b;
+}
+
+static void
+import_bound(struct sprite_pack *pack, struct pack_bound *bound) {
+	ARRAY(uint8_t, state, pack->n);
+	memset(state, BOUND_TODO, pack->n);
+	int i;
+	for (i=0;i<pack->n;i++) {
+		calc_bound(pack, bound, state, i);
+	}
+}
+
+const struct pack_bound *
+spritepack_bound(struct sprite_pack *pack, int id) {
+	offset_t *data = OFFSET_TO_POINTER(offset_t, pack, pack->data);
+	struct pack_bound *bound = (struct pack_bound *)(data + pack->n);
+	return &bound[id];
+}
+
 /*
 	table/number texture
 	integer maxid
@@ -386,8 +542,9 @@ limport(lua_State *L) {
 
 	struct import_alloc alloc;
 	alloc.L = L;
-	alloc.buffer = (char *)lua_newuserdata(L, size);
-	alloc.cap = size;
+	int bound_size = (max_id + 1) * SIZEOF_BOUND;
+	alloc.buffer = (char *)lua_newuserdata(L, size + bound_size);
+	alloc.cap = size + bound_size;
 
 	struct sprite_pack *pack = (struct sprite_pack *)ialloc(&alloc, SIZEOF_PACK + tex * sizeof(int));
 	pack->n = max_id + 1;
@@ -398,6 +555,7 @@ limport(lua_State *L) {
 	offset_t *data = (offset_t *)ialloc(&alloc, pack->n * sizeof(offset_t));
 	pack->data = POINTER_TO_OFFSET(pack, data);
 	memset(data, 0, pack->n * sizeof(offset_t));
+	struct pack_bound *bound = (struct pack_bound *)ialloc(&alloc, bound_size);
 
 	if (lua_istable(L,1)) {
 		int i;
@@ -430,6 +588,7 @@ limport(lua_State *L) {
 	while (is.size != 0) {
 		import_sprite(&is);
 	}
+	import_bound(pack, bound);
 
 	return 1;
 }
@@ -145,8 +145,23 @@ struct sprite_pack {
 
 #define SIZEOF_PACK (sizeof(struct sprite_pack) - 2 * sizeof(int))
 
+// local aabb of an id in pack, for all the frames
+struct pack_bound {
+	int32_t minx;
+	int32_t miny;
+	int32_t maxx;
+	int32_t maxy;
+};
+
+#define SIZEOF_BOUND (sizeof(struct pack_bound))
+#define BOUND_EMPTY(b) ((b)->minx > (b)->maxx)
+// label draws the text unknown at import
+#define BOUND_INFINITE(b) ((b)->minx == INT32_MIN)
+
 int ejoy2d_spritepack(lua_State *L);
 void dump_pack(struct sprite_pack *pack);
+// the bounds are calculated by import, and placed after the data array (not counted in pack_size)
+const struct pack_bound * spritepack_bound(struct sprite_pack *pack, int id);
 
 #define OFFSET_TO_POINTER(t, pack, off) ((off == 0) ? NULL : (t*)((uintptr_t)(pack) + (off)))
 #define OFFSET_TO_STRING(pack, off) ((const char *)(pack) + (off))
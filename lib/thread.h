@@ -0,0 +1,149 @@
+#ifndef ejoy2d_thread_h
+#define ejoy2d_thread_h
+
+// Minimal thread, mutex and condition variable, pthread or win32.
+// Mutex and condition can be initialized statically with THREAD_MUTEX_INIT / THREAD_COND_INIT.
+
+#ifdef _WIN32
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+
+struct thread_mutex {
+	SRWLOCK lock;
+};
+
+struct thread_cond {
+	CONDITION_VARIABLE cond;
+};
+
+struct thread {
+	HANDLE handle;
+	void (*func)(void *);
+	void *ud;
+};
+
+#define THREAD_MUTEX_INIT { SRWLOCK_INIT }
+#define THREAD_COND_INIT { CONDITION_VARIABLE_INIT }
+
+static inline void
+thread_mutex_lock(struct thread_mutex *m) {
+	AcquireSRWLockExclusive(&m->lock);
+}
+
+static inline void
+thread_mutex_unlock(struct thread_mutex *m) {
+	ReleaseSRWLockExclusive(&m->lock);
+}
+
+static inline void
+thread_cond_wait(struct thread_cond *c, struct thread_mutex *m) {
+	SleepConditionVariableSRW(&c->cond, &m->lock, INFINITE, 0);
+}
+
+static inline void
+thread_cond_signal(struct thread_cond *c) {
+	WakeConditionVariable(&c->cond);
+}
+
+static inline void
+thread_cond_broadcast(struct thread_cond *c) {
+	WakeAllConditionVariable(&c->cond);
+}
+
+static inline DWORD WINAPI
+thread_start_(LPVOID ud) {
+	struct thread *t = (struct thread *)ud;
+	t->func(t->ud);
+	return 0;
+}
+
+// t must stay valid until thread_join
+static inline int
+thread_create(struct thread *t, void (*func)(void *), void *ud) {
+	t->func = func;
+	t->ud = ud;
+	t->handle = CreateThread(NULL, 0, thread_start_, t, 0, NULL);
+	return t->handle == NULL ? -1 : 0;
+}
+
+static inline void
+thread_join(struct thread *t) {
+	WaitForSingleObject(t->handle, INFINITE);
+	CloseHandle(t->handle);
+}
+
+#else
+
+#include <pthread.h>
+
+struct thread_mutex {
+	pthread_mutex_t lock;
+};
+
+struct thread_cond {
+	pthread_cond_t cond;
+};
+
+struct thread {
+	pthread_t id;
+	void (*func)(void *);
+	void *ud;
+};
+
+#define THREAD_MUTEX_INIT { PTHREAD_MUTEX_INITIALIZER }
+#define THREAD_COND_INIT { PTHREAD_COND_INITIALIZER }
+
+static inline void
+thread_mutex_lock(struct thread_mutex *m) {
+	pthread_mutex_lock(&m->lock);
+}
+
+static inline void
+thread_mutex_unlock(struct thread_mutex *m) {
+	pthread_mutex_unlock(&m->lock);
+}
+
+static inline void
+thread_cond_wait(struct thread_cond *c, struct thread_mutex *m) {
+	pthread_cond_wait(&c->cond, &m->lock);
+}
+
+static inline void
+thread_cond_signal(struct thread_cond *c) {
+	pthread_cond_signal(&c->cond);
+}
+
+static inline void
+thread_cond_broadcast(struct thread_cond *c) {
+	pthread_cond_broadcast(&c->cond);
+}
+
+static inline void *
+thread_start_(void *ud) {
+	struct thread *t = (struct thread *)ud;
+	t->func(t->ud);
+	return NULL;
+}
+
+// t must stay valid until thread_join
+static inline int
+thread_create(struct thread *t, void (*func)(void *), void *ud) {
+	t->func = func;
+	t->ud = ud;
+	return pthread_create(&t->id, NULL, thread_start_, t);
+}
+
+static inline void
+thread_join(struct thread *t) {
+	pthread_join(t->id, NULL);
+}
+
+#endif
+
+#endif
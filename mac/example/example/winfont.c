@@ -1,4 +1,5 @@
 #include "label.h"
+#include "bitmap.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -53,13 +54,7 @@ cpy_bitmap(struct bitmap * target, struct bitmap * src, int x, int y) {
 
     tbuf += y0 * target->pitch + x0;
     sbuf += (y0 - y)*src->pitch + x0 - x;
-    int i,j;
-    for (i=0;i<h;i++) {
-        for (j=0;j<w;j++) 
-            tbuf[j] = sbuf[j];
-        sbuf += src->pitch;
-        tbuf += target->pitch;
-    }
+    bitmap_copy(tbuf, target->pitch, sbuf, src->pitch, w, h);
 }
 
 void
@@ -96,11 +91,8 @@ font_size(const char *str, int unicode, struct font_context *ctx) {
 		ctx->w = 0;
 		return;
 	}
+    // the advance is known without rendering, font_glyph renders it
     FT_Load_Glyph(face, glyph_index, FT_LOAD_NO_BITMAP);
-    
-    int err = FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL);
-	if (err)
-        _fault(err, "render failed");
 
     FT_GlyphSlot slot = face->glyph;
 
@@ -112,6 +104,12 @@ void
 font_glyph(const char * str, int unicode, void * buffer, struct font_context *ctx) {
     FT_Face face = ctx->font;
 	FT_GlyphSlot slot = face->glyph;
+    // the glyph loaded by font_size
+    if (slot->format == FT_GLYPH_FORMAT_OUTLINE) {
+        int err = FT_Render_Glyph(slot, FT_RENDER_MODE_NORMAL);
+        if (err)
+            _fault(err, "render failed");
+    }
     FT_Bitmap *bitmap = &(slot->bitmap);
 
     int offx = slot->bitmap_left;
@@ -1,5 +1,6 @@
 #include "label.h"
 #include "array.h"
+#include "bitmap.h"
 #include <windows.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -85,14 +86,7 @@ font_glyph(const char * str, int unicode, void * buffer, struct font_context *ct
 	assert(offx + gm.gmBlackBoxX <= ctx->w);
 	assert(offy + h <= ctx->h);
 
-	int i,j;
-
-	for (i=0;i<h;i++) {
-		for (j=0;j<gm.gmBlackBoxX;j++) {
-			int src = tmp[i*w+j];
-			buf[(i + offy)*ctx->w + j + offx] = src * 255 / 64;
-		}
-	}
+	bitmap_gray64(buf + offy*ctx->w + offx, ctx->w, tmp, w, gm.gmBlackBoxX, h);
 }
 
 
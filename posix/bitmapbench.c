@@ -0,0 +1,219 @@
+// Compare the glyph bitmap kernels in bitmap.h with the plain C loops they replace.
+// usage: make bitmapbench && ./bitmapbench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bitmap.h"
+
+#define ROUND 20000
+
+static double
+now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static unsigned Seed = 1;
+
+static int
+rnd(int n) {
+	Seed = Seed * 1103515245 + 12345;
+	return (Seed >> 8) % n;
+}
+
+// a glyph like bitmap : strokes of 255 with anti-aliased borders, 0 elsewhere
+static void
+glyph(uint8_t *buf, int w, int h, int level) {
+	int i,j;
+	memset(buf, 0, w*h);
+	for (i=1;i<h-1;i++) {
+		for (j=1;j<w-1;j++) {
+			if ((i/4 + j/5) % 3 == 0) {
+				buf[i*w+j] = level;
+			} else if ((i/4 + j/5) % 3 == 1 && rnd(2)) {
+				buf[i*w+j] = rnd(level);
+			}
+		}
+	}
+}
+
+// the old loops
+
+static inline int
+max(int a, int b, int c, int d) {
+	a = a>b ? a : b;
+	a = a>c ? a : c;
+	a = a>d ? a : d;
+	return a;
+}
+
+static void
+gen_outline(int w, int h, uint8_t *buffer, uint8_t *dest) {
+	int i,j;
+	for (i=0;i<h;i++) {
+		uint8_t * output = dest + i*w;
+		uint8_t * line = buffer + i*w;
+		uint8_t * prev;
+		uint8_t * next;
+		if (i==0) {
+			prev = line;
+		} else {
+			prev = line-w;
+		}
+		if (i==h-1) {
+			next = line;
+		} else {
+			next = line+w;
+		}
+		for (j=0;j<w;j++) {
+			int left, right;
+			if (j==0) {
+				left = 0;
+			} else {
+				left = 1;
+			}
+			if (j==w-1) {
+				right = 0;
+			} else {
+				right = 1;
+			}
+			int n1 = max(line[j-left],line[j+right],prev[j],next[j]);
+			int n2 = max(prev[j-left],prev[j+right],next[j-left],next[j+right]);
+			int edge = (n1*3 + n2) / 4;
+			if (line[j] == 0) {
+				output[j] = edge / 2;
+			} else {
+				output[j] = line[j]/2 + 128;
+			}
+		}
+		if (output[0] > 128) {
+			output[0]/=2;
+		}
+		if (output[w-1] > 128) {
+			output[w-1]/=2;
+		}
+	}
+}
+
+static void
+cpy_bitmap(uint8_t *tbuf, int tpitch, const uint8_t *sbuf, int spitch, int w, int h) {
+	int i,j;
+	for (i=0;i<h;i++) {
+		for (j=0;j<w;j++)
+			tbuf[j] = sbuf[j];
+		sbuf += spitch;
+		tbuf += tpitch;
+	}
+}
+
+static void
+gray64(uint8_t *buf, int pitch, const uint8_t *tmp, int tpitch, int w, int h) {
+	int i,j;
+	for (i=0;i<h;i++) {
+		for (j=0;j<w;j++) {
+			int src = tmp[i*tpitch+j];
+			buf[i*pitch + j] = src * 255 / 64;
+		}
+	}
+}
+
+static void
+convert_rgba_to_alpha(int sz, uint32_t * src, uint8_t *dest) {
+	int i;
+	for (i=0;i<sz;i++) {
+		uint8_t alpha = (src[i]>>24) & 0xff;
+		if (alpha == 0xff) {
+			dest[i]=255;
+		} else {
+			dest[i] = alpha / 2;
+		}
+	}
+}
+
+static void
+report(const char *name, int w, int h, double old, double new, int same) {
+	printf("%-8s %3dx%-3d old %8.1f ns  new %8.1f ns  x%.1f  %s\n", name, w, h,
+		old / ROUND, new / ROUND, old / new, same ? "same" : "DIFFERENT");
+}
+
+static int
+bench(int w, int h) {
+	int sz = w * h;
+	uint8_t *src = malloc(sz);
+	uint8_t *a = malloc(sz);
+	uint8_t *b = malloc(sz);
+	uint32_t *rgba = malloc(sz * sizeof(uint32_t));
+	int ok = 1, same, i;
+	double t0, t1, t2;
+
+	glyph(src, w, h, 255);
+	t0 = now();
+	for (i=0;i<ROUND;i++) gen_outline(w, h, src, a);
+	t1 = now();
+	for (i=0;i<ROUND;i++) bitmap_outline(w, h, src, b);
+	t2 = now();
+	same = memcmp(a, b, sz) == 0;
+	ok &= same;
+	report("outline", w, h, t1-t0, t2-t1, same);
+
+	// a glyph into a wider target, as FT_Bitmap into the font context
+	int sw = w - 3, sh = h - 2;
+	t0 = now();
+	for (i=0;i<ROUND;i++) cpy_bitmap(a + w + 1, w, src, sw, sw, sh);
+	t1 = now();
+	for (i=0;i<ROUND;i++) bitmap_copy(b + w + 1, w, src, sw, sw, sh);
+	t2 = now();
+	same = memcmp(a, b, sz) == 0;
+	ok &= same;
+	report("copy", sw, sh, t1-t0, t2-t1, same);
+
+	glyph(src, w, h, 64);
+	t0 = now();
+	for (i=0;i<ROUND;i++) gray64(a, w, src, w, w, h);
+	t1 = now();
+	for (i=0;i<ROUND;i++) bitmap_gray64(b, w, src, w, w, h);
+	t2 = now();
+	same = memcmp(a, b, sz) == 0;
+	ok &= same;
+	report("gray64", w, h, t1-t0, t2-t1, same);
+
+	for (i=0;i<sz;i++) {
+		rgba[i] = (uint32_t)(rnd(3) == 0 ? 255 : rnd(256)) << 24 | rnd(0x1000000);
+	}
+	t0 = now();
+	for (i=0;i<ROUND;i++) convert_rgba_to_alpha(sz, rgba, a);
+	t1 = now();
+	for (i=0;i<ROUND;i++) bitmap_alpha(b, rgba, sz);
+	t2 = now();
+	same = memcmp(a, b, sz) == 0;
+	ok &= same;
+	report("alpha", w, h, t1-t0, t2-t1, same);
+
+	free(src);
+	free(a);
+	free(b);
+	free(rgba);
+	return ok;
+}
+
+int
+main() {
+#if defined(BITMAP_SSE2)
+	printf("kernels : sse2\n");
+#elif defined(BITMAP_NEON)
+	printf("kernels : neon\n");
+#else
+	printf("kernels : scalar\n");
+#endif
+	// glyphs of the label atlas (FONT_SIZE 31 + 1) : narrow ones as 'i' or '1', wide ones, with sdf padding, and large ones
+	int size[][2] = { {6,32}, {9,32}, {13,32}, {17,17}, {17,32}, {24,32}, {32,32}, {40,40}, {64,64} };
+	int ok = 1;
+	int i;
+	for (i=0;i<(int)(sizeof(size)/sizeof(size[0]));i++) {
+		ok &= bench(size[i][0], size[i][1]);
+	}
+	return ok ? 0 : 1;
+}
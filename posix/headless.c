@@ -0,0 +1,92 @@
+// Run a script without window or GL context, on the null render backend.
+// usage: ej2d [-frames n] [-log cmdlog.txt] script.lua
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "winfw.h"
+#include "shader.h"
+#include "nullrender.h"
+#include "sprite.h"
+
+void font_init();
+
+static void
+usage(const char *name) {
+	fprintf(stderr, "usage: %s [-frames n] [-log file] script.lua ...\n", name);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[]) {
+	int frames = 60;
+	FILE * cmdlog = NULL;
+	int i = 1;
+	while (i < argc && argv[i][0] == '-') {
+		if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
+			frames = atoi(argv[i+1]);
+		} else if (strcmp(argv[i], "-log") == 0 && i + 1 < argc) {
+			cmdlog = fopen(argv[i+1], "w");
+			if (cmdlog == NULL) {
+				fprintf(stderr, "can't open %s\n", argv[i+1]);
+				return 1;
+			}
+		} else {
+			usage(argv[0]);
+		}
+		i += 2;
+	}
+	if (i >= argc)
+		usage(argv[0]);
+
+	render_null_setlog(cmdlog);
+	font_init();
+
+	// ejoy2d_win_init takes the script as argv[1]
+	argv[i-1] = argv[0];
+	ejoy2d_win_init(argc - i + 1, argv + i - 1);
+
+	struct render_stat total;
+	memset(&total, 0, sizeof(total));
+	int batch = 0;
+	int saved = 0;
+	int f;
+	for (f=0;f<frames;f++) {
+		if (cmdlog) {
+			fprintf(cmdlog, "frame %d\n", f);
+		}
+		ejoy2d_win_update();
+		ejoy2d_win_frame();
+
+		struct render_stat stat;
+		shader_getstat(&stat);
+		batch += drawcall_count();
+		saved += drawcall_saved();
+		total.drawcall += stat.drawcall;
+		total.primitive += stat.primitive;
+		total.state_change += stat.state_change;
+		total.buffer_upload += stat.buffer_upload;
+		total.texture_upload += stat.texture_upload;
+		total.fence_wait += stat.fence_wait;
+	}
+
+	printf("frames %d\n", frames);
+	if (frames > 0) {
+		printf("batch %d (%.1f/frame)\n", batch, (float)batch / frames);
+		printf("batch saved %d\n", saved);
+		printf("drawcall %d (%.1f/frame)\n", total.drawcall, (float)total.drawcall / frames);
+		printf("primitive %d (%.1f/frame)\n", total.primitive, (float)total.primitive / frames);
+		printf("state_change %d (%.1f/frame)\n", total.state_change, (float)total.state_change / frames);
+		printf("buffer_upload %d bytes\n", total.buffer_upload);
+		printf("texture_upload %d bytes\n", total.texture_upload);
+		printf("fence_wait %d\n", total.fence_wait);
+		int test, culled;
+		sprite_visible_stat(&test, &culled);
+		printf("visible_test %d culled %d\n", test, culled);
+	}
+
+	if (cmdlog) {
+		fclose(cmdlog);
+	}
+	return 0;
+}
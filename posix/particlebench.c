@@ -0,0 +1,344 @@
+// Compare the particle update of particle.c (struct of arrays) with the array of structs code it replaces.
+// usage: make particlebench && ./particlebench [particles]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "particle.h"
+
+#define FRAMES 200
+
+static double
+now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// the old particle system
+
+struct old_particle {
+	struct point pos;
+	struct point startPos;
+	struct matrix emitMatrix;
+
+	struct color4f color;
+	struct color4f deltaColor;
+	uint32_t color_val;
+
+	float size;
+	float deltaSize;
+
+	float rotation;
+	float deltaRotation;
+
+	float timeToLive;
+
+	union {
+		struct {
+			struct point dir;
+			float radialAccel;
+			float tangentialAccel;
+		} A;
+		struct {
+			float angle;
+			float degreesPerSecond;
+			float radius;
+			float deltaRadius;
+		} B;
+	} mode;
+};
+
+struct old_system {
+	int particleCount;
+	struct old_particle *particles;
+	struct particle_config *config;
+};
+
+static void
+_normalize_point(struct point *p, struct point *out) {
+	float l2 = p->x * p->x + p->y *p->y;
+	if (l2 == 0) {
+		out->x = 1.0f;
+		out->y = 0;
+	} else {
+		float len = sqrtf(l2);
+		out->x = p->x/len;
+		out->y = p->y/len;
+	}
+}
+
+static void
+_update_particle(struct old_system *ps, struct old_particle *p, float dt) {
+	if (ps->config->positionType != POSITION_TYPE_GROUPED) {
+		p->startPos = ps->config->sourcePosition;
+	}
+	if (ps->config->emitterMode == PARTICLE_MODE_GRAVITY) {
+		struct point tmp, radial, tangential;
+
+		radial.x = 0;
+		radial.y = 0;
+		if (p->pos.x || p->pos.y) {
+			_normalize_point(&p->pos, &radial);
+		}
+		tangential = radial;
+		radial.x *= p->mode.A.radialAccel;
+		radial.y *= p->mode.A.radialAccel;
+
+		float newy = tangential.x;
+		tangential.x = -tangential.y * p->mode.A.tangentialAccel;
+		tangential.y = newy * p->mode.A.tangentialAccel;
+
+		tmp.x = radial.x + tangential.x + ps->config->mode.A.gravity.x;
+		tmp.y = radial.y + tangential.y + ps->config->mode.A.gravity.y;
+		tmp.x *= dt;
+		tmp.y *= dt;
+		p->mode.A.dir.x += tmp.x;
+		p->mode.A.dir.y += tmp.y;
+		tmp.x = p->mode.A.dir.x * dt;
+		tmp.y = p->mode.A.dir.y * dt;
+		p->pos.x += tmp.x;
+		p->pos.y += tmp.y;
+	} else {
+		p->mode.B.angle += p->mode.B.degreesPerSecond * dt;
+		p->mode.B.radius += p->mode.B.deltaRadius * dt;
+
+		p->pos.x = - cosf(p->mode.B.angle) * p->mode.B.radius;
+		p->pos.y = - sinf(p->mode.B.angle) * p->mode.B.radius;
+	}
+
+	p->size += (p->deltaSize * dt);
+	if (p->size < 0)
+		p->size = 0;
+
+	p->color.r += (p->deltaColor.r * dt);
+	p->color.g += (p->deltaColor.g * dt);
+	p->color.b += (p->deltaColor.b * dt);
+	p->color.a += (p->deltaColor.a * dt);
+
+	p->rotation += (p->deltaRotation * dt);
+}
+
+static void
+_remove_particle(struct old_system *ps, int idx) {
+	if ( idx != ps->particleCount-1) {
+		ps->particles[idx] = ps->particles[ps->particleCount-1];
+	}
+	--ps->particleCount;
+}
+
+static void
+old_update(struct old_system *ps, float dt) {
+	int i = 0;
+	while (i < ps->particleCount) {
+		struct old_particle *p = &ps->particles[i];
+		p->timeToLive -= dt;
+		if (p->timeToLive > 0) {
+			_update_particle(ps,p,dt);
+			if (p->size <= 0) {
+				_remove_particle(ps, i);
+			} else {
+				++i;
+			}
+		} else {
+			_remove_particle(ps, i);
+		}
+	}
+}
+
+// the old system starts from the particles the new one emitted
+static void
+load_old(struct old_system *old, struct particle_system *ps) {
+	float **a = ps->attrib;
+	int i;
+	for (i=0;i<ps->particleCount;i++) {
+		struct old_particle *p = &old->particles[i];
+		p->pos.x = a[PA_X][i];
+		p->pos.y = a[PA_Y][i];
+		p->startPos.x = a[PA_START_X][i];
+		p->startPos.y = a[PA_START_Y][i];
+		p->emitMatrix = ps->emitMatrix[i];
+		p->color.r = a[PA_R][i];
+		p->color.g = a[PA_G][i];
+		p->color.b = a[PA_B][i];
+		p->color.a = a[PA_A][i];
+		p->deltaColor.r = a[PA_DELTA_R][i];
+		p->deltaColor.g = a[PA_DELTA_G][i];
+		p->deltaColor.b = a[PA_DELTA_B][i];
+		p->deltaColor.a = a[PA_DELTA_A][i];
+		p->size = a[PA_SIZE][i];
+		p->deltaSize = a[PA_DELTA_SIZE][i];
+		p->rotation = a[PA_ROTATION][i];
+		p->deltaRotation = a[PA_DELTA_ROTATION][i];
+		p->timeToLive = a[PA_TIME_TO_LIVE][i];
+		if (ps->config->emitterMode == PARTICLE_MODE_GRAVITY) {
+			p->mode.A.dir.x = a[PA_DIR_X][i];
+			p->mode.A.dir.y = a[PA_DIR_Y][i];
+			p->mode.A.radialAccel = a[PA_RADIAL_ACCEL][i];
+			p->mode.A.tangentialAccel = a[PA_TANGENTIAL_ACCEL][i];
+		} else {
+			p->mode.B.angle = a[PA_ANGLE][i];
+			p->mode.B.degreesPerSecond = a[PA_DEGREES_PER_SECOND][i];
+			p->mode.B.radius = a[PA_RADIUS][i];
+			p->mode.B.deltaRadius = a[PA_DELTA_RADIUS][i];
+		}
+	}
+	old->particleCount = ps->particleCount;
+}
+
+// compare the particles, the order is different
+
+struct state {
+	float v[6];	// time to live, x, y, size, alpha, rotation
+};
+
+static int
+state_compar(const void *a, const void *b) {
+	const struct state *s1 = a;
+	const struct state *s2 = b;
+	int i;
+	for (i=0;i<6;i++) {
+		if (s1->v[i] != s2->v[i])
+			return s1->v[i] < s2->v[i] ? -1 : 1;
+	}
+	return 0;
+}
+
+static float
+compare(struct particle_system *ps, struct old_system *old) {
+	int n = ps->particleCount;
+	if (n != old->particleCount)
+		return INFINITY;
+	struct state *s1 = malloc(n * sizeof(struct state));
+	struct state *s2 = malloc(n * sizeof(struct state));
+	int i,j;
+	for (i=0;i<n;i++) {
+		struct old_particle *p = &old->particles[i];
+		struct state s1i = {{ ps->attrib[PA_TIME_TO_LIVE][i], ps->attrib[PA_X][i], ps->attrib[PA_Y][i], ps->attrib[PA_SIZE][i], ps->attrib[PA_A][i], ps->attrib[PA_ROTATION][i] }};
+		struct state s2i = {{ p->timeToLive, p->pos.x, p->pos.y, p->size, p->color.a, p->rotation }};
+		s1[i] = s1i;
+		s2[i] = s2i;
+	}
+	qsort(s1, n, sizeof(struct state), state_compar);
+	qsort(s2, n, sizeof(struct state), state_compar);
+	float diff = 0;
+	for (i=0;i<n;i++) {
+		for (j=0;j<6;j++) {
+			float d = fabsf(s1[i].v[j] - s2[i].v[j]);
+			if (d > diff)
+				diff = d;
+		}
+	}
+	free(s1);
+	free(s2);
+	return diff;
+}
+
+static void
+config(struct particle_config *c, int mode, int n) {
+	memset(c, 0, sizeof(*c));
+	c->emitterMode = mode;
+	c->totalParticles = n;
+	c->duration = DURATION_INFINITY;
+	c->life = 3.0f;
+	c->lifeVar = 1.0f;
+	c->emissionRate = c->life / n;
+	c->posVar.x = 20;
+	c->posVar.y = 20;
+	c->angle = 90;
+	c->angleVar = 30;
+	c->startSize = 32;
+	c->startSizeVar = 8;
+	c->endSize = 4;
+	c->endSizeVar = 2;
+	c->startColor.r = c->startColor.g = c->startColor.b = c->startColor.a = 1.0f;
+	c->startColorVar.r = 0.2f;
+	c->endColor.a = 0;
+	c->startSpin = 0;
+	c->endSpin = 360;
+	c->endSpinVar = 90;
+	c->positionType = POSITION_TYPE_RELATIVE;
+	if (mode == PARTICLE_MODE_GRAVITY) {
+		c->mode.A.gravity.y = -100;
+		c->mode.A.speed = 120;
+		c->mode.A.speedVar = 40;
+		c->mode.A.radialAccel = 10;
+		c->mode.A.radialAccelVar = 5;
+		c->mode.A.tangentialAccel = 20;
+		c->mode.A.tangentialAccelVar = 10;
+	} else {
+		c->mode.B.startRadius = 200;
+		c->mode.B.startRadiusVar = 50;
+		c->mode.B.endRadius = 10;
+		c->mode.B.rotatePerSecond = 180;
+		c->mode.B.rotatePerSecondVar = 90;
+	}
+}
+
+static int
+bench(int mode, int n) {
+	const float dt = 1.0f / 60;
+	struct particle_config cfg;
+	config(&cfg, mode, n);
+
+	size_t sz = particle_system_size(n);
+	struct particle_system *ps = malloc(sz);
+	memset(ps, 0, sz);
+	struct particle_config *shared = particle_config_new();
+	*shared = cfg;
+	init_with_particles(ps, n, shared);
+	particle_config_release(shared);
+	particle_system_reset(ps);
+
+	// emit all the particles at once, then run the frames from the same state without emitting
+	ps->emitCounter = cfg.life;
+	particle_system_update(ps, 0);
+	ps->isActive = false;
+
+	struct old_system old;
+	memset(&old, 0, sizeof(old));
+	old.particles = calloc(n, sizeof(struct old_particle));
+	old.config = &cfg;
+	load_old(&old, ps);
+
+	int i;
+	double t0, t_old, t_new;
+	t0 = now();
+	for (i=1;i<FRAMES;i++) {
+		old_update(&old, dt);
+	}
+	t_old = now() - t0;
+	t0 = now();
+	for (i=1;i<FRAMES;i++) {
+		particle_system_update(ps, dt);
+	}
+	t_new = now() - t0;
+	float diff = compare(ps, &old);
+
+	printf("%-8s %6d particles  old %6.3f ms  new %6.3f ms  x%.1f  (%d alive, max diff %g)\n",
+		mode == PARTICLE_MODE_GRAVITY ? "gravity" : "radius", n,
+		t_old / (FRAMES-1), t_new / (FRAMES-1), t_old / t_new, ps->particleCount, diff);
+
+	particle_system_config(ps, NULL);
+	free(ps);
+	free(old.particles);
+	// positions are in pixels, the sin/cos of the radius mode is an approximation
+	return diff < 0.01f;
+}
+
+int
+main(int argc, char *argv[]) {
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(PARTICLE_SCALAR)
+	printf("kernels : sse2\n");
+#elif (defined(__aarch64__) || defined(_M_ARM64)) && !defined(PARTICLE_SCALAR)
+	printf("kernels : neon\n");
+#else
+	printf("kernels : scalar\n");
+#endif
+	int n = argc > 1 ? atoi(argv[1]) : 100000;
+	int ok = bench(PARTICLE_MODE_GRAVITY, n);
+	ok &= bench(PARTICLE_MODE_RADIUS, n);
+	return ok ? 0 : 1;
+}
@@ -1,4 +1,5 @@
 #include "label.h"
+#include "bitmap.h"
 #include <X11/Xlib.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,6 +8,7 @@
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_GLYPH_H
+#include FT_SIZES_H
 
 FT_Library  library;
 
@@ -54,17 +56,47 @@ cpy_bitmap(struct bitmap * target, struct bitmap * src, int x, int y) {
 
     tbuf += y0 * target->pitch + x0;
     sbuf += (y0 - y)*src->pitch + x0 - x;
-    int i,j;
-    for (i=0;i<h;i++) {
-        for (j=0;j<w;j++) 
-            tbuf[j] = sbuf[j];
-        sbuf += src->pitch;
-        tbuf += target->pitch;
+    bitmap_copy(tbuf, target->pitch, sbuf, src->pitch, w, h);
+}
+
+// The face is opened once and kept, with an FT_Size for each pixel size.
+// font_create/font_release only take and drop a reference.
+
+#define MAX_SIZE 16
+
+struct face_size {
+    int pixel;
+    int ref;
+    unsigned last;
+    FT_Size size;
+};
+
+struct face_cache {
+    const char *path;
+    FT_Face face;
+    unsigned clock;
+    int n;
+    struct face_size size[MAX_SIZE];
+};
+
+static struct face_cache FC;
+
+static void
+face_close() {
+    if (FC.face) {
+        FT_Done_Face(FC.face);  // it releases all the sizes
     }
+    FC.path = NULL;
+    FC.face = NULL;
+    FC.n = 0;
 }
 
-void
-font_create(int font_size, struct font_context *ctx) {
+static FT_Face
+face_open() {
+    if (FC.face && FC.path == TTFONT) {
+        return FC.face;
+    }
+    face_close();
     FT_Face face;
     int err = FT_New_Face(library, TTFONT, 0, &face);
     if (err) {
@@ -73,35 +105,81 @@ font_create(int font_size, struct font_context *ctx) {
         else
             _fault(err, "new face failed");
     }
+    FC.path = TTFONT;
+    FC.face = face;
+    return face;
+}
 
-    err = FT_Set_Pixel_Sizes(face,0,font_size);
-
+static struct face_size *
+face_size(FT_Face face, int pixel) {
+    int i;
+    struct face_size *fs = NULL;
+    for (i=0;i<FC.n;i++) {
+        if (FC.size[i].pixel == pixel) {
+            fs = &FC.size[i];
+            fs->last = ++FC.clock;
+            return fs;
+        }
+    }
+    if (FC.n < MAX_SIZE) {
+        fs = &FC.size[FC.n++];
+    } else {
+        // reuse the least recently used size which isn't in use
+        for (i=0;i<MAX_SIZE;i++) {
+            struct face_size *s = &FC.size[i];
+            if (s->ref == 0 && (fs == NULL || s->last < fs->last)) {
+                fs = s;
+            }
+        }
+        if (fs == NULL)
+            _fault(0, "too many font sizes in use");
+        FT_Done_Size(fs->size);
+    }
+    int err = FT_New_Size(face, &fs->size);
+    if (err)
+        _fault(err, "new size failed");
+    FT_Activate_Size(fs->size);
+    err = FT_Set_Pixel_Sizes(face,0,pixel);
     if (err)
         _fault(err, "set char size failed");
-    
+    fs->pixel = pixel;
+    fs->ref = 0;
+    fs->last = ++FC.clock;
+    return fs;
+}
+
+void
+font_create(int font_size, struct font_context *ctx) {
+    FT_Face face = face_open();
+    struct face_size *fs = face_size(face, font_size);
+    ++fs->ref;
+
     ctx->font = face;
-    ctx->ascent = face->size->metrics.ascender >>6;
-    ctx->h = face->size->metrics.height >> 6;
+    ctx->dc = fs;
+    ctx->ascent = fs->size->metrics.ascender >>6;
+    ctx->h = fs->size->metrics.height >> 6;
 }
 
 void
 font_release(struct font_context *ctx) {
-    FT_Done_Face(ctx->font);
+    struct face_size *fs = ctx->dc;
+    --fs->ref;
 }
 
 void 
 font_size(const char *str, int unicode, struct font_context *ctx) {
     FT_Face face = ctx->font;
+    struct face_size *fs = ctx->dc;
+    if (face->size != fs->size) {
+        FT_Activate_Size(fs->size);
+    }
     FT_UInt glyph_index = FT_Get_Char_Index(face, unicode);
     if (!glyph_index) {
         ctx->w = 0;
         return;
 	  }
+    // the advance is known without rendering, font_glyph renders it
     FT_Load_Glyph(face, glyph_index, FT_LOAD_NO_BITMAP);
-    
-    int err = FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL);
-    if (err)
-        _fault(err, "render failed");
 
     FT_GlyphSlot slot = face->glyph;
 
@@ -113,6 +191,12 @@ void
 font_glyph(const char * str, int unicode, void * buffer, struct font_context *ctx) {
     FT_Face face = ctx->font;
 	FT_GlyphSlot slot = face->glyph;
+    // the glyph loaded by font_size
+    if (slot->format == FT_GLYPH_FORMAT_OUTLINE) {
+        int err = FT_Render_Glyph(slot, FT_RENDER_MODE_NORMAL);
+        if (err)
+            _fault(err, "render failed");
+    }
     FT_Bitmap *bitmap = &(slot->bitmap);
 
     int offx = slot->bitmap_left;
@@ -133,6 +217,10 @@ font_glyph(const char * str, int unicode, void * buffer, struct font_context *ct
 
 void
 font_init() {
+    const char * path = getenv("EJOY2D_FONT");
+    if (path) {
+        TTFONT = path;
+    }
     if (FT_Init_FreeType(&library)) {
         printf("font init failed");
     }